@@ -0,0 +1,657 @@
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <atomic>
+#include <stdexcept>
+#include "bst.h"
+#include "avlbst.h"
+#include "test_check.h"
+
+using namespace std;
+
+typedef AVLTree<int, int> Tree;
+typedef map<int, int> Model;
+
+// Reads the protected root of any tree, for the structural checks
+template<class Key, class Value, class Augment>
+struct RootAccess : public BinarySearchTree<Key, Value, Augment>
+{
+    static Node<Key, Value, Augment>* of(const BinarySearchTree<Key, Value, Augment>& tree)
+    {
+        return tree.*(&RootAccess::root_);
+    }
+};
+
+// Checks the links, key order and balance factors of the subtree under n
+// and returns its height
+template<class Key, class Value, class Augment>
+int checkAVLSubtree(AVLNode<Key, Value, Augment>* n, AVLNode<Key, Value, Augment>* parent)
+{
+    if(n == NULL) {
+        return 0;
+    }
+    CHECK(n->getParent() == parent);
+    int left = checkAVLSubtree(n->getLeft(), n);
+    int right = checkAVLSubtree(n->getRight(), n);
+    if(n->getLeft() != NULL) {
+        CHECK(n->getLeft()->getKey() < n->getKey());
+    }
+    if(n->getRight() != NULL) {
+        CHECK(n->getKey() < n->getRight()->getKey());
+    }
+    CHECK(n->getBalance() == right - left);
+    CHECK(abs(right - left) <= 1);
+    return 1 + max(left, right);
+}
+
+// Checks tree against model: structure, contents in both directions, and
+// the O(1) and O(log n) summaries against a full recount
+template<class Augment>
+void checkSame(const AVLTree<int, int, Augment>& tree, const Model& model)
+{
+    AVLNode<int, int, Augment>* root =
+        static_cast<AVLNode<int, int, Augment>*>(RootAccess<int, int, Augment>::of(tree));
+    int height = checkAVLSubtree(root, static_cast<AVLNode<int, int, Augment>*>(NULL));
+    TreeStats stats = tree.stats();
+    CHECK(tree.height() == height);
+    CHECK(stats.height == height);
+    CHECK(stats.imbalancedNodes == 0);
+    CHECK(stats.nodes == model.size());
+    CHECK(tree.size() == model.size());
+    CHECK(tree.empty() == model.empty());
+
+    Model::const_iterator expected = model.begin();
+    for(typename AVLTree<int, int, Augment>::iterator it = tree.begin(); it != tree.end(); ++it, ++expected) {
+        CHECK(expected != model.end());
+        CHECK(it->first == expected->first && it->second == expected->second);
+    }
+    CHECK(expected == model.end());
+    Model::const_reverse_iterator back = model.rbegin();
+    for(typename AVLTree<int, int, Augment>::reverse_iterator it = tree.rbegin(); it != tree.rend(); ++it, ++back) {
+        CHECK(back != model.rend());
+        CHECK(it->first == back->first);
+    }
+    CHECK(back == model.rend());
+    if(!model.empty()) {
+        CHECK(tree.front().first == model.begin()->first);
+        CHECK(tree.back().first == model.rbegin()->first);
+    }
+}
+
+// Checks that every SubtreeSize aggregate under n counts its subtree and
+// returns the count
+template<class Key, class Value>
+size_t checkSizes(Node<Key, Value, SubtreeSize>* n)
+{
+    if(n == NULL) {
+        return 0;
+    }
+    size_t count = checkSizes(n->getLeft()) + 1 + checkSizes(n->getRight());
+    CHECK(n->getAugment() == count);
+    return count;
+}
+
+// Checks that the aggregate in every node under n combines the items of
+// its subtree in key order, and returns the subtree's aggregate
+template<class Augment>
+typename Augment::value_type checkAugment(Node<int, int, Augment>* n)
+{
+    if(n == NULL) {
+        return Augment::identity();
+    }
+    typename Augment::value_type own = Augment::template lift<int, int>(n->getKey(), n->getValue());
+    typename Augment::value_type expected =
+        Augment::combine(Augment::combine(checkAugment(n->getLeft()), own), checkAugment(n->getRight()));
+    CHECK(n->getAugment() == expected);
+    return expected;
+}
+
+// Every way of inserting and removing, mixed at random over a small key
+// space so keys are often already present, with the whole tree checked
+// after every change
+void testRandomOps()
+{
+    mt19937 rng(16);
+    for(int round = 0; round < 20; ++round) {
+        Tree tree;
+        Model model;
+        for(int op = 0; op < 1500; ++op) {
+            int key = static_cast<int>(rng() % 400);
+            int value = static_cast<int>(rng());
+            switch(rng() % 9) {
+            case 0:
+                tree.insert(make_pair(key, value));
+                model[key] = value;
+                break;
+            case 1:
+                CHECK(tree.insert_or_assign(key, value).second == (model.count(key) == 0));
+                model[key] = value;
+                break;
+            case 2:
+                CHECK(tree.try_emplace(key, value).second == model.insert(make_pair(key, value)).second);
+                break;
+            case 3:
+                CHECK(tree.emplace(key, value).second == model.insert(make_pair(key, value)).second);
+                break;
+            case 4: {
+                Tree::iterator hint = tree.lower_bound(key);
+                tree.insert(hint, make_pair(key, value));
+                model[key] = value;
+                break;
+            }
+            case 5:
+                if(!model.empty()) {
+                    tree.pop_min();
+                    model.erase(model.begin());
+                }
+                break;
+            case 6:
+                if(!model.empty()) {
+                    tree.pop_max();
+                    model.erase(--model.end());
+                }
+                break;
+            default:
+                tree.remove(key);
+                model.erase(key);
+                break;
+            }
+            checkSame(tree, model);
+        }
+        tree.clear();
+        model.clear();
+        checkSame(tree, model);
+    }
+}
+
+// Sorted and reverse-sorted runs, which drive rotations along one spine
+void testSortedRuns()
+{
+    Tree tree;
+    Model model;
+    for(int i = 0; i < 5000; ++i) {
+        tree.insert(make_pair(i, i));
+        model[i] = i;
+    }
+    checkSame(tree, model);
+    for(int i = -1; i > -5000; --i) {
+        tree.insert(make_pair(i, i));
+        model[i] = i;
+    }
+    checkSame(tree, model);
+    for(int i = -4999; i < 5000; i += 2) {
+        tree.remove(i);
+        model.erase(i);
+    }
+    checkSame(tree, model);
+}
+
+// Every insertion and construction entry point called through a
+// BinarySearchTree reference must still build and rebalance AVLNodes
+void testThroughBase()
+{
+    Tree tree;
+    BinarySearchTree<int, int>& base = tree;
+    Model model;
+    mt19937 rng(4);
+    for(int op = 0; op < 3000; ++op) {
+        int key = static_cast<int>(rng() % 1000);
+        int value = static_cast<int>(rng());
+        switch(op % 6) {
+        case 0:
+            base.insert_or_assign(key, value);
+            model[key] = value;
+            break;
+        case 1:
+            base.try_emplace(key, value);
+            model.insert(make_pair(key, value));
+            break;
+        case 2:
+            base.emplace(key, value);
+            model.insert(make_pair(key, value));
+            break;
+        case 3:
+            base.insert(base.upper_bound(key), make_pair(key, value));
+            model[key] = value;
+            break;
+        case 4:
+            base.insert(make_pair(key, value));
+            model[key] = value;
+            break;
+        default:
+            base.remove(key);
+            model.erase(key);
+            break;
+        }
+    }
+    checkSame(tree, model);
+
+    vector<pair<int, int> > sorted(model.begin(), model.end());
+    base.buildFromSorted(sorted.begin(), sorted.end());
+    checkSame(tree, model);
+    base.parallelBuild(sorted.rbegin(), sorted.rend(), 2);
+    checkSame(tree, model);
+
+    Tree other;
+    Model otherModel;
+    for(int i = 0; i < 2000; i += 3) {
+        other.insert(make_pair(i, -i));
+        otherModel.insert(make_pair(i, -i));
+    }
+    base.merge(other);
+    model.insert(otherModel.begin(), otherModel.end());
+    checkSame(tree, model);
+    CHECK(other.empty());
+
+    // a move through the base leaves the height unknown until height()
+    // recounts it; updates before and after that must both be right
+    BinarySearchTree<int, int>& otherBase = other;
+    otherBase = std::move(base);
+    for(int i = 2000; i < 2500; ++i) {
+        other.insert(make_pair(i, i));
+        model[i] = i;
+    }
+    checkSame(other, model);
+    for(int i = 0; i < 1000; i += 2) {
+        other.remove(i);
+        model.erase(i);
+    }
+    checkSame(other, model);
+}
+
+// merge() and union_with() on trees of every relative size, with key
+// ranges that are disjoint, interleaved or overlapping, against the union
+// of the models; the aggregates of the merged tree must be rebuilt, and
+// both trees must stay usable afterwards
+void testMerge()
+{
+    typedef AVLTree<int, int, WithSize<Sum<long long> > > SumTree;
+    static const size_t SIZES[] = { 0, 1, 2, 7, 100, 2000 };
+    static const size_t SIZE_COUNT = sizeof(SIZES) / sizeof(SIZES[0]);
+    mt19937 rng(8);
+    for(int round = 0; round < 120; ++round) {
+        SumTree tree;
+        SumTree other;
+        Model model;
+        Model otherModel;
+        size_t count = SIZES[rng() % SIZE_COUNT];
+        size_t otherCount = SIZES[rng() % SIZE_COUNT];
+        // the other tree's keys start anywhere from well below to well
+        // above this tree's, and are spaced one, two or three apart
+        int offset = static_cast<int>(rng() % 6000) - 3000;
+        int stride = 1 + static_cast<int>(rng() % 3);
+        for(size_t i = 0; i < count; ++i) {
+            int key = static_cast<int>(rng() % 4000);
+            tree.insert(make_pair(key, key));
+            model[key] = key;
+        }
+        for(size_t i = 0; i < otherCount; ++i) {
+            int key = offset + stride * static_cast<int>(rng() % 2000);
+            other.insert(make_pair(key, -key));
+            otherModel[key] = -key;
+        }
+        switch(round % 3) {
+        case 0:
+            tree.merge(other);
+            model.insert(otherModel.begin(), otherModel.end());
+            break;
+        case 1:
+            tree.union_with(other, TakeIncoming());
+            for(Model::const_iterator it = otherModel.begin(); it != otherModel.end(); ++it) {
+                model[it->first] = it->second;
+            }
+            break;
+        default:
+            tree.union_with(other, [](int& existing, int& incoming) { existing += 2 * incoming + 1; });
+            for(Model::const_iterator it = otherModel.begin(); it != otherModel.end(); ++it) {
+                Model::iterator found = model.find(it->first);
+                if(found == model.end()) {
+                    model.insert(*it);
+                }
+                else {
+                    found->second += 2 * it->second + 1;
+                }
+            }
+            break;
+        }
+        checkSame(tree, model);
+        checkSame(other, Model());
+        checkAugment(RootAccess<int, int, WithSize<Sum<long long> > >::of(tree));
+        long long sum = 0;
+        for(Model::const_iterator it = model.begin(); it != model.end(); ++it) {
+            sum += it->second;
+        }
+        CHECK(tree.aggregate().first == model.size());
+        CHECK(tree.aggregate().second == sum);
+
+        otherModel.clear();
+        for(int i = 0; i < 50; ++i) {
+            int key = static_cast<int>(rng() % 8000) - 4000;
+            tree.insert(make_pair(key, i));
+            model[key] = i;
+            other.insert(make_pair(key, i));
+            otherModel[key] = i;
+        }
+        checkSame(tree, model);
+        checkSame(other, otherModel);
+        checkAugment(RootAccess<int, int, WithSize<Sum<long long> > >::of(tree));
+    }
+
+    // a plain tree can only reach an AVLTree's merge through a base
+    // reference, and the other way round; its items are copied across
+    typedef BinarySearchTree<int, int, WithSize<Sum<long long> > > PlainTree;
+    for(int round = 0; round < 20; ++round) {
+        SumTree tree;
+        PlainTree plain;
+        Model model;
+        Model plainModel;
+        for(int i = 0; i < 300; ++i) {
+            int key = static_cast<int>(rng() % 1000);
+            tree.insert(make_pair(key, key));
+            model[key] = key;
+            key = static_cast<int>(rng() % 1000);
+            plain.insert(make_pair(key, -key));
+            plainModel[key] = -key;
+        }
+        PlainTree& base = tree;
+        if(round % 2 == 0) {
+            base.union_with(plain, TakeIncoming());
+            for(Model::const_iterator it = plainModel.begin(); it != plainModel.end(); ++it) {
+                model[it->first] = it->second;
+            }
+            CHECK(plain.empty() && plain.begin() == plain.end());
+            checkSame(tree, model);
+            checkAugment(RootAccess<int, int, WithSize<Sum<long long> > >::of(tree));
+            plain.insert(make_pair(1, 1));
+            CHECK(plain.size() == 1);
+        }
+        else {
+            plain.merge(base);
+            plainModel.insert(model.begin(), model.end());
+            checkSame(tree, Model());
+            Model::const_iterator expected = plainModel.begin();
+            for(PlainTree::iterator it = plain.begin(); it != plain.end(); ++it, ++expected) {
+                CHECK(expected != plainModel.end() && it->first == expected->first && it->second == expected->second);
+            }
+            CHECK(expected == plainModel.end());
+            CHECK(plain.size() == plainModel.size());
+            checkAugment(RootAccess<int, int, WithSize<Sum<long long> > >::of(plain));
+            tree.insert(make_pair(1, 1));
+            Model single;
+            single[1] = 1;
+            checkSame(tree, single);
+        }
+    }
+}
+
+// rank(), select() and count_range() against positions in the model,
+// probed after every change to a size-augmented tree, for keys present,
+// absent and beyond either end
+void testRankSelect()
+{
+    typedef AVLTree<int, int, SubtreeSize> SizedTree;
+    mt19937 rng(10);
+    SizedTree tree;
+    Model model;
+    vector<int> keys;
+    for(int op = 0; op < 4000; ++op) {
+        int key = static_cast<int>(rng() % 600);
+        if(rng() % 3 != 0) {
+            tree.insert(make_pair(key, op));
+            model[key] = op;
+        }
+        else if(rng() % 2 == 0 || model.empty()) {
+            tree.remove(key);
+            model.erase(key);
+        }
+        else {
+            // remove by position, as a caller of select() would
+            size_t k = rng() % model.size();
+            SizedTree::iterator it = tree.select(k);
+            Model::iterator expected = model.begin();
+            advance(expected, k);
+            CHECK(it != tree.end() && it->first == expected->first);
+            tree.remove(it->first);
+            model.erase(expected);
+        }
+        CHECK(tree.size() == model.size());
+        keys.assign(1, -1);
+        keys.push_back(600);
+        for(int probe = 0; probe < 4; ++probe) {
+            keys.push_back(static_cast<int>(rng() % 600));
+        }
+        for(size_t i = 0; i < keys.size(); ++i) {
+            Model::iterator bound = model.lower_bound(keys[i]);
+            CHECK(tree.rank(keys[i]) == static_cast<size_t>(distance(model.begin(), bound)));
+            for(size_t j = 0; j < keys.size(); ++j) {
+                size_t expected = (keys[i] < keys[j]) ? distance(bound, model.lower_bound(keys[j])) : 0;
+                CHECK(tree.count_range(keys[i], keys[j]) == expected);
+            }
+        }
+        if(op % 100 == 0) {
+            size_t k = 0;
+            for(Model::const_iterator it = model.begin(); it != model.end(); ++it, ++k) {
+                SizedTree::iterator found = tree.select(k);
+                CHECK(found != tree.end() && found->first == it->first && found->second == it->second);
+                CHECK(tree.rank(it->first) == k);
+            }
+            checkSizes(RootAccess<int, int, SubtreeSize>::of(tree));
+        }
+        CHECK(tree.select(model.size()) == tree.end());
+    }
+}
+
+// Folds the model's items with keys in [lo, hi) the way the tree's
+// aggregate() should
+template<class Augment>
+typename Augment::value_type foldRange(const Model& model, int lo, int hi)
+{
+    typename Augment::value_type result = Augment::identity();
+    for(Model::const_iterator it = model.lower_bound(lo); it != model.end() && it->first < hi; ++it) {
+        result = Augment::combine(result, Augment::template lift<int, int>(it->first, it->second));
+    }
+    return result;
+}
+
+// aggregate() over random ranges, empty and reversed ones included, and
+// over the whole tree, while values are inserted, reassigned and removed
+template<class Augment>
+void testAggregate(unsigned seed)
+{
+    mt19937 rng(seed);
+    AVLTree<int, int, Augment> tree;
+    Model model;
+    for(int op = 0; op < 3000; ++op) {
+        int key = static_cast<int>(rng() % 500);
+        int value = static_cast<int>(rng() % 20001) - 10000;
+        switch(rng() % 4) {
+        case 0:
+            tree.insert(make_pair(key, value));
+            model[key] = value;
+            break;
+        case 1:
+            tree.insert_or_assign(key, value);
+            model[key] = value;
+            break;
+        case 2:
+            if(!model.empty()) {
+                tree.pop_min();
+                model.erase(model.begin());
+            }
+            break;
+        default:
+            tree.remove(key);
+            model.erase(key);
+            break;
+        }
+        CHECK(tree.aggregate() == foldRange<Augment>(model, -1, 500));
+        for(int probe = 0; probe < 3; ++probe) {
+            int lo = static_cast<int>(rng() % 520) - 10;
+            int hi = static_cast<int>(rng() % 520) - 10;
+            CHECK(tree.aggregate(lo, hi) == foldRange<Augment>(model, lo, hi));
+        }
+        if(op % 100 == 0) {
+            checkAugment(RootAccess<int, int, Augment>::of(tree));
+        }
+    }
+}
+
+// Splits at random keys and joins the halves back, with inserts and
+// removals in between, on a size-augmented tree so the aggregates along
+// the joined spines are checked too. Memory held through the shared arena
+// blocks must stay bounded however often the halves trade nodes.
+void testSplitJoin()
+{
+    typedef AVLTree<int, int, SubtreeSize> SizedTree;
+    mt19937 rng(9);
+    SizedTree tree;
+    Model model;
+    for(int i = 0; i < 3000; ++i) {
+        int key = static_cast<int>(rng() % 6000);
+        tree.insert(make_pair(key, i));
+        model[key] = i;
+    }
+    size_t memory = 0;
+    for(int round = 0; round < 2000; ++round) {
+        int key = static_cast<int>(rng() % 6200) - 100;
+        SizedTree geq;
+        tree.split(key, geq);
+        Model modelGeq(model.lower_bound(key), model.end());
+        Model modelLess(model.begin(), model.lower_bound(key));
+        checkSame(tree, modelLess);
+        checkSame(geq, modelGeq);
+        checkSizes(RootAccess<int, int, SubtreeSize>::of(tree));
+        checkSizes(RootAccess<int, int, SubtreeSize>::of(geq));
+
+        // both halves change while they share their blocks
+        int extra = static_cast<int>(rng() % 6000);
+        if(extra < key) {
+            tree.insert(make_pair(extra, round));
+            modelLess[extra] = round;
+        }
+        else {
+            geq.insert(make_pair(extra, round));
+            modelGeq[extra] = round;
+        }
+        if(!modelGeq.empty()) {
+            // join back around the smallest key of the upper half
+            pair<const int, int> pivot = geq.front();
+            geq.pop_min();
+            if(round % 2 == 0) {
+                tree.join(tree, pivot, geq);
+            }
+            else {
+                geq.join(tree, pivot, geq);
+                tree = std::move(geq);
+            }
+        }
+        model = modelLess;
+        model.insert(modelGeq.begin(), modelGeq.end());
+        checkSame(tree, model);
+        checkSame(geq, Model());
+        checkSizes(RootAccess<int, int, SubtreeSize>::of(tree));
+        if(round == 100) {
+            memory = tree.memoryUsage();
+        }
+        else if(round > 100) {
+            CHECK(tree.memoryUsage() <= 2 * memory);
+        }
+    }
+}
+
+// parallelBuild() on enough items to sort, deduplicate and link in
+// several pieces, against the model the same items inserted one by one
+// would give
+void testParallelBuild()
+{
+    mt19937 rng(24);
+    vector<pair<int, int> > items;
+    Model model;
+    for(int i = 0; i < 150000; ++i) {
+        int key = static_cast<int>(rng() % 60000);
+        items.push_back(make_pair(key, i));
+        model[key] = i;
+    }
+    for(unsigned threads = 1; threads <= 4; threads += 3) {
+        AVLTree<int, int, SubtreeSize> tree;
+        tree.insert(make_pair(-1, 0));
+        tree.parallelBuild(items.begin(), items.end(), threads);
+        checkSame(tree, model);
+        CHECK(checkSizes(RootAccess<int, int, SubtreeSize>::of(tree)) == model.size());
+    }
+}
+
+// parallel_for_each() and parallel_reduce() on one pool reused across
+// calls, including calls where fn throws part way through
+void testParallelScans()
+{
+    Tree tree;
+    long long expected = 0;
+    for(int i = 0; i < 200000; ++i) {
+        tree.insert(make_pair(i, i % 1000));
+        expected += i % 1000;
+    }
+    WorkStealingPool pool(4);
+    for(int round = 0; round < 3; ++round) {
+        atomic<long long> sum(0);
+        tree.parallel_for_each([&sum](pair<const int, int>& item) {
+            sum.fetch_add(item.second, memory_order_relaxed);
+        }, pool);
+        CHECK(sum.load() == expected);
+        long long reduced = tree.parallel_reduce(0LL, [](const pair<const int, int>& item) {
+            return static_cast<long long>(item.second);
+        }, [](long long a, long long b) { return a + b; }, pool);
+        CHECK(reduced == expected);
+        // the first key in key order wins, as reduce combines in order
+        int first = tree.parallel_reduce(-1, [](const pair<const int, int>& item) { return item.first; },
+            [](int a, int b) { return (a < 0) ? b : a; }, pool);
+        CHECK(first == 0);
+
+        bool thrown = false;
+        try {
+            tree.parallel_for_each([round](pair<const int, int>& item) {
+                if(item.first % 50000 == round) {
+                    throw runtime_error("stop");
+                }
+            }, pool);
+        }
+        catch(const runtime_error&) {
+            thrown = true;
+        }
+        CHECK(thrown);
+        thrown = false;
+        try {
+            tree.parallel_reduce(0, [](const pair<const int, int>& item) {
+                if(item.first == 123456) {
+                    throw runtime_error("stop");
+                }
+                return 1;
+            }, [](int a, int b) { return a + b; }, 4);
+        }
+        catch(const runtime_error&) {
+            thrown = true;
+        }
+        CHECK(thrown);
+    }
+}
+
+int main()
+{
+    testRandomOps();
+    testSortedRuns();
+    testThroughBase();
+    testMerge();
+    testRankSelect();
+    testAggregate<Sum<long long> >(12);
+    testAggregate<Min<int> >(13);
+    testAggregate<Max<int> >(14);
+    testAggregate<WithSize<Max<int> > >(15);
+    testSplitJoin();
+    testParallelBuild();
+    testParallelScans();
+    cout << "avl-ops-test: all passed" << endl;
+    return 0;
+}
@@ -14,14 +14,21 @@ struct KeyError { };
 * A special kind of node for an AVL tree, which adds the balance as a data member, plus
 * other additional helper functions. You do NOT need to implement any functionality or
 * add additional data members or helper functions.
+*
+* Compiling with AVL_COMPACT_NODES defined drops the balance_ member and
+* stores the balance (always -1, 0 or 1) in the two low bits of the parent
+* pointer instead, which saves a padded word per node.
 */
-template <typename Key, typename Value>
-class AVLNode : public Node<Key, Value>
+template <typename Key, typename Value, typename Augment = NoAugment>
+class AVLNode : public Node<Key, Value, Augment>
 {
 public:
     // Constructor/destructor.
-    AVLNode(const Key& key, const Value& value, AVLNode<Key, Value>* parent);
-    virtual ~AVLNode();
+    AVLNode(const Key& key, const Value& value, AVLNode<Key, Value, Augment>* parent);
+    AVLNode(Key&& key, Value&& value, AVLNode<Key, Value, Augment>* parent);
+    template<typename... ItemArgs>
+    AVLNode(AVLNode<Key, Value, Augment>* parent, ItemArgs&&... itemArgs);
+    ~AVLNode();
 
     // Getter/setter for the node's height.
     int8_t getBalance () const;
@@ -29,14 +36,17 @@ public:
     void updateBalance(int8_t diff);
 
     // Getters for parent, left, and right. These need to be redefined since they
-    // return pointers to AVLNodes - not plain Nodes. See the Node class in bst.h
-    // for more information.
-    virtual AVLNode<Key, Value>* getParent() const override;
-    virtual AVLNode<Key, Value>* getLeft() const override;
-    virtual AVLNode<Key, Value>* getRight() const override;
+    // return pointers to AVLNodes - not plain Nodes. They hide (rather than
+    // override) the Node versions, so calls are resolved statically. See the
+    // Node class in bst.h for more information.
+    AVLNode<Key, Value, Augment>* getParent() const;
+    AVLNode<Key, Value, Augment>* getLeft() const;
+    AVLNode<Key, Value, Augment>* getRight() const;
 
 protected:
+#ifndef AVL_COMPACT_NODES
     int8_t balance_;    // effectively a signed char
+#endif
 };
 
 /*
@@ -48,9 +58,42 @@ protected:
 /**
 * An explicit constructor to initialize the elements by calling the base class constructor
 */
-template<class Key, class Value>
-AVLNode<Key, Value>::AVLNode(const Key& key, const Value& value, AVLNode<Key, Value> *parent) :
-    Node<Key, Value>(key, value, parent), balance_(0)
+template<class Key, class Value, class Augment>
+AVLNode<Key, Value, Augment>::AVLNode(const Key& key, const Value& value, AVLNode<Key, Value, Augment> *parent) :
+#ifdef AVL_COMPACT_NODES
+    Node<Key, Value, Augment>(key, value, parent)
+#else
+    Node<Key, Value, Augment>(key, value, parent), balance_(0)
+#endif
+{
+
+}
+
+/**
+* An explicit constructor that takes over the key and value.
+*/
+template<class Key, class Value, class Augment>
+AVLNode<Key, Value, Augment>::AVLNode(Key&& key, Value&& value, AVLNode<Key, Value, Augment> *parent) :
+#ifdef AVL_COMPACT_NODES
+    Node<Key, Value, Augment>(std::move(key), std::move(value), parent)
+#else
+    Node<Key, Value, Augment>(std::move(key), std::move(value), parent), balance_(0)
+#endif
+{
+
+}
+
+/**
+* A constructor that builds the item in place, see the matching Node constructor.
+*/
+template<class Key, class Value, class Augment>
+template<typename... ItemArgs>
+AVLNode<Key, Value, Augment>::AVLNode(AVLNode<Key, Value, Augment>* parent, ItemArgs&&... itemArgs) :
+#ifdef AVL_COMPACT_NODES
+    Node<Key, Value, Augment>(parent, std::forward<ItemArgs>(itemArgs)...)
+#else
+    Node<Key, Value, Augment>(parent, std::forward<ItemArgs>(itemArgs)...), balance_(0)
+#endif
 {
 
 }
@@ -58,8 +101,8 @@ AVLNode<Key, Value>::AVLNode(const Key& key, const Value& value, AVLNode<Key, Va
 /**
 * A destructor which does nothing.
 */
-template<class Key, class Value>
-AVLNode<Key, Value>::~AVLNode()
+template<class Key, class Value, class Augment>
+AVLNode<Key, Value, Augment>::~AVLNode()
 {
 
 }
@@ -67,56 +110,68 @@ AVLNode<Key, Value>::~AVLNode()
 /**
 * A getter for the balance of a AVLNode.
 */
-template<class Key, class Value>
-int8_t AVLNode<Key, Value>::getBalance() const
+template<class Key, class Value, class Augment>
+int8_t AVLNode<Key, Value, Augment>::getBalance() const
 {
+#ifdef AVL_COMPACT_NODES
+    // the tag is the balance as a two bit two's complement number,
+    // so an untagged parent pointer reads as a balance of 0
+    uintptr_t tag = reinterpret_cast<uintptr_t>(this->parent_) & this->PARENT_TAG_MASK;
+    return static_cast<int8_t>(tag == 3 ? -1 : tag);
+#else
     return balance_;
+#endif
 }
 
 /**
 * A setter for the balance of a AVLNode.
 */
-template<class Key, class Value>
-void AVLNode<Key, Value>::setBalance(int8_t balance)
+template<class Key, class Value, class Augment>
+void AVLNode<Key, Value, Augment>::setBalance(int8_t balance)
 {
+#ifdef AVL_COMPACT_NODES
+    uintptr_t bits = reinterpret_cast<uintptr_t>(this->parent_) & ~this->PARENT_TAG_MASK;
+    this->parent_ = reinterpret_cast<Node<Key, Value, Augment>*>(bits | (static_cast<uintptr_t>(balance) & this->PARENT_TAG_MASK));
+#else
     balance_ = balance;
+#endif
 }
 
 /**
 * Adds diff to the balance of a AVLNode.
 */
-template<class Key, class Value>
-void AVLNode<Key, Value>::updateBalance(int8_t diff)
+template<class Key, class Value, class Augment>
+void AVLNode<Key, Value, Augment>::updateBalance(int8_t diff)
 {
-    balance_ += diff;
+    setBalance(getBalance() + diff);
 }
 
 /**
-* An overridden function for getting the parent since a static_cast is necessary to make sure
+* A redefined function for getting the parent since a static_cast is necessary to make sure
 * that our node is a AVLNode.
 */
-template<class Key, class Value>
-AVLNode<Key, Value> *AVLNode<Key, Value>::getParent() const
+template<class Key, class Value, class Augment>
+AVLNode<Key, Value, Augment> *AVLNode<Key, Value, Augment>::getParent() const
 {
-    return static_cast<AVLNode<Key, Value>*>(this->parent_);
+    return static_cast<AVLNode<Key, Value, Augment>*>(Node<Key, Value, Augment>::getParent());
 }
 
 /**
-* Overridden for the same reasons as above.
+* Redefined for the same reasons as above.
 */
-template<class Key, class Value>
-AVLNode<Key, Value> *AVLNode<Key, Value>::getLeft() const
+template<class Key, class Value, class Augment>
+AVLNode<Key, Value, Augment> *AVLNode<Key, Value, Augment>::getLeft() const
 {
-    return static_cast<AVLNode<Key, Value>*>(this->left_);
+    return static_cast<AVLNode<Key, Value, Augment>*>(Node<Key, Value, Augment>::getLeft());
 }
 
 /**
-* Overridden for the same reasons as above.
+* Redefined for the same reasons as above.
 */
-template<class Key, class Value>
-AVLNode<Key, Value> *AVLNode<Key, Value>::getRight() const
+template<class Key, class Value, class Augment>
+AVLNode<Key, Value, Augment> *AVLNode<Key, Value, Augment>::getRight() const
 {
-    return static_cast<AVLNode<Key, Value>*>(this->right_);
+    return static_cast<AVLNode<Key, Value, Augment>*>(Node<Key, Value, Augment>::getRight());
 }
 
 
@@ -127,416 +182,828 @@ AVLNode<Key, Value> *AVLNode<Key, Value>::getRight() const
 */
 
 
-template <class Key, class Value>
-class AVLTree : public BinarySearchTree<Key, Value>
+template <class Key, class Value, class Augment = NoAugment>
+class AVLTree : public BinarySearchTree<Key, Value, Augment>
 {
 public:
+    AVLTree();
+    template<typename ForwardIt>
+    AVLTree(ForwardIt first, ForwardIt last);
+    AVLTree(const AVLTree<Key, Value, Augment>& other);
+    AVLTree(AVLTree<Key, Value, Augment>&& other);
+    AVLTree<Key, Value, Augment>& operator=(const AVLTree<Key, Value, Augment>& other);
+    AVLTree<Key, Value, Augment>& operator=(AVLTree<Key, Value, Augment>&& other);
     virtual void insert (const std::pair<const Key, Value> &new_item); // TODO
+    virtual void insert (std::pair<const Key, Value>&& new_item);
     virtual void remove(const Key& key);  // TODO
+
+    // the hinted inserts, which the insert() overrides above would hide
+    using BinarySearchTree<Key, Value, Augment>::insert;
+
+    // O(log n) partitioning: split() moves the keys >= key into geq, and
+    // join() makes this tree hold left, then pivot, then right.
+    void split(const Key& key, AVLTree<Key, Value, Augment>& geq);
+    void join(AVLTree<Key, Value, Augment>& left, const std::pair<const Key, Value>& pivot, AVLTree<Key, Value, Augment>& right);
+    // The O(n + m) merges of BinarySearchTree, hidden behind versions that
+    // only take another AVLTree, whose nodes can be reused
+    void merge(AVLTree<Key, Value, Augment>& other);
+    template<typename ConflictPolicy>
+    void union_with(AVLTree<Key, Value, Augment>& other, ConflictPolicy policy);
+
+    // The height of the tree in O(1); 0 when empty, 1 for a single node.
+    int height() const;
 protected:
-    virtual void nodeSwap( AVLNode<Key,Value>* n1, AVLNode<Key,Value>* n2);
+    virtual void nodeSwap( AVLNode<Key, Value, Augment>* n1, AVLNode<Key, Value, Augment>* n2);
+    virtual void removeNode(Node<Key, Value, Augment>* n);
 
     // Add helper functions here
-    void insertFix(AVLNode<Key,Value>* parent, AVLNode<Key,Value>* current);
-    void rotateRight(AVLNode<Key, Value>* parent);
-    void rotateLeft(AVLNode<Key, Value>* parent);
-    void removeFix(AVLNode<Key,Value>* parent, int diff);
-
+    virtual Node<Key, Value, Augment>* createNode(void* slot, Node<Key, Value, Augment>* parent,
+                                         ItemSource<Key, Value>& source);
+    virtual void afterAttach(Node<Key, Value, Augment>* n);
+    virtual void setBuiltBalance(Node<Key, Value, Augment>* n, int balance);
+    virtual void setBuiltHeight(int height);
+    bool insertFix(AVLNode<Key, Value, Augment>* parent, AVLNode<Key, Value, Augment>* current);
+    void rotateRight(AVLNode<Key, Value, Augment>* node);
+    void rotateLeft(AVLNode<Key, Value, Augment>* node);
+    bool removeFix(AVLNode<Key, Value, Augment>* node, int diff);
+    static int subtreeHeight(AVLNode<Key, Value, Augment>* n);
+    void splitSubtree(AVLNode<Key, Value, Augment>* n, int height, const Key& key,
+                      AVLNode<Key, Value, Augment>*& less, int& lessHeight, AVLNode<Key, Value, Augment>*& geq, int& geqHeight);
+    AVLNode<Key, Value, Augment>* joinSubtrees(AVLNode<Key, Value, Augment>* left, int leftHeight, AVLNode<Key, Value, Augment>* pivot,
+                                      AVLNode<Key, Value, Augment>* right, int rightHeight, int& height);
+
+    // the height of the tree while it is not empty, kept by every change
+    // to its shape; UNKNOWN_HEIGHT after a copy or move made through a
+    // BinarySearchTree, until height() next reads it off the balances
+    mutable int height_;
 };
 
 
 
-/*
- * Recall: If key is already in the tree, you should 
- * overwrite the current value with the updated value.
- */
-template<class Key, class Value>
-void AVLTree<Key, Value>::insert (const std::pair<const Key, Value> &new_item)
+/**
+* Default constructor, which sizes the arena's slots for AVLNodes.
+*/
+template<class Key, class Value, class Augment>
+AVLTree<Key, Value, Augment>::AVLTree() :
+    BinarySearchTree<Key, Value, Augment>(sizeof(AVLNode<Key, Value, Augment>), alignof(AVLNode<Key, Value, Augment>),
+                                 &BinarySearchTree<Key, Value, Augment>::template destructNode<AVLNode<Key, Value, Augment> >),
+    height_(0)
 {
-    // TODO
 
-    AVLNode<Key, Value>* duplicates = static_cast<AVLNode<Key, Value>*>(this->internalFind(new_item.first));
-	// if there is a duplicate, replace the value
-	if(duplicates != NULL) {
-        // std::cout << "HAS DUPE" << std::endl;
-		duplicates->setValue(new_item.second);
-	}
-	// if root is NULL, then insert a new node with new_item's variables to root
-	else if(this->root_ == NULL) {
-		AVLNode<Key, Value>* temp = new AVLNode<Key, Value>(new_item.first, new_item.second, NULL);
-		this->root_ = temp; 
+}
+
+/**
+* Constructor that builds a balanced tree from a sorted range, see buildFromSorted().
+*/
+template<class Key, class Value, class Augment>
+template<typename ForwardIt>
+AVLTree<Key, Value, Augment>::AVLTree(ForwardIt first, ForwardIt last) :
+    BinarySearchTree<Key, Value, Augment>(sizeof(AVLNode<Key, Value, Augment>), alignof(AVLNode<Key, Value, Augment>),
+                                 &BinarySearchTree<Key, Value, Augment>::template destructNode<AVLNode<Key, Value, Augment> >),
+    height_(0)
+{
+    this->buildFromSorted(first, last);
+}
+
+/**
+* Copy constructor. The clone keeps other's shape and balance factors, so
+* it costs O(n) with no comparisons or rotations.
+*/
+template<class Key, class Value, class Augment>
+AVLTree<Key, Value, Augment>::AVLTree(const AVLTree<Key, Value, Augment>& other) :
+    BinarySearchTree<Key, Value, Augment>(sizeof(AVLNode<Key, Value, Augment>), alignof(AVLNode<Key, Value, Augment>),
+                                 &BinarySearchTree<Key, Value, Augment>::template destructNode<AVLNode<Key, Value, Augment> >),
+    height_(0)
+{
+    this->template cloneFrom<AVLNode<Key, Value, Augment> >(other);
+    height_ = other.height_;
+}
+
+/**
+* Move constructor, which takes over the nodes of other in O(1).
+*/
+template<class Key, class Value, class Augment>
+AVLTree<Key, Value, Augment>::AVLTree(AVLTree<Key, Value, Augment>&& other) :
+    BinarySearchTree<Key, Value, Augment>(std::move(other)),
+    height_(other.height_)
+{
+
+}
+
+/**
+* Copy assignment, see the copy constructor.
+*/
+template<class Key, class Value, class Augment>
+AVLTree<Key, Value, Augment>& AVLTree<Key, Value, Augment>::operator=(const AVLTree<Key, Value, Augment>& other)
+{
+    if(&other != this) {
+        AVLTree<Key, Value, Augment> copy(other);
+        *this = std::move(copy);
+    }
+    return *this;
+}
+
+/**
+* Move assignment, which frees this tree's nodes and takes over other's.
+*/
+template<class Key, class Value, class Augment>
+AVLTree<Key, Value, Augment>& AVLTree<Key, Value, Augment>::operator=(AVLTree<Key, Value, Augment>&& other)
+{
+    if(&other != this) {
+        this->takeFrom(other);
+        height_ = other.height_;
+    }
+    return *this;
+}
+
+/**
+* Splits the tree around key in O(log n), or O(log^2 n) in threaded mode
+* where every join rethreads its pivot: keys less than key stay in this
+* tree and the rest are moved into geq, replacing its contents. No node
+* is copied; geq shares the arena blocks the moved nodes live in, so the
+* memory of both halves stays reserved until both trees have let go of it
+* (see NodeArena::share). Copying a half into a fresh tree detaches it.
+*/
+template<class Key, class Value, class Augment>
+void AVLTree<Key, Value, Augment>::split(const Key& key, AVLTree<Key, Value, Augment>& geq)
+{
+    if(&geq == this) {
         return;
-	}
-	// otherwise, create a new Node with new_item's variables and insert into the BST
-	else {
-		AVLNode<Key, Value>* temp = new AVLNode<Key, Value>(new_item.first, new_item.second, NULL);
-		AVLNode<Key, Value>* parent = static_cast<AVLNode<Key, Value>*>(this->root_);
-		bool isDone = false;
-		while(!isDone) {
-			// if the current key value is less than the root's key value
-			if(temp->getKey() < parent->getKey()) {
-				// if parent node's left child is NULL, then sets it to the new value
-				if(parent->getLeft() == NULL) {
-					temp->setParent(parent);
-					parent->setLeft(temp);  
-					isDone = true; 
-				}
-				// if the parent's left child is not NULL, then continues down the BST
-				else {
-					parent = parent->getLeft();
-				}
-			}
-			// if the current key value is greater than  the root's key value
-			else if(temp->getKey() > parent->getKey()) {
-				// if parent node's right child is NULL, then sets it to the new value
-				if(parent->getRight() == NULL) {
-					temp->setParent(parent);
-					parent->setRight(temp);  
-					isDone = true; 
-				}
-				// if the parent's right child is not NULL, then continues down the BST
-				else {
-					parent = parent->getRight();
-				}
-			}
-		}
-        // sets the balance
-        if(parent->getBalance() == 1 || parent->getBalance() == -1) {
-            parent->setBalance(0);
-            return;
-        }
-        else {
-            if(parent->getLeft() != NULL && parent->getRight() == NULL) {
-                parent->setBalance(-1);
-            }
-            else if(parent->getRight() != NULL && parent->getLeft() == NULL) {
-                parent->setBalance(1);
-            }
-            insertFix(parent, temp);
+    }
+    geq.clear();
+    AVLNode<Key, Value, Augment>* root = static_cast<AVLNode<Key, Value, Augment>*>(this->root_);
+    AVLNode<Key, Value, Augment>* less;
+    AVLNode<Key, Value, Augment>* more;
+    int lessHeight;
+    int moreHeight;
+    splitSubtree(root, height(), key, less, lessHeight, more, moreHeight);
+
+    if(more != NULL) {
+        this->arena_.share(geq.arena_);
+        geq.leftmost_ = more;
+        while(geq.leftmost_->getLeft() != NULL) {
+            geq.leftmost_ = geq.leftmost_->getLeft();
         }
-	}
+        geq.rightmost_ = this->rightmost_;
+    }
+    geq.root_ = more;
+    geq.height_ = moreHeight;
+    this->root_ = less;
+    height_ = lessHeight;
+    // an augmentation with subtree sizes answers size() by itself
+    geq.size_ = BinarySearchTree<Key, Value, Augment>::UNKNOWN_SIZE;
+    this->size_ = BinarySearchTree<Key, Value, Augment>::UNKNOWN_SIZE;
+    // the smallest node stays here unless every key moved out
+    if(less == NULL) {
+        this->leftmost_ = NULL;
+    }
+    this->rightmost_ = less;
+    while(this->rightmost_ != NULL && this->rightmost_->getRight() != NULL) {
+        this->rightmost_ = this->rightmost_->getRight();
+    }
+#ifdef BST_THREADED_NODES
+    // the two halves must not thread across the cut
+    if(this->rightmost_ != NULL) {
+        this->rightmost_->setRightThread(NULL);
+    }
+    if(more != NULL) {
+        geq.leftmost_->setLeftThread(NULL);
+    }
+#endif
 }
 
+/**
+* Replaces the contents of this tree with the items of left, then pivot,
+* then the items of right, in O(log n). Every key of left must be less
+* than the pivot key and every key of right greater. left and right are
+* left empty, and this tree may be one of them. Their nodes are reused.
+*/
+template<class Key, class Value, class Augment>
+void AVLTree<Key, Value, Augment>::join(AVLTree<Key, Value, Augment>& left, const std::pair<const Key, Value>& pivot,
+                               AVLTree<Key, Value, Augment>& right)
+{
+    AVLNode<Key, Value, Augment>* leftRoot = static_cast<AVLNode<Key, Value, Augment>*>(left.root_);
+    AVLNode<Key, Value, Augment>* rightRoot = static_cast<AVLNode<Key, Value, Augment>*>(right.root_);
+    Node<Key, Value, Augment>* leftmost = left.leftmost_;
+    Node<Key, Value, Augment>* rightmost = right.rightmost_;
+    int leftHeight = left.height();
+    int rightHeight = right.height();
+    std::size_t size = BinarySearchTree<Key, Value, Augment>::UNKNOWN_SIZE;
+    if(left.size_ != size && right.size_ != size) {
+        size = left.size_ + right.size_ + 1;
+    }
+    left.size_ = 0;
+    right.size_ = 0;
+    left.root_ = NULL;
+    left.leftmost_ = NULL;
+    left.rightmost_ = NULL;
+    right.root_ = NULL;
+    right.leftmost_ = NULL;
+    right.rightmost_ = NULL;
+    if(this != &left && this != &right) {
+        this->clear();
+    }
+    this->arena_.adopt(left.arena_);
+    this->arena_.adopt(right.arena_);
+
+    AVLNode<Key, Value, Augment>* middle = new (this->allocateNode()) AVLNode<Key, Value, Augment>(pivot.first, pivot.second, NULL);
+    int height;
+    this->root_ = joinSubtrees(leftRoot, leftHeight, middle, rightRoot, rightHeight, height);
+    height_ = height;
+    this->leftmost_ = (leftmost != NULL) ? leftmost : middle;
+    this->rightmost_ = (rightmost != NULL) ? rightmost : middle;
+    this->size_ = size;
+}
+
+template<class Key, class Value, class Augment>
+void AVLTree<Key, Value, Augment>::merge(AVLTree<Key, Value, Augment>& other)
+{
+    BinarySearchTree<Key, Value, Augment>::merge(other);
+}
 
-template<class Key, class Value>
-void AVLTree<Key, Value>::insertFix(AVLNode<Key,Value>* parent, AVLNode<Key,Value>* current) {
-    if(parent->getParent() == NULL || parent == NULL) {
+template<class Key, class Value, class Augment>
+template<typename ConflictPolicy>
+void AVLTree<Key, Value, Augment>::union_with(AVLTree<Key, Value, Augment>& other, ConflictPolicy policy)
+{
+    BinarySearchTree<Key, Value, Augment>::union_with(other, policy);
+}
+
+/**
+* Returns the height of the tree, which every change to its shape keeps
+* up to date. Only after a copy or move made through a BinarySearchTree
+* is it unknown; it is then read off the balance factors in O(log n) once.
+*/
+template<class Key, class Value, class Augment>
+int AVLTree<Key, Value, Augment>::height() const
+{
+    if(this->root_ == NULL) {
+        return 0;
+    }
+    if(height_ == BinarySearchTree<Key, Value, Augment>::UNKNOWN_HEIGHT) {
+        height_ = subtreeHeight(static_cast<AVLNode<Key, Value, Augment>*>(this->root_));
+    }
+    return height_;
+}
+
+/**
+* Returns the height of the subtree rooted at n in O(log n), by following
+* the taller child all the way down.
+*/
+template<class Key, class Value, class Augment>
+int AVLTree<Key, Value, Augment>::subtreeHeight(AVLNode<Key, Value, Augment>* n)
+{
+    int height = 0;
+    while(n != NULL) {
+        ++height;
+        n = (n->getBalance() < 0) ? n->getLeft() : n->getRight();
+    }
+    return height;
+}
+
+/**
+* Splits the detached subtree n of the given height into detached AVL
+* subtrees less (keys less than key) and geq (the rest), along with their
+* heights. Each level joins the half it does not descend into with the
+* partial result, and the join costs telescope to O(log n) overall.
+*/
+template<class Key, class Value, class Augment>
+void AVLTree<Key, Value, Augment>::splitSubtree(AVLNode<Key, Value, Augment>* n, int height, const Key& key,
+                                       AVLNode<Key, Value, Augment>*& less, int& lessHeight,
+                                       AVLNode<Key, Value, Augment>*& geq, int& geqHeight)
+{
+    if(n == NULL) {
+        less = NULL;
+        geq = NULL;
+        lessHeight = 0;
+        geqHeight = 0;
         return;
     }
-    // if the child is a left child of the parent's parent
-    if(parent->getParent()->getLeft() == parent) {
-        parent->getParent()->updateBalance(-1);
-        // case 1
-        if(parent->getParent()->getBalance() == 0) {
-            // std::cout << "case 1" << std::endl;
-            return;
+    AVLNode<Key, Value, Augment>* left = n->getLeft();
+    AVLNode<Key, Value, Augment>* right = n->getRight();
+    int leftHeight = height - ((n->getBalance() <= 0) ? 1 : 2);
+    int rightHeight = height - ((n->getBalance() >= 0) ? 1 : 2);
+    if(left != NULL) {
+        left->setParent(NULL);
+    }
+    if(right != NULL) {
+        right->setParent(NULL);
+    }
+    if(n->getKey() < key) {
+        splitSubtree(right, rightHeight, key, less, lessHeight, geq, geqHeight);
+        less = joinSubtrees(left, leftHeight, n, less, lessHeight, lessHeight);
+    }
+    else {
+        splitSubtree(left, leftHeight, key, less, lessHeight, geq, geqHeight);
+        geq = joinSubtrees(geq, geqHeight, n, right, rightHeight, geqHeight);
+    }
+}
+
+/**
+* Joins the detached subtrees left and right, all of whose keys are less
+* and greater than pivot's respectively, with pivot between them. pivot
+* is linked in where the taller side's spine comes down to the height of
+* the shorter side, and the growth is fixed up like an insertion, so the
+* cost is O(|leftHeight - rightHeight| + 1), plus O(log n) to thread pivot
+* in when BST_THREADED_NODES is defined. Both subtrees are detached, so
+* the aggregates refreshed above pivot are only those of the spine just
+* walked, and augmented trees keep the same bound. Returns the new root,
+* which has no parent, and sets height to its height.
+*/
+template<class Key, class Value, class Augment>
+AVLNode<Key, Value, Augment>* AVLTree<Key, Value, Augment>::joinSubtrees(AVLNode<Key, Value, Augment>* left, int leftHeight,
+                                                       AVLNode<Key, Value, Augment>* pivot, AVLNode<Key, Value, Augment>* right,
+                                                       int rightHeight, int& height)
+{
+    if(leftHeight > rightHeight + 1) {
+        // walk down the right spine of left to a subtree short enough
+        AVLNode<Key, Value, Augment>* parent = NULL;
+        AVLNode<Key, Value, Augment>* current = left;
+        int currentHeight = leftHeight;
+        while(currentHeight > rightHeight + 1) {
+            currentHeight -= (current->getBalance() >= 0) ? 1 : 2;
+            parent = current;
+            current = current->getRight();
         }
-        // case 2
-        else if(parent->getParent()->getBalance() == -1) {
-            // std::cout << "case 2" << std::endl;
-            insertFix(parent->getParent(), parent);
-            return;
+        pivot->setLeft(current);
+        if(current != NULL) {
+            current->setParent(pivot);
         }
-        else if(parent->getLeft() == current || parent->getRight() == current) {
-            // std::cout << "case 3" << std::endl;
-            parent->setBalance(0);
-            parent->getParent()->setBalance(0);
-            rotateRight(parent);
+        pivot->setRight(right);
+        if(right != NULL) {
+            right->setParent(pivot);
         }
+        pivot->setParent(parent);
+        parent->setRight(pivot);
+        pivot->setBalance(rightHeight - currentHeight);
+        this->pullUpPath(pivot);
+        this->rethread(pivot);
+        // pivot is always one taller than the subtree it replaced
+        bool grew = insertFix(pivot, current);
+        height = leftHeight + (grew ? 1 : 0);
+        // only a rotation at the very top can move left down a level
+        return (left->getParent() != NULL) ? left->getParent() : left;
     }
-    else if(parent->getParent()->getRight() == parent) {
-        parent->getParent()->updateBalance(1);
-        // case 1
-        if(parent->getParent()->getBalance() == 0) {
-            // std::cout << "case 1" << std::endl;
-            return;
+    if(rightHeight > leftHeight + 1) {
+        // walk down the left spine of right to a subtree short enough
+        AVLNode<Key, Value, Augment>* parent = NULL;
+        AVLNode<Key, Value, Augment>* current = right;
+        int currentHeight = rightHeight;
+        while(currentHeight > leftHeight + 1) {
+            currentHeight -= (current->getBalance() <= 0) ? 1 : 2;
+            parent = current;
+            current = current->getLeft();
         }
-        // case 2
-        else if(parent->getParent()->getBalance() == 1) {
-            // std::cout << "case 2" << std::endl;
-            insertFix(parent->getParent(), parent);
-            return;
+        pivot->setRight(current);
+        if(current != NULL) {
+            current->setParent(pivot);
         }
-        else if(parent->getRight() == current || parent->getLeft() == current) {
-            // std::cout << "case 3" << std::endl;
-            parent->setBalance(0);
-            parent->getParent()->setBalance(0);
-            rotateLeft(parent);
+        pivot->setLeft(left);
+        if(left != NULL) {
+            left->setParent(pivot);
         }
+        pivot->setParent(parent);
+        parent->setLeft(pivot);
+        pivot->setBalance(currentHeight - leftHeight);
+        this->pullUpPath(pivot);
+        this->rethread(pivot);
+        bool grew = insertFix(pivot, current);
+        height = rightHeight + (grew ? 1 : 0);
+        return (right->getParent() != NULL) ? right->getParent() : right;
     }
+    pivot->setLeft(left);
+    if(left != NULL) {
+        left->setParent(pivot);
+    }
+    pivot->setRight(right);
+    if(right != NULL) {
+        right->setParent(pivot);
+    }
+    pivot->setParent(NULL);
+    pivot->setBalance(rightHeight - leftHeight);
+    this->pullUp(pivot);
+    this->rethread(pivot);
+    height = 1 + std::max(leftHeight, rightHeight);
+    return pivot;
+}
+
+/**
+* Stores the balance of a node placed by the shared linear-time builders.
+*/
+template<class Key, class Value, class Augment>
+void AVLTree<Key, Value, Augment>::setBuiltBalance(Node<Key, Value, Augment>* n, int balance)
+{
+    static_cast<AVLNode<Key, Value, Augment>*>(n)->setBalance(balance);
 }
 
+/**
+* Stores the height of a tree the shared code built or moved here.
+*/
+template<class Key, class Value, class Augment>
+void AVLTree<Key, Value, Augment>::setBuiltHeight(int height)
+{
+    height_ = height;
+}
 
+/*
+ * Recall: If key is already in the tree, you should 
+ * overwrite the current value with the updated value.
+ */
+template<class Key, class Value, class Augment>
+void AVLTree<Key, Value, Augment>::insert (const std::pair<const Key, Value> &new_item)
+{
+    this->insert_or_assign(new_item.first, new_item.second);
+}
+
+/**
+* Moves the value out of new_item, see BinarySearchTree::insert().
+*/
+template<class Key, class Value, class Augment>
+void AVLTree<Key, Value, Augment>::insert (std::pair<const Key, Value>&& new_item)
+{
+    this->insert_or_assign(new_item.first, std::move(new_item.second));
+}
+
+/**
+* Constructs an AVLNode in slot, see BinarySearchTree::createNode().
+*/
+template<class Key, class Value, class Augment>
+Node<Key, Value, Augment>* AVLTree<Key, Value, Augment>::createNode(void* slot, Node<Key, Value, Augment>* parent,
+                                                  ItemSource<Key, Value>& source)
+{
+    return new (slot) AVLNode<Key, Value, Augment>(static_cast<AVLNode<Key, Value, Augment>*>(parent), source);
+}
 
-template<class Key, class Value>
-void AVLTree<Key, Value>::rotateRight(AVLNode<Key, Value>* parent) {
-    // std::cout << "1" << std::endl;
-    AVLNode<Key, Value>* grandparent = parent->getParent();
-    AVLNode<Key, Value>* greatgrandparent = grandparent->getParent();
-    // two left nodes
-    if(parent->getLeft() != NULL) {
-        // std::cout << "2" << std::endl;
-        if(grandparent == this->root_) {
-            // std::cout << "3" << std::endl;
-            AVLNode<Key, Value>* child = parent->getLeft();
-            this->root_ = parent;
-            parent->setLeft(child);
-            child->setParent(parent);
-            parent->setParent(NULL);
-            parent->setRight(grandparent);
-            grandparent->setParent(parent);
-            grandparent->setLeft(NULL);
+/**
+* Restores the AVL property above n, a leaf the shared insertion code
+* just linked in.
+*/
+template<class Key, class Value, class Augment>
+void AVLTree<Key, Value, Augment>::afterAttach(Node<Key, Value, Augment>* n)
+{
+    AVLNode<Key, Value, Augment>* temp = static_cast<AVLNode<Key, Value, Augment>*>(n);
+    AVLNode<Key, Value, Augment>* parent = temp->getParent();
+    if(parent == NULL) {
+        height_ = 1;
+        return;
+    }
+    // sets the balance; if the parent was leaning the other way the
+    // height of its subtree did not change and we are done
+    if(parent->getBalance() != 0) {
+        parent->setBalance(0);
+    }
+    else {
+        if(parent->getLeft() == temp) {
+            parent->setBalance(-1);
         }
         else {
-            // std::cout << "1" << std::endl;
-
-            AVLNode<Key, Value>* child = parent->getLeft();
-            // this->root_ = parent;
-            parent->setLeft(child);
-            child->setParent(parent);
-            parent->setParent(greatgrandparent);
-            parent->setRight(grandparent);
-            grandparent->setParent(parent);
-            grandparent->setLeft(NULL);
-            // if(greatgrandparent->getRight() == grandparent) {
-            //     greatgrandparent->setRight(parent);
-            // }
-            // else {
-            //     greatgrandparent->setLeft(parent);
-            // }
+            parent->setBalance(1);
         }
-        
-    }
-    // root - left - right
-    else if(parent->getRight() != NULL) {
-        // std::cout << "other one" << std::endl;
-        if(grandparent == this->root_) {
-            // std::cout << "5" << std::endl;
-            AVLNode<Key, Value>* child = parent->getRight();
-            this->root_ = child;
-            this->root_->setLeft(parent);
-            parent->setParent(this->root_);
-            this->root_->setRight(grandparent);
-            grandparent->setParent(this->root_);
-            grandparent->setLeft(NULL);
-            parent->setRight(NULL);
-        }
-        else {
-            // std::cout << "2" << std::endl;
-            
-            AVLNode<Key, Value>* child = parent->getRight();
-            // this->root_ = child;
-            child->setLeft(parent);
-            parent->setParent(child);
-            child->setRight(grandparent);
-            child->setParent(greatgrandparent);
-            grandparent->setParent(child);
-            grandparent->setLeft(NULL);
-            parent->setRight(NULL);
-            // if(greatgrandparent->getRight() == grandparent) {
-            //     greatgrandparent->setRight(child);
-            // }
-            // else {
-            //     greatgrandparent->setLeft(child);
-            // }
-
+        if(insertFix(parent, temp) && height_ != BinarySearchTree<Key, Value, Augment>::UNKNOWN_HEIGHT) {
+            ++height_;
         }
     }
 }
 
 
-
-
-template<class Key, class Value>
-void AVLTree<Key, Value>::rotateLeft(AVLNode<Key, Value>* parent) {
-    // std::cout << "1" << std::endl;
-    AVLNode<Key, Value>* grandparent = parent->getParent();
-    AVLNode<Key, Value>* greatgrandparent = grandparent->getParent();
-    // two right nodes
-    if(parent->getRight() != NULL) {
-        // std::cout << "2" << std::endl;
-        if(grandparent == this->root_) {
-            // std::cout << "3" << std::endl;
-            AVLNode<Key, Value>* child = parent->getRight();
-            this->root_ = parent;
-            parent->setRight(child);
-            child->setParent(parent);
-            parent->setParent(NULL);
-            parent->setLeft(grandparent);
-            grandparent->setParent(parent);
-            grandparent->setRight(NULL);
-        }
-        else {
-            // std::cout << "3" << std::endl;
-
-            AVLNode<Key, Value>* child = parent->getRight();
-            // this->root_ = parent;
-            parent->setRight(child);
-            child->setParent(parent);
-            parent->setParent(greatgrandparent);
-            parent->setLeft(grandparent);
-            grandparent->setParent(parent);
-            grandparent->setRight(NULL);
-            // if(greatgrandparent->getRight() == grandparent) {
-            //     greatgrandparent->setRight(parent);
-            // }
-            // else {
-            //     greatgrandparent->setLeft(parent);
-            // }
-        }
-        
-    }
-    // root - right - left
-    else if(parent->getLeft() != NULL) {
-        // std::cout << "other one" << std::endl;
-        if(grandparent == this->root_) {
-            std::cout << "5" << std::endl;
-            AVLNode<Key, Value>* child = parent->getLeft();
-            this->root_ = child;
-            this->root_->setRight(parent);
-            parent->setParent(this->root_);
-            this->root_->setLeft(grandparent);
-            grandparent->setParent(this->root_);
-            grandparent->setRight(NULL);
-            parent->setLeft(NULL);
+/**
+* Walks up from parent after the height of its subtree grew by one because
+* current was added below it, updating balances and doing at most one
+* single or double rotation. Balances never leave the range -1..1, even
+* temporarily, so they always fit in the compact node encoding.
+* Returns true if the growth reached the top of the tree, meaning the
+* whole tree is now one level taller.
+*/
+template<class Key, class Value, class Augment>
+bool AVLTree<Key, Value, Augment>::insertFix(AVLNode<Key, Value, Augment>* parent, AVLNode<Key, Value, Augment>* current) {
+    while(parent != NULL && parent->getParent() != NULL) {
+        AVLNode<Key, Value, Augment>* grandparent = parent->getParent();
+        // if the parent is a left child of the grandparent
+        if(grandparent->getLeft() == parent) {
+            // case 1: grandparent is now balanced
+            if(grandparent->getBalance() == 1) {
+                grandparent->setBalance(0);
+                return false;
+            }
+            // case 2: grandparent grew, keep going up
+            else if(grandparent->getBalance() == 0) {
+                grandparent->setBalance(-1);
+                current = parent;
+                parent = grandparent;
+                continue;
+            }
+            // case 3: zig-zig
+            if(parent->getLeft() == current) {
+                rotateRight(grandparent);
+                parent->setBalance(0);
+                grandparent->setBalance(0);
+            }
+            // case 3: zig-zag
+            else {
+                rotateLeft(parent);
+                rotateRight(grandparent);
+                if(current->getBalance() == -1) {
+                    parent->setBalance(0);
+                    grandparent->setBalance(1);
+                }
+                else if(current->getBalance() == 0) {
+                    parent->setBalance(0);
+                    grandparent->setBalance(0);
+                }
+                else {
+                    parent->setBalance(-1);
+                    grandparent->setBalance(0);
+                }
+                current->setBalance(0);
+            }
+            return false;
         }
         else {
-            // std::cout << "4" << std::endl;
-
-            AVLNode<Key, Value>* child = parent->getLeft();
-            // this->root_ = child;
-            child->setRight(parent);
-            parent->setParent(child);
-            child->setLeft(grandparent);
-            child->setParent(greatgrandparent);
-            grandparent->setParent(child);
-            grandparent->setRight(NULL);
-            parent->setLeft(NULL);
-            // if(greatgrandparent->getRight() == grandparent) {
-            //     greatgrandparent->setRight(child);
-            // }
-            // else {
-            //     greatgrandparent->setLeft(child);
-            // }
+            // case 1: grandparent is now balanced
+            if(grandparent->getBalance() == -1) {
+                grandparent->setBalance(0);
+                return false;
+            }
+            // case 2: grandparent grew, keep going up
+            else if(grandparent->getBalance() == 0) {
+                grandparent->setBalance(1);
+                current = parent;
+                parent = grandparent;
+                continue;
+            }
+            // case 3: zig-zig
+            if(parent->getRight() == current) {
+                rotateLeft(grandparent);
+                parent->setBalance(0);
+                grandparent->setBalance(0);
+            }
+            // case 3: zig-zag
+            else {
+                rotateRight(parent);
+                rotateLeft(grandparent);
+                if(current->getBalance() == 1) {
+                    parent->setBalance(0);
+                    grandparent->setBalance(-1);
+                }
+                else if(current->getBalance() == 0) {
+                    parent->setBalance(0);
+                    grandparent->setBalance(0);
+                }
+                else {
+                    parent->setBalance(1);
+                    grandparent->setBalance(0);
+                }
+                current->setBalance(0);
+            }
+            return false;
         }
     }
+    return true;
 }
 
 
+/**
+* Rotates node's left child up into node's place. Balances are left
+* for the caller to fix.
+*/
+template<class Key, class Value, class Augment>
+void AVLTree<Key, Value, Augment>::rotateRight(AVLNode<Key, Value, Augment>* node) {
+    AVLNode<Key, Value, Augment>* child = node->getLeft();
+    AVLNode<Key, Value, Augment>* parent = node->getParent();
+    node->setLeft(child->getRight());
+    if(child->getRight() != NULL) {
+        child->getRight()->setParent(node);
+    }
+    child->setRight(node);
+    node->setParent(child);
+    child->setParent(parent);
+    if(parent == NULL) {
+        this->root_ = child;
+    }
+    else if(parent->getLeft() == node) {
+        parent->setLeft(child);
+    }
+    else {
+        parent->setRight(child);
+    }
+    // node is now below child
+    this->pullUp(node);
+    this->pullUp(child);
+    // node's left slot may have lost its only child
+    this->threadNeighbours(child, node);
+}
+
 
+/**
+* Rotates node's right child up into node's place. Balances are left
+* for the caller to fix.
+*/
+template<class Key, class Value, class Augment>
+void AVLTree<Key, Value, Augment>::rotateLeft(AVLNode<Key, Value, Augment>* node) {
+    AVLNode<Key, Value, Augment>* child = node->getRight();
+    AVLNode<Key, Value, Augment>* parent = node->getParent();
+    node->setRight(child->getLeft());
+    if(child->getLeft() != NULL) {
+        child->getLeft()->setParent(node);
+    }
+    child->setLeft(node);
+    node->setParent(child);
+    child->setParent(parent);
+    if(parent == NULL) {
+        this->root_ = child;
+    }
+    else if(parent->getLeft() == node) {
+        parent->setLeft(child);
+    }
+    else {
+        parent->setRight(child);
+    }
+    // node is now below child
+    this->pullUp(node);
+    this->pullUp(child);
+    this->threadNeighbours(node, child);
+}
 
 
 /*
  * Recall: The writeup specifies that if a node has 2 children you
  * should swap with the predecessor and then remove.
  */
-template<class Key, class Value>
-void AVLTree<Key, Value>:: remove(const Key& key)
+template<class Key, class Value, class Augment>
+void AVLTree<Key, Value, Augment>:: remove(const Key& key)
 {
     // TODO
-	AVLNode<Key, Value>* current = static_cast<AVLNode<Key, Value>*>(this->internalFind(key));
+	AVLNode<Key, Value, Augment>* current = static_cast<AVLNode<Key, Value, Augment>*>(this->internalFind(key));
 		
 	// if there are no nodes, do nothing
 	if(current == NULL) {
 		return;
 	}
+	removeNode(current);
+}
+
+/**
+* Unlinks and destroys n, which is in this tree, then restores the AVL
+* property on the way up.
+*/
+template<class Key, class Value, class Augment>
+void AVLTree<Key, Value, Augment>::removeNode(Node<Key, Value, Augment>* n)
+{
+	AVLNode<Key, Value, Augment>* current = static_cast<AVLNode<Key, Value, Augment>*>(n);
 	// if there are two children
-    bool isTwo = false;
 	if(current->getRight() != NULL && current->getLeft() != NULL) {
-		AVLNode<Key, Value>* pred = static_cast<AVLNode<Key, Value>*>(this->predecessor(current));
+		AVLNode<Key, Value, Augment>* pred = static_cast<AVLNode<Key, Value, Augment>*>(this->predecessor(current));
 		nodeSwap(current, pred);
-        isTwo = true;
 	}
-    int diff = 0;
-    AVLNode<Key, Value>* p = current->getParent();
-    if(p != NULL) {
-        if(p->getLeft() == current) {
-            p->setLeft(current);
-            diff = 1;
-        }
-        else {
-            p->setRight(current);
-            diff = -1;
-        }
-    }
-	// if there are no children
-	if(current->getLeft() == NULL && current->getRight() == NULL) {
-		if(current == this->root_) {
-			this->root_ = NULL;
-		}
-		else if(current->getParent()->getLeft() == current) {
-			current->getParent()->updateBalance(1);
-            current->getParent()->setLeft(NULL);
+	this->updateBoundsBeforeRemove(current);
+	// diff is the change in the parent's balance once current is gone
+	int diff = 0;
+	AVLNode<Key, Value, Augment>* p = current->getParent();
+	if(p != NULL) {
+		if(p->getLeft() == current) {
+			diff = 1;
 		}
 		else {
-            current->getParent()->updateBalance(-1);
-			current->getParent()->setRight(NULL);
+			diff = -1;
 		}
-		// delete current;
-		// current = nullptr;
-		// return;
 	}
-	// one child, promote the child to current spot
-	else if(current->getLeft() != NULL && current->getRight() == NULL) {
-		current->getLeft()->setParent(current->getParent());
-		if(current == this->root_) {
-			this->root_ = current->getLeft();
-		}
-		else if(current->getParent()->getRight() == current) {
-            current->getParent()->updateBalance(-1);
-			current->getParent()->setRight(current->getLeft());
-		}
-		else {
-            current->getParent()->updateBalance(1);
-			current->getParent()->setLeft(current->getLeft());
-		}
-		// delete current;
-		// current = nullptr;
-		// return;
+	// promote the only child (if any) to current's spot
+	AVLNode<Key, Value, Augment>* child = current->getLeft();
+	if(child == NULL) {
+		child = current->getRight();
 	}
-	else if(current->getRight() != NULL && current->getLeft() == NULL) {
-		current->getRight()->setParent(current->getParent());
-		if(current == this->root_) {
-			this->root_ = current->getRight();
-		}
-		else if(current->getParent()->getRight() == current) {
-            current->getParent()->updateBalance(-1);
-			current->getParent()->setRight(current->getRight());
-		}
-		else {
-            current->getParent()->updateBalance(1);
-			current->getParent()->setLeft(current->getRight());
-		}
-		// delete current;
-		// current = nullptr;
-		// return;
+	if(child != NULL) {
+		child->setParent(p);
+	}
+	if(p == NULL) {
+		this->root_ = child;
+	}
+	else if(p->getLeft() == current) {
+		p->setLeft(child);
 	}
-	delete current;
+	else {
+		p->setRight(child);
+	}
+	this->finishRemove(current, p);
 	current = nullptr;
-    if(!isTwo) {
-        if(this->root_ != NULL && ((this->root_->getLeft() != NULL && this->root_->getLeft()->getLeft() != NULL) || (this->root_->getRight() != NULL && this->root_->getRight()->getRight() != NULL))) {
-            std::cout << "HERE" << std::endl;
-            removeFix(p, diff);
-        }
-    }
+	if(removeFix(p, diff) && height_ != BinarySearchTree<Key, Value, Augment>::UNKNOWN_HEIGHT) {
+		--height_;
+	}
 }
 
 
-template<class Key, class Value>
-void AVLTree<Key, Value>::removeFix(AVLNode<Key,Value>* parent, int diff) {
-    if(diff == -1) {
-        rotateRight(parent->getLeft());
-    }
-    else if(diff == 1) {
-        rotateLeft(parent->getRight());
+/**
+* Walks up from node after one of its subtrees shrank by one (diff is +1 if
+* it was the left subtree, -1 if it was the right), rotating where needed.
+* Unlike insertion, removal may need a rotation at every level.
+* Returns true if the shrinking reached the top, so the whole tree is
+* now one level shorter (always the case when node is NULL).
+*/
+template<class Key, class Value, class Augment>
+bool AVLTree<Key, Value, Augment>::removeFix(AVLNode<Key, Value, Augment>* node, int diff) {
+    while(node != NULL) {
+        // work out the diff for the next level before rotations move node
+        AVLNode<Key, Value, Augment>* parent = node->getParent();
+        int nextDiff = 0;
+        if(parent != NULL) {
+            nextDiff = (parent->getLeft() == node) ? 1 : -1;
+        }
+
+        if(diff == -1) {
+            // balance would become -2: the left side is too tall
+            if(node->getBalance() == -1) {
+                AVLNode<Key, Value, Augment>* child = node->getLeft();
+                if(child->getBalance() == -1) {
+                    rotateRight(node);
+                    node->setBalance(0);
+                    child->setBalance(0);
+                }
+                else if(child->getBalance() == 0) {
+                    rotateRight(node);
+                    node->setBalance(-1);
+                    child->setBalance(1);
+                    return false;
+                }
+                else {
+                    AVLNode<Key, Value, Augment>* grandchild = child->getRight();
+                    rotateLeft(child);
+                    rotateRight(node);
+                    if(grandchild->getBalance() == 1) {
+                        node->setBalance(0);
+                        child->setBalance(-1);
+                    }
+                    else if(grandchild->getBalance() == 0) {
+                        node->setBalance(0);
+                        child->setBalance(0);
+                    }
+                    else {
+                        node->setBalance(1);
+                        child->setBalance(0);
+                    }
+                    grandchild->setBalance(0);
+                }
+            }
+            else if(node->getBalance() == 0) {
+                node->setBalance(-1);
+                return false;
+            }
+            else {
+                node->setBalance(0);
+            }
+        }
+        else {
+            // balance would become +2: the right side is too tall
+            if(node->getBalance() == 1) {
+                AVLNode<Key, Value, Augment>* child = node->getRight();
+                if(child->getBalance() == 1) {
+                    rotateLeft(node);
+                    node->setBalance(0);
+                    child->setBalance(0);
+                }
+                else if(child->getBalance() == 0) {
+                    rotateLeft(node);
+                    node->setBalance(1);
+                    child->setBalance(-1);
+                    return false;
+                }
+                else {
+                    AVLNode<Key, Value, Augment>* grandchild = child->getLeft();
+                    rotateRight(child);
+                    rotateLeft(node);
+                    if(grandchild->getBalance() == -1) {
+                        node->setBalance(0);
+                        child->setBalance(1);
+                    }
+                    else if(grandchild->getBalance() == 0) {
+                        node->setBalance(0);
+                        child->setBalance(0);
+                    }
+                    else {
+                        node->setBalance(-1);
+                        child->setBalance(0);
+                    }
+                    grandchild->setBalance(0);
+                }
+            }
+            else if(node->getBalance() == 0) {
+                node->setBalance(1);
+                return false;
+            }
+            else {
+                node->setBalance(0);
+            }
+        }
+        // the subtree got shorter, so keep going up
+        node = parent;
+        diff = nextDiff;
     }
+    return true;
 }
 
 
-template<class Key, class Value>
-void AVLTree<Key, Value>::nodeSwap( AVLNode<Key,Value>* n1, AVLNode<Key,Value>* n2)
+template<class Key, class Value, class Augment>
+void AVLTree<Key, Value, Augment>::nodeSwap( AVLNode<Key, Value, Augment>* n1, AVLNode<Key, Value, Augment>* n2)
 {
-    BinarySearchTree<Key, Value>::nodeSwap(n1, n2);
+    BinarySearchTree<Key, Value, Augment>::nodeSwap(n1, n2);
     int8_t tempB = n1->getBalance();
     n1->setBalance(n2->getBalance());
     n2->setBalance(tempB);
@@ -0,0 +1,646 @@
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <algorithm>
+#include <random>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include "bst.h"
+#include "avlbst.h"
+#include "persistent_avl.h"
+
+using namespace std;
+
+// Number of keys in the large trees, which do not fit in cache
+static const size_t NUM_KEYS = 1000000;
+// Number of keys in the small trees, which stay cache resident
+static const size_t NUM_SMALL_KEYS = 10000;
+static const size_t SMALL_ROUNDS = 100;
+
+// Returns the seconds elapsed since start
+static double secondsSince(chrono::steady_clock::time_point start)
+{
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+// Prints one result line as millions of operations per second
+static void report(const char* name, size_t ops, double seconds)
+{
+    cout << left << setw(36) << name << right << setw(10) << fixed << setprecision(2)
+         << (ops / seconds) / 1e6 << " Mops/s" << endl;
+}
+
+// Prints one result line as microseconds per operation, for operations
+// too slow or too quick to read well in Mops/s
+static void reportLatency(const char* name, size_t ops, double seconds)
+{
+    cout << left << setw(36) << name << right << setw(10) << fixed << setprecision(3)
+         << seconds * 1e6 / ops << " us/op" << endl;
+}
+
+// Returns the keys 0..n-1 in a random order
+static vector<uint64_t> shuffledKeys(size_t n)
+{
+    vector<uint64_t> keys(n);
+    for(size_t i = 0; i < n; ++i) {
+        keys[i] = i;
+    }
+    mt19937_64 rng(104);
+    shuffle(keys.begin(), keys.end(), rng);
+    return keys;
+}
+
+// Looks up every key rounds times, in a different random order than insertion
+template<typename Tree>
+void benchLookup(const char* name, Tree& tree, vector<uint64_t> keys, size_t rounds)
+{
+    mt19937_64 rng(4);
+    shuffle(keys.begin(), keys.end(), rng);
+    uint64_t checksum = 0;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for(size_t r = 0; r < rounds; ++r) {
+        for(size_t i = 0; i < keys.size(); ++i) {
+            checksum += tree.find(keys[i])->second;
+        }
+    }
+    report(name, keys.size() * rounds, secondsSince(start));
+    if(checksum == 0) cout << "unexpected checksum" << endl;
+}
+
+// Walks the whole tree with the iterator rounds times
+template<typename Tree>
+void benchIteration(const char* name, Tree& tree, size_t size, size_t rounds)
+{
+    uint64_t checksum = 0;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for(size_t r = 0; r < rounds; ++r) {
+        for(typename Tree::iterator it = tree.begin(); it != tree.end(); ++it) {
+            checksum += it->second;
+        }
+    }
+    report(name, size * rounds, secondsSince(start));
+    if(checksum == 0) cout << "unexpected checksum" << endl;
+}
+
+// Lookup and iteration over a BinarySearchTree built from the given keys
+void benchBST(const char* lookupName, const char* scanName, const vector<uint64_t>& keys, size_t rounds)
+{
+    BinarySearchTree<uint64_t, uint64_t> bt;
+    for(size_t i = 0; i < keys.size(); ++i) {
+        bt.insert(make_pair(keys[i], keys[i] + 1));
+    }
+    benchLookup(lookupName, bt, keys, rounds);
+    benchIteration(scanName, bt, keys.size(), rounds);
+}
+
+// Inserts NUM_KEYS increasing keys into an AVLTree, like a timestamp stream
+void benchSequentialIngest()
+{
+    AVLTree<uint64_t, uint64_t> plain;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for(uint64_t i = 0; i < NUM_KEYS; ++i) {
+        plain.insert(make_pair(i, i));
+    }
+    report("AVL sequential insert", NUM_KEYS, secondsSince(start));
+
+    AVLTree<uint64_t, uint64_t> hinted;
+    start = chrono::steady_clock::now();
+    for(uint64_t i = 0; i < NUM_KEYS; ++i) {
+        hinted.insert(hinted.end(), make_pair(i, i));
+    }
+    report("AVL sequential insert, end() hint", NUM_KEYS, secondsSince(start));
+}
+
+// Drains an AVLTree in key order, as a priority queue would, first by
+// removing the key found through begin() and then with front() and pop_min()
+void benchPriorityQueue(const vector<uint64_t>& keys)
+{
+    AVLTree<uint64_t, uint64_t> searched;
+    AVLTree<uint64_t, uint64_t> popped;
+    for(size_t i = 0; i < keys.size(); ++i) {
+        searched.insert(make_pair(keys[i], keys[i]));
+        popped.insert(make_pair(keys[i], keys[i]));
+    }
+    uint64_t checksum = 0;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    while(!searched.empty()) {
+        uint64_t key = searched.begin()->first;
+        checksum += key;
+        searched.remove(key);
+    }
+    report("AVL drain, begin() + remove(key)", keys.size(), secondsSince(start));
+
+    start = chrono::steady_clock::now();
+    while(!popped.empty()) {
+        checksum += popped.front().second;
+        popped.pop_min();
+    }
+    report("AVL drain, front() + pop_min()", keys.size(), secondsSince(start));
+    if(checksum == 0) cout << "unexpected checksum" << endl;
+}
+
+// Copies an AVLTree by reinserting every item, then with the copy
+// constructor's structural clone, and times moving the clone
+void benchTreeCopy(const vector<uint64_t>& keys)
+{
+    AVLTree<uint64_t, uint64_t> source;
+    for(size_t i = 0; i < keys.size(); ++i) {
+        source.insert(make_pair(keys[i], keys[i]));
+    }
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    AVLTree<uint64_t, uint64_t> reinserted;
+    for(AVLTree<uint64_t, uint64_t>::iterator it = source.begin(); it != source.end(); ++it) {
+        reinserted.insert(*it);
+    }
+    report("AVL copy, reinsert each item", keys.size(), secondsSince(start));
+
+    start = chrono::steady_clock::now();
+    AVLTree<uint64_t, uint64_t> cloned(source);
+    report("AVL copy, structural clone", keys.size(), secondsSince(start));
+
+    start = chrono::steady_clock::now();
+    AVLTree<uint64_t, uint64_t> moved(std::move(cloned));
+    reportLatency("AVL move constructor", 1, secondsSince(start));
+    if(moved.size() != reinserted.size() || !cloned.empty()) cout << "unexpected copy" << endl;
+}
+
+// Compares a consistent read view of a 1M-key map taken by copying an
+// AVLTree with PersistentAVLTree::snapshot(), then the cost of updates
+// while an old snapshot is held and the memory that snapshot retains
+void benchSnapshots(const vector<uint64_t>& keys)
+{
+    AVLTree<uint64_t, uint64_t> at;
+    PersistentAVLTree<uint64_t, uint64_t> pt;
+    for(size_t i = 0; i < keys.size(); ++i) {
+        at.insert(make_pair(keys[i], keys[i]));
+        pt.insert(make_pair(keys[i], keys[i]));
+    }
+    static const int COPIES = 10;
+    static const int SNAPSHOTS = 1000;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for(int i = 0; i < COPIES; ++i) {
+        AVLTree<uint64_t, uint64_t> view(at);
+    }
+    reportLatency("AVL read view, copy the tree", COPIES, secondsSince(start));
+    start = chrono::steady_clock::now();
+    for(int i = 0; i < SNAPSHOTS; ++i) {
+        PersistentAVLTree<uint64_t, uint64_t>::Snapshot view = pt.snapshot();
+    }
+    reportLatency("Persistent read view, snapshot()", SNAPSHOTS, secondsSince(start));
+
+    static const size_t UPDATES = 100000;
+    start = chrono::steady_clock::now();
+    for(size_t i = 0; i < UPDATES; ++i) {
+        at.insert(make_pair(keys[i], i));
+    }
+    report("AVL update in place", UPDATES, secondsSince(start));
+    PersistentAVLTree<uint64_t, uint64_t>::Snapshot held = pt.snapshot();
+    start = chrono::steady_clock::now();
+    for(size_t i = 0; i < UPDATES; ++i) {
+        pt.insert(make_pair(keys[i], i));
+    }
+    report("Persistent update, snapshot held", UPDATES, secondsSince(start));
+    cout << left << setw(36) << "Persistent memory, current version" << right
+         << setw(10) << pt.memoryUsage() / (1024 * 1024) << " MiB" << endl;
+    cout << left << setw(36) << "Retained by the held snapshot" << right
+         << setw(10) << pt.retainedMemory(held) / (1024 * 1024) << " MiB" << endl;
+}
+
+// Times clear() on trees whose values need their destructors run: a
+// balanced tree, and a BST fed sorted keys, which is one long right spine
+void benchClear(const vector<uint64_t>& keys)
+{
+    AVLTree<uint64_t, string> balanced;
+    for(size_t i = 0; i < keys.size(); ++i) {
+        balanced.insert(make_pair(keys[i], string("value")));
+    }
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    balanced.clear();
+    report("AVL clear, string values", keys.size(), secondsSince(start));
+
+    BinarySearchTree<uint64_t, string> spine;
+    for(uint64_t i = 0; i < NUM_KEYS; ++i) {
+        spine.insert(spine.end(), make_pair(i, string("value")));
+    }
+    start = chrono::steady_clock::now();
+    spine.clear();
+    report("BST clear, 1M-deep spine", NUM_KEYS, secondsSince(start));
+}
+
+// Loads NUM_KEYS sorted items into an AVLTree by repeated insertion and by buildFromSorted
+void benchBulkLoad()
+{
+    vector<pair<uint64_t, uint64_t> > items(NUM_KEYS);
+    for(size_t i = 0; i < NUM_KEYS; ++i) {
+        items[i] = make_pair(uint64_t(i), uint64_t(i));
+    }
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    {
+        AVLTree<uint64_t, uint64_t> inserted;
+        for(size_t i = 0; i < items.size(); ++i) {
+            inserted.insert(items[i]);
+        }
+    }
+    report("AVL load sorted, insert loop", NUM_KEYS, secondsSince(start));
+
+    start = chrono::steady_clock::now();
+    {
+        AVLTree<uint64_t, uint64_t> built(items.begin(), items.end());
+    }
+    report("AVL load sorted, buildFromSorted", NUM_KEYS, secondsSince(start));
+}
+
+// Loads an AVLTree from NUM_KEYS unsorted records with repeated keys, by
+// inserting them one at a time, by sorting, deduplicating and calling
+// buildFromSorted() on one thread, and by parallelBuild()
+void benchParallelBuild()
+{
+    vector<pair<uint64_t, uint64_t> > records(NUM_KEYS);
+    mt19937_64 rng(24);
+    for(size_t i = 0; i < NUM_KEYS; ++i) {
+        records[i] = make_pair(rng() % NUM_KEYS, uint64_t(i));
+    }
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    AVLTree<uint64_t, uint64_t> inserted;
+    for(size_t i = 0; i < records.size(); ++i) {
+        inserted.insert(records[i]);
+    }
+    report("AVL load unsorted, insert loop", NUM_KEYS, secondsSince(start));
+
+    start = chrono::steady_clock::now();
+    {
+        vector<pair<uint64_t, uint64_t> > sorted(records);
+        stable_sort(sorted.begin(), sorted.end(),
+                    [](const pair<uint64_t, uint64_t>& a, const pair<uint64_t, uint64_t>& b) { return a.first < b.first; });
+        // keep the last record of each key, as insert() does
+        vector<pair<uint64_t, uint64_t> > unique;
+        for(size_t i = 0; i < sorted.size(); ++i) {
+            if(i + 1 == sorted.size() || sorted[i].first != sorted[i + 1].first) {
+                unique.push_back(sorted[i]);
+            }
+        }
+        AVLTree<uint64_t, uint64_t> built(unique.begin(), unique.end());
+    }
+    report("AVL load unsorted, sort + build", NUM_KEYS, secondsSince(start));
+
+    unsigned cores = max(1u, thread::hardware_concurrency());
+    for(unsigned threads = 1; threads <= cores; threads *= 2) {
+        start = chrono::steady_clock::now();
+        AVLTree<uint64_t, uint64_t> built;
+        built.parallelBuild(records.begin(), records.end(), threads);
+        double seconds = secondsSince(start);
+        string name = "AVL load unsorted, parallelBuild x" + to_string(threads);
+        report(name.c_str(), NUM_KEYS, seconds);
+        if(built.size() != inserted.size() || built.front() != inserted.front()) cout << "unexpected build" << endl;
+    }
+}
+
+// Combines two AVLTrees of NUM_KEYS / 2 interleaved keys, by inserting one
+// into the other and by merge()
+void benchMerge()
+{
+    vector<pair<uint64_t, uint64_t> > evens;
+    vector<pair<uint64_t, uint64_t> > odds;
+    for(uint64_t i = 0; i < NUM_KEYS; i += 2) {
+        evens.push_back(make_pair(i, i));
+        odds.push_back(make_pair(i + 1, i + 1));
+    }
+
+    {
+        AVLTree<uint64_t, uint64_t> target(evens.begin(), evens.end());
+        AVLTree<uint64_t, uint64_t> source(odds.begin(), odds.end());
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for(AVLTree<uint64_t, uint64_t>::iterator it = source.begin(); it != source.end(); ++it) {
+            target.insert(*it);
+        }
+        report("AVL combine 2x500k, insert loop", NUM_KEYS / 2, secondsSince(start));
+    }
+    {
+        AVLTree<uint64_t, uint64_t> target(evens.begin(), evens.end());
+        AVLTree<uint64_t, uint64_t> source(odds.begin(), odds.end());
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        target.merge(source);
+        report("AVL combine 2x500k, merge", NUM_KEYS / 2, secondsSince(start));
+    }
+}
+
+// Splits a 1M-key AVLTree at a random key and joins it back together
+void benchSplitJoin()
+{
+    static const size_t ROUNDS = 100000;
+    vector<pair<uint64_t, uint64_t> > items;
+    for(uint64_t i = 0; i < NUM_KEYS; ++i) {
+        items.push_back(make_pair(2 * i, i));
+    }
+    AVLTree<uint64_t, uint64_t> tree(items.begin(), items.end());
+    mt19937_64 rng(9);
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for(size_t r = 0; r < ROUNDS; ++r) {
+        // odd pivots are never in the tree, and stay in it afterwards
+        uint64_t pivot = 2 * (rng() % NUM_KEYS) + 1;
+        AVLTree<uint64_t, uint64_t> upper;
+        tree.split(pivot, upper);
+        tree.join(tree, make_pair(pivot, uint64_t(0)), upper);
+    }
+    report("AVL split + join, 1M keys", ROUNDS, secondsSince(start));
+}
+
+// Joins a small AVLTree whose arena holds 1M free slots into a new tree,
+// over and over, as ShardedAVLMap does when it moves a cut; the cost must
+// not depend on the free slots that come along
+void benchJoinFreeSlots()
+{
+    static const size_t ROUNDS = 1000;
+    AVLTree<uint64_t, uint64_t> tree;
+    for(uint64_t i = 0; i < NUM_KEYS; ++i) {
+        tree.insert(make_pair(i, i));
+    }
+    for(uint64_t i = 16; i < NUM_KEYS; ++i) {
+        tree.remove(i);
+    }
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for(size_t r = 0; r < ROUNDS; ++r) {
+        AVLTree<uint64_t, uint64_t> joined;
+        AVLTree<uint64_t, uint64_t> empty;
+        joined.join(tree, make_pair(uint64_t(100), uint64_t(r)), empty);
+        joined.remove(100);
+        tree = std::move(joined);
+    }
+    report("AVL join, 16 keys + 1M free slots", ROUNDS, secondsSince(start));
+}
+
+// Percentile queries on a 1M-key AVLTree augmented with subtree sizes,
+// and what the augmentation costs random insertion
+void benchOrderStatistics(const vector<uint64_t>& keys)
+{
+    AVLTree<uint64_t, uint64_t> plain;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for(size_t i = 0; i < keys.size(); ++i) {
+        plain.insert(make_pair(keys[i], keys[i]));
+    }
+    report("AVL random insert", keys.size(), secondsSince(start));
+
+    AVLTree<uint64_t, uint64_t, SubtreeSize> sized;
+    start = chrono::steady_clock::now();
+    for(size_t i = 0; i < keys.size(); ++i) {
+        sized.insert(make_pair(keys[i], keys[i]));
+    }
+    report("AVL random insert, SubtreeSize", keys.size(), secondsSince(start));
+
+    uint64_t checksum = 0;
+    start = chrono::steady_clock::now();
+    for(size_t i = 0; i < keys.size(); ++i) {
+        checksum += sized.select(keys[i])->second;
+    }
+    report("AVL select(k), 1M keys", keys.size(), secondsSince(start));
+    start = chrono::steady_clock::now();
+    for(size_t i = 0; i < keys.size(); ++i) {
+        checksum += sized.rank(keys[i]);
+    }
+    report("AVL rank(key), 1M keys", keys.size(), secondsSince(start));
+    if(checksum == 0) cout << "unexpected checksum" << endl;
+}
+
+// Sums the values of 1000-key windows of a 1M-key AVLTree, by filtering a
+// full iterator walk, by range() and with a Sum augmentation; reports the
+// keys in windows per second
+void benchRangeScan(const vector<uint64_t>& keys)
+{
+    static const uint64_t WINDOW = 1000;
+    static const size_t LINEAR_ROUNDS = 10;
+    static const size_t RANGE_ROUNDS = 10000;
+    AVLTree<uint64_t, uint64_t> tree;
+    for(size_t i = 0; i < keys.size(); ++i) {
+        tree.insert(make_pair(keys[i], keys[i]));
+    }
+    mt19937_64 rng(5);
+    uint64_t checksum = 0;
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for(size_t r = 0; r < LINEAR_ROUNDS; ++r) {
+        uint64_t lo = rng() % (NUM_KEYS - WINDOW);
+        for(AVLTree<uint64_t, uint64_t>::iterator it = tree.begin(); it != tree.end(); ++it) {
+            if(it->first >= lo && it->first < lo + WINDOW) {
+                checksum += it->second;
+            }
+        }
+    }
+    report("AVL 1000-key window, filtered scan", LINEAR_ROUNDS * WINDOW, secondsSince(start));
+
+    start = chrono::steady_clock::now();
+    for(size_t r = 0; r < RANGE_ROUNDS; ++r) {
+        uint64_t lo = rng() % (NUM_KEYS - WINDOW);
+        AVLTree<uint64_t, uint64_t>::range_view window = tree.range(lo, lo + WINDOW);
+        for(AVLTree<uint64_t, uint64_t>::iterator it = window.begin(); it != window.end(); ++it) {
+            checksum += it->second;
+        }
+    }
+    report("AVL 1000-key window, range()", RANGE_ROUNDS * WINDOW, secondsSince(start));
+
+    AVLTree<uint64_t, uint64_t, Sum<uint64_t> > summed;
+    for(size_t i = 0; i < keys.size(); ++i) {
+        summed.insert(make_pair(keys[i], keys[i]));
+    }
+    start = chrono::steady_clock::now();
+    for(size_t r = 0; r < RANGE_ROUNDS; ++r) {
+        uint64_t lo = rng() % (NUM_KEYS - WINDOW);
+        checksum += summed.aggregate(lo, lo + WINDOW);
+    }
+    report("AVL 1000-key window, Sum aggregate()", RANGE_ROUNDS * WINDOW, secondsSince(start));
+    if(checksum == 0) cout << "unexpected checksum" << endl;
+}
+
+// Adds up the values it is called on, for the for_each() benchmarks
+struct SumValues
+{
+    uint64_t* total;
+    void operator()(const pair<const uint64_t, uint64_t>& item) const { *total += item.second; }
+};
+
+// Full and windowed scans of a tree much larger than the last-level cache,
+// through the iterator, for_each() and parallel_reduce(). The keys are inserted in a
+// random order, so nodes that are neighbours in key order are far apart.
+void benchBulkScan(const vector<uint64_t>& keys)
+{
+    static const size_t FULL_ROUNDS = 5;
+    static const uint64_t WINDOW = 1000;
+    static const size_t RANGE_ROUNDS = 10000;
+    AVLTree<uint64_t, uint64_t> tree;
+    for(size_t i = 0; i < keys.size(); ++i) {
+        tree.insert(make_pair(keys[i], keys[i]));
+    }
+    uint64_t checksum = 0;
+    SumValues sum = { &checksum };
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for(size_t r = 0; r < FULL_ROUNDS; ++r) {
+        for(AVLTree<uint64_t, uint64_t>::iterator it = tree.begin(); it != tree.end(); ++it) {
+            checksum += it->second;
+        }
+    }
+    report("AVL 1M keys, iterator scan", FULL_ROUNDS * keys.size(), secondsSince(start));
+
+    start = chrono::steady_clock::now();
+    for(size_t r = 0; r < FULL_ROUNDS; ++r) {
+        tree.for_each(sum);
+    }
+    report("AVL 1M keys, for_each() scan", FULL_ROUNDS * keys.size(), secondsSince(start));
+
+    unsigned cores = max(1u, thread::hardware_concurrency());
+    for(unsigned threads = 1; threads <= cores; threads *= 2) {
+        uint64_t total = 0;
+        start = chrono::steady_clock::now();
+        for(size_t r = 0; r < FULL_ROUNDS; ++r) {
+            total += tree.parallel_reduce(uint64_t(0),
+                [](const pair<const uint64_t, uint64_t>& item) { return item.second; },
+                [](uint64_t a, uint64_t b) { return a + b; }, threads);
+        }
+        string name = "AVL 1M keys, parallel_reduce x" + to_string(threads);
+        report(name.c_str(), FULL_ROUNDS * keys.size(), secondsSince(start));
+        checksum += total;
+    }
+
+    mt19937_64 rng(6);
+    start = chrono::steady_clock::now();
+    for(size_t r = 0; r < RANGE_ROUNDS; ++r) {
+        uint64_t lo = rng() % (NUM_KEYS - WINDOW);
+        AVLTree<uint64_t, uint64_t>::range_view window = tree.range(lo, lo + WINDOW);
+        for(AVLTree<uint64_t, uint64_t>::iterator it = window.begin(); it != window.end(); ++it) {
+            checksum += it->second;
+        }
+    }
+    report("AVL 1000-key window, range() iterator", RANGE_ROUNDS * WINDOW, secondsSince(start));
+
+    start = chrono::steady_clock::now();
+    for(size_t r = 0; r < RANGE_ROUNDS; ++r) {
+        uint64_t lo = rng() % (NUM_KEYS - WINDOW);
+        tree.for_each_range(lo, lo + WINDOW, sum);
+    }
+    report("AVL 1000-key window, for_each_range", RANGE_ROUNDS * WINDOW, secondsSince(start));
+    if(checksum == 0) cout << "unexpected checksum" << endl;
+}
+
+// A large payload that counts how often it is copied and moved
+struct CountedPayload
+{
+    static size_t copies;
+    static size_t moves;
+
+    CountedPayload() : data(4096, 'x') { }
+    CountedPayload(const CountedPayload& other) : data(other.data) { ++copies; }
+    CountedPayload(CountedPayload&& other) : data(std::move(other.data)) { ++moves; }
+    CountedPayload& operator=(const CountedPayload& other) { data = other.data; ++copies; return *this; }
+    CountedPayload& operator=(CountedPayload&& other) { data = std::move(other.data); ++moves; return *this; }
+
+    static void reset() { copies = 0; moves = 0; }
+
+    string data;
+};
+size_t CountedPayload::copies = 0;
+size_t CountedPayload::moves = 0;
+
+ostream& operator<<(ostream& out, const CountedPayload& p)
+{
+    return out << p.data.size() << " bytes";
+}
+
+// Prints the copies and moves of the payload per operation
+static void reportCopies(const char* name, size_t ops)
+{
+    cout << left << setw(36) << name << right << fixed << setprecision(2)
+         << setw(6) << double(CountedPayload::copies) / ops << " copies "
+         << setw(6) << double(CountedPayload::moves) / ops << " moves per op" << endl;
+}
+
+// Counts payload copies and moves for each way of inserting into an AVLTree,
+// for both new keys and keys that are already present (the overwrite path)
+void benchCopies()
+{
+    static const int OPS = 1000;
+    AVLTree<int, CountedPayload> at;
+
+    CountedPayload::reset();
+    for(int i = 0; i < OPS; ++i) {
+        at.insert(make_pair(i, CountedPayload()));
+    }
+    reportCopies("insert(pair&&), new key", OPS);
+    CountedPayload::reset();
+    for(int i = 0; i < OPS; ++i) {
+        at.insert(make_pair(i, CountedPayload()));
+    }
+    reportCopies("insert(pair&&), existing key", OPS);
+
+    at.clear();
+    CountedPayload::reset();
+    for(int i = 0; i < OPS; ++i) {
+        CountedPayload p;
+        at.insert_or_assign(i, std::move(p));
+    }
+    reportCopies("insert_or_assign(k, v&&), new key", OPS);
+    CountedPayload::reset();
+    for(int i = 0; i < OPS; ++i) {
+        CountedPayload p;
+        at.insert_or_assign(i, std::move(p));
+    }
+    reportCopies("insert_or_assign(k, v&&), existing", OPS);
+
+    at.clear();
+    CountedPayload::reset();
+    for(int i = 0; i < OPS; ++i) {
+        at.try_emplace(i);
+    }
+    reportCopies("try_emplace(k), new key", OPS);
+}
+
+// Reports the node size and the node memory per entry of a tree
+template<typename Tree, typename NodeType>
+void reportMemory(const char* name, const Tree& tree, size_t entries)
+{
+    cout << left << setw(36) << name << right
+         << setw(4) << sizeof(NodeType) << " B/node "
+         << setw(8) << fixed << setprecision(2) << double(tree.memoryUsage()) / entries << " B/entry" << endl;
+}
+
+// Node memory of AVLTree<uint64_t, uint64_t> with the current node layout
+void benchAVLMemory(const vector<uint64_t>& keys)
+{
+    AVLTree<uint64_t, uint64_t> at;
+    for(size_t i = 0; i < keys.size(); ++i) {
+        at.insert(make_pair(keys[i], keys[i] + 1));
+    }
+#ifdef AVL_COMPACT_NODES
+    reportMemory<AVLTree<uint64_t, uint64_t>, AVLNode<uint64_t, uint64_t> >("AVL memory (compact nodes)", at, keys.size());
+#else
+    reportMemory<AVLTree<uint64_t, uint64_t>, AVLNode<uint64_t, uint64_t> >("AVL memory", at, keys.size());
+#endif
+}
+
+int main(int argc, char *argv[])
+{
+    vector<uint64_t> keys = shuffledKeys(NUM_KEYS);
+    vector<uint64_t> smallKeys = shuffledKeys(NUM_SMALL_KEYS);
+
+    benchBST("BST find, 10k keys", "BST iterator scan, 10k keys", smallKeys, SMALL_ROUNDS);
+    benchBST("BST find, 1M keys", "BST iterator scan, 1M keys", keys, 1);
+    benchAVLMemory(keys);
+    benchSequentialIngest();
+    benchBulkLoad();
+    benchParallelBuild();
+    benchMerge();
+    benchSplitJoin();
+    benchJoinFreeSlots();
+    benchOrderStatistics(keys);
+    benchRangeScan(keys);
+    benchBulkScan(keys);
+    benchClear(keys);
+    benchPriorityQueue(keys);
+    benchTreeCopy(keys);
+    benchSnapshots(keys);
+    benchCopies();
+
+    return 0;
+}
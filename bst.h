@@ -4,21 +4,207 @@
 #include <iostream>
 #include <exception>
 #include <cstdlib>
+#include <cstddef>
 #include <utility>
+#include <tuple>
+#include <cstdint>
+#include <type_traits>
+#include <iterator>
+#include <algorithm>
+#include <vector>
+#include <limits>
+#include <typeinfo>
+#include "node_arena.h"
+#include "work_stealing.h"
+
+// Asks the CPU to start loading the memory at p, if the compiler supports it
+#if defined(__GNUC__)
+#define BST_PREFETCH(p) __builtin_prefetch(p)
+#else
+#define BST_PREFETCH(p) ((void)(p))
+#endif
+
+/**
+* Augmentation policies. A search tree can keep, in every node, an
+* aggregate of all the items in that node's subtree, given as the third
+* template argument of the tree. A policy defines the aggregate's
+* value_type, lift() to summarize one item, identity() to summarize
+* nothing, and an associative combine() that merges summaries in key
+* order. NoAugment, the default, stores nothing and costs nothing.
+*/
+struct NoAugment { };
+
+/**
+* Keeps the number of items in every subtree. This gives trees
+* rank(), select() and count_range() in O(log n).
+*/
+struct SubtreeSize
+{
+    typedef std::size_t value_type;
+
+    template<typename Key, typename Value>
+    static value_type lift(const Key& key, const Value& value) { return 1; }
+    static value_type identity() { return 0; }
+    static value_type combine(const value_type& left, const value_type& right) { return left + right; }
+    static std::size_t count(const value_type& aggregate) { return aggregate; }
+};
+
+/**
+* Keeps the sum of the values in every subtree, as a T.
+*/
+template<typename T>
+struct Sum
+{
+    typedef T value_type;
+
+    template<typename Key, typename Value>
+    static value_type lift(const Key& key, const Value& value) { return value; }
+    static value_type identity() { return T(); }
+    static value_type combine(const value_type& left, const value_type& right) { return left + right; }
+};
+
+/**
+* Keeps the smallest value in every subtree. An empty range has the
+* largest T as its minimum.
+*/
+template<typename T>
+struct Min
+{
+    typedef T value_type;
+
+    template<typename Key, typename Value>
+    static value_type lift(const Key& key, const Value& value) { return value; }
+    static value_type identity() { return std::numeric_limits<T>::max(); }
+    static value_type combine(const value_type& left, const value_type& right) { return (right < left) ? right : left; }
+};
+
+/**
+* Keeps the largest value in every subtree. An empty range has the
+* lowest T as its maximum.
+*/
+template<typename T>
+struct Max
+{
+    typedef T value_type;
+
+    template<typename Key, typename Value>
+    static value_type lift(const Key& key, const Value& value) { return value; }
+    static value_type identity() { return std::numeric_limits<T>::lowest(); }
+    static value_type combine(const value_type& left, const value_type& right) { return (left < right) ? right : left; }
+};
+
+/**
+* Pairs another augmentation with subtree sizes, so that a tree can
+* answer both aggregate() and the order statistics. Aggregates are
+* std::pairs of the size and the inner policy's aggregate.
+*/
+template<typename Inner>
+struct WithSize
+{
+    typedef std::pair<std::size_t, typename Inner::value_type> value_type;
+
+    template<typename Key, typename Value>
+    static value_type lift(const Key& key, const Value& value)
+    {
+        return value_type(1, Inner::template lift<Key, Value>(key, value));
+    }
+    static value_type identity() { return value_type(0, Inner::identity()); }
+    static value_type combine(const value_type& left, const value_type& right)
+    {
+        return value_type(left.first + right.first, Inner::combine(left.second, right.second));
+    }
+    static std::size_t count(const value_type& aggregate) { return aggregate.first; }
+};
+
+/**
+* Tells whether an augmentation keeps subtree sizes. Policies that do
+* define a static count() that reads the size back out of an aggregate.
+*/
+template<typename Augment>
+struct AugmentCounts : std::false_type { };
+
+template<>
+struct AugmentCounts<SubtreeSize> : std::true_type { };
+
+template<typename Inner>
+struct AugmentCounts<WithSize<Inner> > : std::true_type { };
+
+/**
+* The per-node storage for an augmentation, which Node derives from.
+* The NoAugment version is empty and takes no space in the node.
+*/
+template<typename Augment>
+class AugmentSlot
+{
+public:
+    static const bool trivially_destructible = std::is_trivially_destructible<typename Augment::value_type>::value;
+
+    const typename Augment::value_type& getAugment() const { return augment_; }
+    void setAugment(const typename Augment::value_type& augment) { augment_ = augment; }
+
+protected:
+    typename Augment::value_type augment_;
+};
+
+template<>
+class AugmentSlot<NoAugment>
+{
+public:
+    static const bool trivially_destructible = true;
+};
+
+/**
+* Makes the item of a node that is about to be created. The shared
+* insertion code wraps its arguments in one, so that a tree's virtual
+* createNode() can build its own kind of node around them. make() returns
+* the item by value straight into the node, so nothing is copied.
+*/
+template <typename Key, typename Value>
+class ItemSource
+{
+public:
+    virtual std::pair<const Key, Value> make() = 0;
+
+protected:
+    ~ItemSource() { }
+};
+
+// An ItemSource that calls fn, usually a lambda holding the arguments
+template <typename Key, typename Value, typename Fn>
+class ItemSourceFn : public ItemSource<Key, Value>
+{
+public:
+    explicit ItemSourceFn(Fn& fn) : fn_(fn) { }
+    std::pair<const Key, Value> make() { return fn_(); }
+
+private:
+    Fn& fn_;
+};
 
 /**
  * A templated class for a Node in a search tree.
- * The getters for parent/left/right are virtual so
- * that they can be overridden for future kinds of
- * search trees, such as Red Black trees, Splay trees,
- * and AVL trees.
+ * Nodes have no virtual functions, so there is no vptr in
+ * each node and every step of a traversal can be inlined.
+ * Future kinds of search trees, such as Red Black trees,
+ * Splay trees, and AVL trees, derive from Node and hide the
+ * getters for parent/left/right with versions that return
+ * their own node type.
+ *
+ * Compiling with BST_THREADED_NODES defined makes the trees threaded:
+ * an empty left or right slot holds a link to the in-order predecessor
+ * or successor instead, flagged by the low bit of the pointer. getLeft()
+ * and getRight() still only return real children.
  */
-template <typename Key, typename Value>
-class Node
+template <typename Key, typename Value, typename Augment = NoAugment>
+class Node : public AugmentSlot<Augment>
 {
 public:
-    Node(const Key& key, const Value& value, Node<Key, Value>* parent);
-    virtual ~Node();
+    Node(const Key& key, const Value& value, Node<Key, Value, Augment>* parent);
+    Node(Key&& key, Value&& value, Node<Key, Value, Augment>* parent);
+    template<typename... ItemArgs>
+    Node(Node<Key, Value, Augment>* parent, ItemArgs&&... itemArgs);
+    Node(Node<Key, Value, Augment>* parent, ItemSource<Key, Value>& source);
+    ~Node();
 
     const std::pair<const Key, Value>& getItem() const;
     std::pair<const Key, Value>& getItem();
@@ -26,20 +212,42 @@ public:
     const Value& getValue() const;
     Value& getValue();
 
-    virtual Node<Key, Value>* getParent() const;
-    virtual Node<Key, Value>* getLeft() const;
-    virtual Node<Key, Value>* getRight() const;
+    Node<Key, Value, Augment>* getParent() const;
+    Node<Key, Value, Augment>* getLeft() const;
+    Node<Key, Value, Augment>* getRight() const;
 
-    void setParent(Node<Key, Value>* parent);
-    void setLeft(Node<Key, Value>* left);
-    void setRight(Node<Key, Value>* right);
+    void setParent(Node<Key, Value, Augment>* parent);
+    void setLeft(Node<Key, Value, Augment>* left);
+    void setRight(Node<Key, Value, Augment>* right);
     void setValue(const Value &value);
+    void setValue(Value&& value);
+
+#ifdef BST_THREADED_NODES
+    // The in-order neighbours stored in empty child slots (NULL if a slot
+    // holds a real child, or there is no neighbour on that side)
+    Node<Key, Value, Augment>* getLeftThread() const;
+    Node<Key, Value, Augment>* getRightThread() const;
+    void setLeftThread(Node<Key, Value, Augment>* predecessor);
+    void setRightThread(Node<Key, Value, Augment>* successor);
+#endif
 
 protected:
+#ifdef BST_THREADED_NODES
+    static const uintptr_t THREAD_TAG = 1;
+    static Node<Key, Value, Augment>* untagged(Node<Key, Value, Augment>* link, bool wantThread);
+#endif
+#ifdef AVL_COMPACT_NODES
+    // In compact mode the low bits of parent_ are free for derived nodes
+    // to store a small tag in (the AVL balance). Nodes hold pointers, so
+    // they are always at least pointer aligned.
+    static const uintptr_t PARENT_TAG_MASK = 3;
+    static_assert(alignof(void*) > PARENT_TAG_MASK, "node pointers have no spare low bits");
+#endif
+
     std::pair<const Key, Value> item_;
-    Node<Key, Value>* parent_;
-    Node<Key, Value>* left_;
-    Node<Key, Value>* right_;
+    Node<Key, Value, Augment>* parent_;
+    Node<Key, Value, Augment>* left_;
+    Node<Key, Value, Augment>* right_;
 };
 
 /*
@@ -51,8 +259,8 @@ protected:
 /**
 * Explicit constructor for a node.
 */
-template<typename Key, typename Value>
-Node<Key, Value>::Node(const Key& key, const Value& value, Node<Key, Value>* parent) :
+template<typename Key, typename Value, typename Augment>
+Node<Key, Value, Augment>::Node(const Key& key, const Value& value, Node<Key, Value, Augment>* parent) :
     item_(key, value),
     parent_(parent),
     left_(NULL),
@@ -61,13 +269,55 @@ Node<Key, Value>::Node(const Key& key, const Value& value, Node<Key, Value>* par
 
 }
 
+/**
+* Explicit constructor for a node that takes over the key and value.
+*/
+template<typename Key, typename Value, typename Augment>
+Node<Key, Value, Augment>::Node(Key&& key, Value&& value, Node<Key, Value, Augment>* parent) :
+    item_(std::move(key), std::move(value)),
+    parent_(parent),
+    left_(NULL),
+    right_(NULL)
+{
+
+}
+
+/**
+* Constructor that builds the item in place from any arguments accepted by
+* std::pair's constructors (e.g. std::piecewise_construct and two tuples),
+* so neither the key nor the value has to be copied into the node.
+*/
+template<typename Key, typename Value, typename Augment>
+template<typename... ItemArgs>
+Node<Key, Value, Augment>::Node(Node<Key, Value, Augment>* parent, ItemArgs&&... itemArgs) :
+    item_(std::forward<ItemArgs>(itemArgs)...),
+    parent_(parent),
+    left_(NULL),
+    right_(NULL)
+{
+
+}
+
+/**
+* Constructor that takes the item from source, see ItemSource.
+*/
+template<typename Key, typename Value, typename Augment>
+Node<Key, Value, Augment>::Node(Node<Key, Value, Augment>* parent, ItemSource<Key, Value>& source) :
+    item_(source.make()),
+    parent_(parent),
+    left_(NULL),
+    right_(NULL)
+{
+
+}
+
 /**
 * Destructor, which does not need to do anything since the pointers inside of a node
 * are only used as references to existing nodes. The nodes pointed to by parent/left/right
 * are freed by the BinarySearchTree.
 */
-template<typename Key, typename Value>
-Node<Key, Value>::~Node()
+template<typename Key, typename Value, typename Augment>
+Node<Key, Value, Augment>::~Node()
 {
 
 }
@@ -75,8 +325,8 @@ Node<Key, Value>::~Node()
 /**
 * A const getter for the item.
 */
-template<typename Key, typename Value>
-const std::pair<const Key, Value>& Node<Key, Value>::getItem() const
+template<typename Key, typename Value, typename Augment>
+const std::pair<const Key, Value>& Node<Key, Value, Augment>::getItem() const
 {
     return item_;
 }
@@ -84,8 +334,8 @@ const std::pair<const Key, Value>& Node<Key, Value>::getItem() const
 /**
 * A non-const getter for the item.
 */
-template<typename Key, typename Value>
-std::pair<const Key, Value>& Node<Key, Value>::getItem()
+template<typename Key, typename Value, typename Augment>
+std::pair<const Key, Value>& Node<Key, Value, Augment>::getItem()
 {
     return item_;
 }
@@ -93,8 +343,8 @@ std::pair<const Key, Value>& Node<Key, Value>::getItem()
 /**
 * A const getter for the key.
 */
-template<typename Key, typename Value>
-const Key& Node<Key, Value>::getKey() const
+template<typename Key, typename Value, typename Augment>
+const Key& Node<Key, Value, Augment>::getKey() const
 {
     return item_.first;
 }
@@ -102,8 +352,8 @@ const Key& Node<Key, Value>::getKey() const
 /**
 * A const getter for the value.
 */
-template<typename Key, typename Value>
-const Value& Node<Key, Value>::getValue() const
+template<typename Key, typename Value, typename Augment>
+const Value& Node<Key, Value, Augment>::getValue() const
 {
     return item_.second;
 }
@@ -111,53 +361,71 @@ const Value& Node<Key, Value>::getValue() const
 /**
 * A non-const getter for the value.
 */
-template<typename Key, typename Value>
-Value& Node<Key, Value>::getValue()
+template<typename Key, typename Value, typename Augment>
+Value& Node<Key, Value, Augment>::getValue()
 {
     return item_.second;
 }
 
 /**
-* An implementation of the virtual function for retreiving the parent.
+* A getter for the parent.
 */
-template<typename Key, typename Value>
-Node<Key, Value>* Node<Key, Value>::getParent() const
+template<typename Key, typename Value, typename Augment>
+Node<Key, Value, Augment>* Node<Key, Value, Augment>::getParent() const
 {
+#ifdef AVL_COMPACT_NODES
+    return reinterpret_cast<Node<Key, Value, Augment>*>(reinterpret_cast<uintptr_t>(parent_) & ~PARENT_TAG_MASK);
+#else
     return parent_;
+#endif
 }
 
 /**
-* An implementation of the virtual function for retreiving the left child.
+* A getter for the left child.
 */
-template<typename Key, typename Value>
-Node<Key, Value>* Node<Key, Value>::getLeft() const
+template<typename Key, typename Value, typename Augment>
+Node<Key, Value, Augment>* Node<Key, Value, Augment>::getLeft() const
 {
+#ifdef BST_THREADED_NODES
+    return untagged(left_, false);
+#else
     return left_;
+#endif
 }
 
 /**
-* An implementation of the virtual function for retreiving the right child.
+* A getter for the right child.
 */
-template<typename Key, typename Value>
-Node<Key, Value>* Node<Key, Value>::getRight() const
+template<typename Key, typename Value, typename Augment>
+Node<Key, Value, Augment>* Node<Key, Value, Augment>::getRight() const
 {
+#ifdef BST_THREADED_NODES
+    return untagged(right_, false);
+#else
     return right_;
+#endif
 }
 
 /**
 * A setter for setting the parent of a node.
+* In compact mode the tag bits stored alongside the parent are kept.
 */
-template<typename Key, typename Value>
-void Node<Key, Value>::setParent(Node<Key, Value>* parent)
+template<typename Key, typename Value, typename Augment>
+void Node<Key, Value, Augment>::setParent(Node<Key, Value, Augment>* parent)
 {
+#ifdef AVL_COMPACT_NODES
+    uintptr_t tag = reinterpret_cast<uintptr_t>(parent_) & PARENT_TAG_MASK;
+    parent_ = reinterpret_cast<Node<Key, Value, Augment>*>(reinterpret_cast<uintptr_t>(parent) | tag);
+#else
     parent_ = parent;
+#endif
 }
 
 /**
 * A setter for setting the left child of a node.
 */
-template<typename Key, typename Value>
-void Node<Key, Value>::setLeft(Node<Key, Value>* left)
+template<typename Key, typename Value, typename Augment>
+void Node<Key, Value, Augment>::setLeft(Node<Key, Value, Augment>* left)
 {
     left_ = left;
 }
@@ -165,52 +433,239 @@ void Node<Key, Value>::setLeft(Node<Key, Value>* left)
 /**
 * A setter for setting the right child of a node.
 */
-template<typename Key, typename Value>
-void Node<Key, Value>::setRight(Node<Key, Value>* right)
+template<typename Key, typename Value, typename Augment>
+void Node<Key, Value, Augment>::setRight(Node<Key, Value, Augment>* right)
 {
     right_ = right;
 }
 
+#ifdef BST_THREADED_NODES
+/**
+* A getter for the in-order predecessor threaded through the left slot.
+*/
+template<typename Key, typename Value, typename Augment>
+Node<Key, Value, Augment>* Node<Key, Value, Augment>::getLeftThread() const
+{
+    return untagged(left_, true);
+}
+
+/**
+* A getter for the in-order successor threaded through the right slot.
+*/
+template<typename Key, typename Value, typename Augment>
+Node<Key, Value, Augment>* Node<Key, Value, Augment>::getRightThread() const
+{
+    return untagged(right_, true);
+}
+
+/**
+* Empties the left slot, leaving a link to the in-order predecessor.
+*/
+template<typename Key, typename Value, typename Augment>
+void Node<Key, Value, Augment>::setLeftThread(Node<Key, Value, Augment>* predecessor)
+{
+    left_ = (predecessor == NULL) ? NULL :
+        reinterpret_cast<Node<Key, Value, Augment>*>(reinterpret_cast<uintptr_t>(predecessor) | THREAD_TAG);
+}
+
+/**
+* Empties the right slot, leaving a link to the in-order successor.
+*/
+template<typename Key, typename Value, typename Augment>
+void Node<Key, Value, Augment>::setRightThread(Node<Key, Value, Augment>* successor)
+{
+    right_ = (successor == NULL) ? NULL :
+        reinterpret_cast<Node<Key, Value, Augment>*>(reinterpret_cast<uintptr_t>(successor) | THREAD_TAG);
+}
+
+// helper function that returns a slot's pointer if it is the kind wanted
+// (a thread or a real child), and NULL otherwise
+template<typename Key, typename Value, typename Augment>
+Node<Key, Value, Augment>* Node<Key, Value, Augment>::untagged(Node<Key, Value, Augment>* link, bool wantThread)
+{
+    uintptr_t raw = reinterpret_cast<uintptr_t>(link);
+    if(((raw & THREAD_TAG) != 0) != wantThread) {
+        return NULL;
+    }
+    return reinterpret_cast<Node<Key, Value, Augment>*>(raw & ~THREAD_TAG);
+}
+#endif
+
 /**
 * A setter for the value of a node.
 */
-template<typename Key, typename Value>
-void Node<Key, Value>::setValue(const Value& value)
+template<typename Key, typename Value, typename Augment>
+void Node<Key, Value, Augment>::setValue(const Value& value)
 {
     item_.second = value;
 }
 
+/**
+* A setter for the value of a node that moves the new value in.
+*/
+template<typename Key, typename Value, typename Augment>
+void Node<Key, Value, Augment>::setValue(Value&& value)
+{
+    item_.second = std::move(value);
+}
+
 /*
   ---------------------------------------
   End implementations for the Node class.
   ---------------------------------------
 */
 
+/**
+* Recomputes augmented aggregates after the tree changes shape. pullUp()
+* refreshes one node from its children, which must be up to date, and
+* pullUpPath() refreshes a node and all of its ancestors. Both compile
+* to nothing for unaugmented trees.
+*/
+template<typename Key, typename Value, typename Augment>
+struct AugmentUpdater
+{
+    static void pullUp(Node<Key, Value, Augment>* n);
+    static void pullUpPath(Node<Key, Value, Augment>* n);
+    static void swapAggregates(Node<Key, Value, Augment>* n1, Node<Key, Value, Augment>* n2);
+};
+
+template<typename Key, typename Value>
+struct AugmentUpdater<Key, Value, NoAugment>
+{
+    static void pullUp(Node<Key, Value, NoAugment>* n) { }
+    static void pullUpPath(Node<Key, Value, NoAugment>* n) { }
+    static void swapAggregates(Node<Key, Value, NoAugment>* n1, Node<Key, Value, NoAugment>* n2) { }
+};
+
+/**
+* Sets n's aggregate to combine(left subtree, n's item, right subtree).
+*/
+template<typename Key, typename Value, typename Augment>
+void AugmentUpdater<Key, Value, Augment>::pullUp(Node<Key, Value, Augment>* n)
+{
+    typename Augment::value_type aggregate = Augment::template lift<Key, Value>(n->getKey(), n->getValue());
+    if(n->getLeft() != NULL) {
+        aggregate = Augment::combine(n->getLeft()->getAugment(), aggregate);
+    }
+    if(n->getRight() != NULL) {
+        aggregate = Augment::combine(aggregate, n->getRight()->getAugment());
+    }
+    n->setAugment(aggregate);
+}
+
+/**
+* Exchanges the aggregates of two nodes that have swapped places, so
+* each position keeps the aggregate it had.
+*/
+template<typename Key, typename Value, typename Augment>
+void AugmentUpdater<Key, Value, Augment>::swapAggregates(Node<Key, Value, Augment>* n1, Node<Key, Value, Augment>* n2)
+{
+    typename Augment::value_type temp = n1->getAugment();
+    n1->setAugment(n2->getAugment());
+    n2->setAugment(temp);
+}
+
+/**
+* Refreshes n and every node above it, for after a change below n.
+*/
+template<typename Key, typename Value, typename Augment>
+void AugmentUpdater<Key, Value, Augment>::pullUpPath(Node<Key, Value, Augment>* n)
+{
+    while(n != NULL) {
+        pullUp(n);
+        n = n->getParent();
+    }
+}
+
+/**
+* Conflict policies for union_with(). A policy is called as
+* policy(existing, incoming) for every key found in both trees and
+* leaves the value to keep in existing.
+*/
+struct KeepExisting
+{
+    template<typename Value>
+    void operator()(Value& existing, Value& incoming) const { }
+};
+
+struct TakeIncoming
+{
+    template<typename Value>
+    void operator()(Value& existing, Value& incoming) const { existing = std::move(incoming); }
+};
+
+/**
+* A report on the shape of a tree, as returned by stats(). Heights and
+* depths count nodes: an empty tree has height 0 and the root depth 0.
+*/
+struct TreeStats
+{
+    std::size_t nodes;
+    int height;
+    // nodes whose two subtrees differ in height by more than one
+    std::size_t imbalancedNodes;
+    // depthHistogram[d] is the number of nodes at depth d
+    std::vector<std::size_t> depthHistogram;
+    // the mean number of nodes a successful find() visits
+    double averageSearchDepth;
+};
+
 /**
 * A templated unbalanced binary search tree.
+* Nodes are allocated from a per-tree NodeArena rather than with
+* individual calls to new/delete.
 */
-template <typename Key, typename Value> 
+template <typename Key, typename Value, typename Augment = NoAugment>
 class BinarySearchTree
 {
 public:
     BinarySearchTree(); //TODO
+    template<typename ForwardIt>
+    BinarySearchTree(ForwardIt first, ForwardIt last);
+    // Copies clone the shape of other in O(n); moves are O(1) and leave
+    // other empty
+    BinarySearchTree(const BinarySearchTree<Key, Value, Augment>& other);
+    BinarySearchTree(BinarySearchTree<Key, Value, Augment>&& other);
+    BinarySearchTree<Key, Value, Augment>& operator=(const BinarySearchTree<Key, Value, Augment>& other);
+    BinarySearchTree<Key, Value, Augment>& operator=(BinarySearchTree<Key, Value, Augment>&& other);
     virtual ~BinarySearchTree(); //TODO
     virtual void insert(const std::pair<const Key, Value>& keyValuePair); //TODO
+    virtual void insert(std::pair<const Key, Value>&& keyValuePair);
     virtual void remove(const Key& key); //TODO
     void clear(); //TODO
     bool isBalanced() const; //TODO
+    TreeStats stats() const;
     void print() const;
     bool empty() const;
-
-    template<typename PPKey, typename PPValue>
-    friend void prettyPrintBST(BinarySearchTree<PPKey, PPValue> & tree);
+    std::size_t memoryUsage() const;
+    std::size_t size() const;
+
+    // O(1) access to the smallest and largest items, for using the tree as
+    // an ordered priority queue. The tree must not be empty. The pops
+    // remove the item without searching for it; on an empty tree they do
+    // nothing.
+    std::pair<const Key, Value>& front() const;
+    std::pair<const Key, Value>& back() const;
+    void pop_min();
+    void pop_max();
+
+    template<typename PPKey, typename PPValue, typename PPAugment>
+    friend void prettyPrintBST(BinarySearchTree<PPKey, PPValue, PPAugment> & tree);
 public:
     /**
     * An internal iterator class for traversing the contents of the BST.
+    * It is a standard bidirectional iterator, and decrementing end()
+    * gives the last item.
     */
     class iterator  // TODO
     {
     public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef std::pair<const Key, Value> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef std::pair<const Key, Value>* pointer;
+        typedef std::pair<const Key, Value>& reference;
+
         iterator();
 
         std::pair<const Key,Value>& operator*() const;
@@ -220,41 +675,295 @@ public:
         bool operator!=(const iterator& rhs) const;
 
         iterator& operator++();
+        iterator operator++(int);
+        iterator& operator--();
+        iterator operator--(int);
 
     protected:
-        friend class BinarySearchTree<Key, Value>;
-        iterator(Node<Key,Value>* ptr);
-        Node<Key, Value> *current_;
+        friend class BinarySearchTree<Key, Value, Augment>;
+        iterator(Node<Key, Value, Augment>* ptr, const BinarySearchTree<Key, Value, Augment>* tree);
+        Node<Key, Value, Augment> *current_;
+        // the tree being traversed, so that end() knows what comes before it
+        const BinarySearchTree<Key, Value, Augment>* tree_;
+    };
+
+    /**
+    * A read-only version of iterator. An iterator converts to it, and the
+    * two can be compared with each other.
+    */
+    class const_iterator
+    {
+    public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef std::pair<const Key, Value> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const std::pair<const Key, Value>* pointer;
+        typedef const std::pair<const Key, Value>& reference;
+
+        const_iterator();
+        const_iterator(const iterator& it);
+
+        const std::pair<const Key,Value>& operator*() const;
+        const std::pair<const Key,Value>* operator->() const;
+
+        // non-members so that either side may be a plain iterator
+        friend bool operator==(const const_iterator& lhs, const const_iterator& rhs)
+        {
+            return lhs.it_ == rhs.it_;
+        }
+        friend bool operator!=(const const_iterator& lhs, const const_iterator& rhs)
+        {
+            return lhs.it_ != rhs.it_;
+        }
+
+        const_iterator& operator++();
+        const_iterator operator++(int);
+        const_iterator& operator--();
+        const_iterator operator--(int);
+
+    private:
+        iterator it_;
     };
 
+    typedef std::reverse_iterator<iterator> reverse_iterator;
+    typedef std::reverse_iterator<const_iterator> const_reverse_iterator;
+
 public:
     iterator begin() const;
     iterator end() const;
+    const_iterator cbegin() const;
+    const_iterator cend() const;
+    reverse_iterator rbegin() const;
+    reverse_iterator rend() const;
+    const_reverse_iterator crbegin() const;
+    const_reverse_iterator crend() const;
     iterator find(const Key& key) const;
     Value& operator[](const Key& key);
     Value const & operator[](const Key& key) const;
 
+    /**
+    * A lazy view of the items with keys in [lo, hi), as returned by
+    * range(). It only holds two iterators, so nothing is copied, and
+    * it can be used in a range-based for loop.
+    */
+    class range_view
+    {
+    public:
+        range_view(const iterator& first, const iterator& last);
+        iterator begin() const;
+        iterator end() const;
+        bool empty() const;
+
+    private:
+        iterator first_;
+        iterator last_;
+    };
+
+    // Ordered searches, each a single O(log n) descent. The bounds are
+    // as for std::map; floor() finds the largest key <= key and ceiling()
+    // the smallest key >= key. All return end() if there is no such item.
+    iterator lower_bound(const Key& key) const;
+    iterator upper_bound(const Key& key) const;
+    std::pair<iterator, iterator> equal_range(const Key& key) const;
+    iterator floor(const Key& key) const;
+    iterator ceiling(const Key& key) const;
+    range_view range(const Key& lo, const Key& hi) const;
+
+    // Calls fn(item) on every item, or on those with keys in [lo, hi),
+    // in key order. Quicker than an iterator loop over large trees: the
+    // walk keeps its path on a stack instead of climbing parent links,
+    // and prefetches right subtrees before it gets to them.
+    template<typename Fn>
+    void for_each(Fn fn) const;
+    template<typename Fn>
+    void for_each_range(const Key& lo, const Key& hi, Fn fn) const;
+    // Fork-join versions for whole-tree scans, on threads threads (0 for
+    // one per hardware thread). parallel_for_each() calls fn on every item
+    // in no particular order, from several threads at once.
+    // parallel_reduce() returns combine(init, m1, ..., mn) folded over the
+    // mapped items mi = map(item) in key order; as the grouping only
+    // depends on the tree, the result is the same on every run, and equals
+    // the sequential fold when combine is associative. Small trees are
+    // walked on the calling thread. Callers that scan often can pass a
+    // WorkStealingPool of their own instead of paying to start one each
+    // time. If a call of fn, map or combine throws, the rest still run and
+    // the first exception is rethrown.
+    template<typename Fn>
+    void parallel_for_each(Fn fn, unsigned threads = 0) const;
+    template<typename Fn>
+    void parallel_for_each(Fn fn, WorkStealingPool& pool) const;
+    template<typename T, typename Map, typename Combine>
+    T parallel_reduce(T init, Map map, Combine combine, unsigned threads = 0) const;
+    template<typename T, typename Map, typename Combine>
+    T parallel_reduce(T init, Map map, Combine combine, WorkStealingPool& pool) const;
+
+    // Single-descent insertion, with the same meaning as for std::map.
+    // They build nodes through createNode(), so derived trees stay valid.
+    template<typename... Args>
+    std::pair<iterator, bool> try_emplace(const Key& key, Args&&... args);
+    template<typename... Args>
+    std::pair<iterator, bool> try_emplace(Key&& key, Args&&... args);
+    template<typename M>
+    std::pair<iterator, bool> insert_or_assign(const Key& key, M&& obj);
+    template<typename M>
+    std::pair<iterator, bool> insert_or_assign(Key&& key, M&& obj);
+    template<typename... Args>
+    std::pair<iterator, bool> emplace(Args&&... args);
+
+    // Replaces the contents with a perfectly balanced tree built in O(n)
+    // from a range of items sorted by strictly increasing key.
+    template<typename ForwardIt>
+    void buildFromSorted(ForwardIt first, ForwardIt last);
+    // Replaces the contents with the items of an unsorted range, on threads
+    // threads (0 for one per hardware thread): the items are sorted, repeated
+    // keys dropped (the last one wins, as with insert()), and the balanced
+    // subtrees built side by side.
+    template<typename ForwardIt>
+    void parallelBuild(ForwardIt first, ForwardIt last, unsigned threads);
+
+    // Moves every item of other into this tree in O(n + m), leaving other
+    // empty. Nodes are reused, not reallocated, when other is the same
+    // kind of tree; a tree of another kind, which only a base reference
+    // can pass, has its items copied in O(m log(n + m)) instead. merge()
+    // keeps this tree's value for keys present in both; union_with() asks
+    // the policy.
+    void merge(BinarySearchTree<Key, Value, Augment>& other);
+    template<typename ConflictPolicy>
+    void union_with(BinarySearchTree<Key, Value, Augment>& other, ConflictPolicy policy);
+
+    // Order statistics, in O(log n). These need a tree augmented with
+    // subtree sizes, such as AVLTree<Key, Value, SubtreeSize>. rank()
+    // counts the keys less than key, select() finds the item with rank k
+    // (end() if there is none), and count_range() counts keys in [lo, hi).
+    std::size_t rank(const Key& key) const;
+    iterator select(std::size_t k) const;
+    std::size_t count_range(const Key& lo, const Key& hi) const;
+
+    // Range aggregates, in O(log n), for trees with an augmentation such
+    // as Sum<int>: the combined aggregate of all items with keys in
+    // [lo, hi), or of the whole tree. Values changed through operator[]
+    // or an iterator are not seen; use insert_or_assign() instead.
+    template<typename A = Augment>
+    typename A::value_type aggregate(const Key& lo, const Key& hi) const;
+    template<typename A = Augment>
+    typename A::value_type aggregate() const;
+
+    // Hinted insertion: amortized O(1) when the key belongs right before
+    // hint (end() meaning after the largest key). Like insert(), an
+    // existing value is overwritten. Returns an iterator to the item.
+    iterator insert(const iterator& hint, const std::pair<const Key, Value>& keyValuePair);
+    iterator insert(const iterator& hint, std::pair<const Key, Value>&& keyValuePair);
+
 protected:
     // Mandatory helper functions
-    Node<Key, Value>* internalFind(const Key& k) const; // TODO
-    Node<Key, Value> *getSmallestNode() const;  // TODO
-    static Node<Key, Value>* predecessor(Node<Key, Value>* current); // TODO
+    Node<Key, Value, Augment>* internalFind(const Key& k) const; // TODO
+    Node<Key, Value, Augment>* internalLowerBound(const Key& key) const;
+    Node<Key, Value, Augment>* internalUpperBound(const Key& key) const;
+    template<typename Fn>
+    static void visitFrom(std::vector<Node<Key, Value, Augment>*>& path, const Key* hi, Fn& fn);
+    static void pushLeftSpine(Node<Key, Value, Augment>* n, std::vector<Node<Key, Value, Augment>*>& path);
+    unsigned parallelDepth(unsigned threads) const;
+    template<typename Fn>
+    static void parallelVisit(Node<Key, Value, Augment>* n, unsigned depth, Fn& fn, WorkStealingPool* pool);
+    template<typename T, typename Map, typename Combine>
+    static T reduceSubtree(Node<Key, Value, Augment>* n, unsigned depth, Map& map, Combine& combine,
+                           WorkStealingPool* pool);
+    Node<Key, Value, Augment> *getSmallestNode() const;  // TODO
+    static Node<Key, Value, Augment>* predecessor(Node<Key, Value, Augment>* current); // TODO
+    static Node<Key, Value, Augment>* successor(Node<Key, Value, Augment>* current);
     // Note:  static means these functions don't have a "this" pointer
     //        and instead just use the input argument.
 
     // Provided helper functions
-    virtual void printRoot (Node<Key, Value> *r) const;
-    virtual void nodeSwap( Node<Key,Value>* n1, Node<Key,Value>* n2) ;
+    virtual void printRoot (Node<Key, Value, Augment> *r) const;
+    virtual void nodeSwap( Node<Key, Value, Augment>* n1, Node<Key, Value, Augment>* n2) ;
 
     // Add helper functions here
-		void clear_helper(Node<Key, Value> *curr);
-		int balanced_helper(Node<Key, Value> *curr, int val) const;
-		bool balanced_helper2(Node<Key, Value> *curr) const;
+		void destroyAll(Node<Key, Value, Augment> *curr);
+
+    // Single-descent insertion helpers, shared with derived trees
+    Node<Key, Value, Augment>* internalFindSlot(const Key& key, Node<Key, Value, Augment>*& parent, bool& isLeft) const;
+    void attachNode(Node<Key, Value, Augment>* n, Node<Key, Value, Augment>* parent, bool isLeft);
+    template<typename K, typename... Args>
+    std::pair<Node<Key, Value, Augment>*, bool> internalTryEmplace(K&& key, Args&&... args);
+    template<typename K, typename M>
+    std::pair<Node<Key, Value, Augment>*, bool> internalInsertOrAssign(K&& key, M&& obj);
+    template<typename K, typename M>
+    std::pair<Node<Key, Value, Augment>*, bool> internalInsertOrAssignHint(const iterator& hint, K&& key, M&& obj);
+    template<typename K, typename M>
+    std::pair<Node<Key, Value, Augment>*, bool> placeOrAssign(Node<Key, Value, Augment>* existing, Node<Key, Value, Augment>* parent,
+                                                     bool isLeft, K&& key, M&& obj);
+    Node<Key, Value, Augment>* internalFindSlotHint(Node<Key, Value, Augment>* hint, const Key& key,
+                                           Node<Key, Value, Augment>*& parent, bool& isLeft) const;
+    void updateBoundsBeforeRemove(Node<Key, Value, Augment>* n);
+    virtual void removeNode(Node<Key, Value, Augment>* current);
+    void finishRemove(Node<Key, Value, Augment>* n, Node<Key, Value, Augment>* parent);
+
+    // Augmentation upkeep, see AugmentUpdater
+    static void pullUp(Node<Key, Value, Augment>* n);
+    static void pullUpPath(Node<Key, Value, Augment>* n);
+    std::size_t knownSize(std::true_type) const;
+    std::size_t knownSize(std::false_type) const;
+    static std::size_t subtreeCount(Node<Key, Value, Augment>* n);
+
+    // Threaded mode upkeep, see BST_THREADED_NODES; no-ops otherwise
+    static void threadNeighbours(Node<Key, Value, Augment>* before, Node<Key, Value, Augment>* after);
+    static void rethread(Node<Key, Value, Augment>* n);
+    static void threadSequence(Node<Key, Value, Augment>* const* nodes, std::size_t count);
+    template<typename A>
+    static typename A::value_type subtreeAggregate(Node<Key, Value, Augment>* n);
+
+    // Hooks that let the shared code build a derived tree's own kind of
+    // node. createNode() constructs one in slot, afterAttach() restores
+    // the tree's invariants once a new node is linked in, and the
+    // linear-time builders give setBuiltBalance() each node's height
+    // difference (right minus left) as they place it. setBuiltHeight()
+    // gets the height of a whole tree that was built or taken over, or
+    // UNKNOWN_HEIGHT where the shared code cannot tell it.
+    virtual Node<Key, Value, Augment>* createNode(void* slot, Node<Key, Value, Augment>* parent, ItemSource<Key, Value>& source);
+    virtual void afterAttach(Node<Key, Value, Augment>* n);
+    virtual void setBuiltBalance(Node<Key, Value, Augment>* n, int balance);
+    virtual void setBuiltHeight(int height);
+    template<typename Fn>
+    Node<Key, Value, Augment>* makeNode(void* slot, Node<Key, Value, Augment>* parent, Fn fn);
+
+    // Linear-time construction helpers
+    template<typename ForwardIt>
+    Node<Key, Value, Augment>* buildSubtree(ForwardIt& it, std::size_t count, char*& slot, Node<Key, Value, Augment>* parent,
+                                   int& height);
+    Node<Key, Value, Augment>* parallelLinkRun(char* slot, std::size_t count, Node<Key, Value, Augment>* parent, int& height,
+                                      WorkStealingPool& pool, std::size_t cutoff);
+    void finishBuild(std::size_t count);
+    Node<Key, Value, Augment>* linkSubtree(Node<Key, Value, Augment>** nodes, std::size_t count, Node<Key, Value, Augment>* parent,
+                                  int& height);
+    template<typename... Args>
+    std::pair<Node<Key, Value, Augment>*, bool> internalEmplace(Args&&... args);
+    template<typename NodeType>
+    void cloneFrom(const BinarySearchTree<Key, Value, Augment>& other);
+    void takeFrom(BinarySearchTree<Key, Value, Augment>& other);
+    iterator makeIterator(Node<Key, Value, Augment>* n) const;
+
+    // Node memory management, shared with derived trees
+    BinarySearchTree(std::size_t nodeSize, std::size_t nodeAlign,
+                     void (*nodeDestructor)(Node<Key, Value, Augment>*));
+    void* allocateNode();
+    void destroyNode(Node<Key, Value, Augment>* n);
+    template<typename NodeType>
+    static void destructNode(Node<Key, Value, Augment>* n);
 
 
 protected:
-    Node<Key, Value>* root_;
-    // You should not need other data members
+    NodeArena arena_;
+    void (*nodeDestructor_)(Node<Key, Value, Augment>*);
+    Node<Key, Value, Augment>* root_;
+    Node<Key, Value, Augment>* leftmost_;    // smallest node, NULL when empty
+    Node<Key, Value, Augment>* rightmost_;   // largest node, NULL when empty
+    // number of items, or UNKNOWN_SIZE until size() next counts them
+    mutable std::size_t size_;
+    static const std::size_t UNKNOWN_SIZE = static_cast<std::size_t>(-1);
+    static const int UNKNOWN_HEIGHT = -1;
+    // the fewest items worth handing to another thread
+    static const std::size_t PARALLEL_GRAIN = 16384;
 };
 
 /*
@@ -264,279 +973,1954 @@ Begin implementations for the BinarySearchTree::iterator class.
 */
 
 /**
-* Explicit constructor that initializes an iterator with a given node pointer.
+* Explicit constructor that initializes an iterator with a given node pointer
+* (NULL for end()) into the given tree.
+*/
+template<class Key, class Value, class Augment>
+BinarySearchTree<Key, Value, Augment>::iterator::iterator(Node<Key, Value, Augment> *ptr,
+                                                 const BinarySearchTree<Key, Value, Augment>* tree)
+{
+    // TODO
+		current_ = ptr;
+		tree_ = tree;
+}
+
+/**
+* A default constructor that initializes the iterator to NULL.
+*/
+template<class Key, class Value, class Augment>
+BinarySearchTree<Key, Value, Augment>::iterator::iterator() 
+{
+    // TODO
+		current_ = NULL;
+		tree_ = NULL;
+}
+
+/**
+* Provides access to the item.
+*/
+template<class Key, class Value, class Augment>
+std::pair<const Key,Value> &
+BinarySearchTree<Key, Value, Augment>::iterator::operator*() const
+{
+    return current_->getItem();
+}
+
+/**
+* Provides access to the address of the item.
+*/
+template<class Key, class Value, class Augment>
+std::pair<const Key,Value> *
+BinarySearchTree<Key, Value, Augment>::iterator::operator->() const
+{
+    return &(current_->getItem());
+}
+
+/**
+* Checks if 'this' iterator's internals have the same value
+* as 'rhs'
+*/
+template<class Key, class Value, class Augment>
+bool
+BinarySearchTree<Key, Value, Augment>::iterator::operator==(
+    const BinarySearchTree<Key, Value, Augment>::iterator& rhs) const
+{
+    // TODO
+		// compare the nodes themselves, since either side may be end()
+		return this->current_ == rhs.current_;
+}
+ 
+/**
+* Checks if 'this' iterator's internals have a different value
+* as 'rhs'
+*/
+template<class Key, class Value, class Augment>
+bool
+BinarySearchTree<Key, Value, Augment>::iterator::operator!=(
+    const BinarySearchTree<Key, Value, Augment>::iterator& rhs) const
+{
+    // TODO
+		return this->current_ != rhs.current_;
+}
+
+
+/**
+* Advances the iterator's location using an in-order sequencing
+*/
+template<class Key, class Value, class Augment>
+typename BinarySearchTree<Key, Value, Augment>::iterator&
+BinarySearchTree<Key, Value, Augment>::iterator::operator++()
+{
+#ifdef BST_THREADED_NODES
+    // without a right subtree the successor is threaded through the slot
+    Node<Key, Value, Augment>* right = this->current_->getRight();
+    if(right == NULL) {
+        this->current_ = this->current_->getRightThread();
+        return *this;
+    }
+    this->current_ = right;
+    while(this->current_->getLeft() != NULL) {
+        this->current_ = this->current_->getLeft();
+    }
+    return *this;
+#else
+    if(this->current_->getRight() != NULL) {
+        // the successor is the leftmost node of the right subtree
+        this->current_ = this->current_->getRight();
+        while(this->current_->getLeft() != NULL) {
+            this->current_ = this->current_->getLeft();
+        }
+        return *this;
+    }
+    // otherwise climb until we leave a left subtree; past the largest
+    // node this ends at NULL, i.e. end()
+    Node<Key, Value, Augment>* parent = this->current_->getParent();
+    while(parent != NULL && this->current_ == parent->getRight()) {
+        this->current_ = parent;
+        parent = parent->getParent();
+    }
+    this->current_ = parent;
+    return *this;
+#endif
+}
+
+
+/**
+* Advances the iterator, returning a copy of it from before the move.
+*/
+template<class Key, class Value, class Augment>
+typename BinarySearchTree<Key, Value, Augment>::iterator
+BinarySearchTree<Key, Value, Augment>::iterator::operator++(int)
+{
+    iterator old(*this);
+    ++(*this);
+    return old;
+}
+
+/**
+* Moves the iterator back to the previous item in key order; from end()
+* that is the largest item. The iterator must not be at the first item.
+*/
+template<class Key, class Value, class Augment>
+typename BinarySearchTree<Key, Value, Augment>::iterator&
+BinarySearchTree<Key, Value, Augment>::iterator::operator--()
+{
+    if(this->current_ == NULL) {
+        this->current_ = tree_->rightmost_;
+        return *this;
+    }
+#ifdef BST_THREADED_NODES
+    Node<Key, Value, Augment>* left = this->current_->getLeft();
+    if(left == NULL) {
+        this->current_ = this->current_->getLeftThread();
+        return *this;
+    }
+    this->current_ = left;
+    while(this->current_->getRight() != NULL) {
+        this->current_ = this->current_->getRight();
+    }
+#else
+    this->current_ = predecessor(this->current_);
+#endif
+    return *this;
+}
+
+/**
+* Moves the iterator back, returning a copy of it from before the move.
+*/
+template<class Key, class Value, class Augment>
+typename BinarySearchTree<Key, Value, Augment>::iterator
+BinarySearchTree<Key, Value, Augment>::iterator::operator--(int)
+{
+    iterator old(*this);
+    --(*this);
+    return old;
+}
+
+/**
+* A default constructor that initializes the iterator to NULL.
+*/
+template<class Key, class Value, class Augment>
+BinarySearchTree<Key, Value, Augment>::const_iterator::const_iterator() :
+    it_()
+{
+
+}
+
+/**
+* Converts a mutable iterator to a read-only one.
+*/
+template<class Key, class Value, class Augment>
+BinarySearchTree<Key, Value, Augment>::const_iterator::const_iterator(const iterator& it) :
+    it_(it)
+{
+
+}
+
+/**
+* Provides read-only access to the item.
+*/
+template<class Key, class Value, class Augment>
+const std::pair<const Key,Value> &
+BinarySearchTree<Key, Value, Augment>::const_iterator::operator*() const
+{
+    return *it_;
+}
+
+/**
+* Provides the address of the item, read-only.
+*/
+template<class Key, class Value, class Augment>
+const std::pair<const Key,Value> *
+BinarySearchTree<Key, Value, Augment>::const_iterator::operator->() const
+{
+    return it_.operator->();
+}
+
+/**
+* Advances the iterator as iterator::operator++() does.
+*/
+template<class Key, class Value, class Augment>
+typename BinarySearchTree<Key, Value, Augment>::const_iterator&
+BinarySearchTree<Key, Value, Augment>::const_iterator::operator++()
+{
+    ++it_;
+    return *this;
+}
+
+/**
+* Advances the iterator, returning a copy of it from before the move.
+*/
+template<class Key, class Value, class Augment>
+typename BinarySearchTree<Key, Value, Augment>::const_iterator
+BinarySearchTree<Key, Value, Augment>::const_iterator::operator++(int)
+{
+    const_iterator old(*this);
+    ++it_;
+    return old;
+}
+
+/**
+* Moves the iterator back as iterator::operator--() does.
+*/
+template<class Key, class Value, class Augment>
+typename BinarySearchTree<Key, Value, Augment>::const_iterator&
+BinarySearchTree<Key, Value, Augment>::const_iterator::operator--()
+{
+    --it_;
+    return *this;
+}
+
+/**
+* Moves the iterator back, returning a copy of it from before the move.
+*/
+template<class Key, class Value, class Augment>
+typename BinarySearchTree<Key, Value, Augment>::const_iterator
+BinarySearchTree<Key, Value, Augment>::const_iterator::operator--(int)
+{
+    const_iterator old(*this);
+    --it_;
+    return old;
+}
+
+/*
+-------------------------------------------------------------
+End implementations for the BinarySearchTree::iterator class.
+-------------------------------------------------------------
+*/
+
+/**
+* Constructor for a view of the items from first up to, but not
+* including, last.
+*/
+template<class Key, class Value, class Augment>
+BinarySearchTree<Key, Value, Augment>::range_view::range_view(const iterator& first, const iterator& last) :
+    first_(first),
+    last_(last)
+{
+
+}
+
+/**
+* Returns an iterator to the first item in the view.
+*/
+template<class Key, class Value, class Augment>
+typename BinarySearchTree<Key, Value, Augment>::iterator
+BinarySearchTree<Key, Value, Augment>::range_view::begin() const
+{
+    return first_;
+}
+
+/**
+* Returns the iterator just past the last item in the view.
+*/
+template<class Key, class Value, class Augment>
+typename BinarySearchTree<Key, Value, Augment>::iterator
+BinarySearchTree<Key, Value, Augment>::range_view::end() const
+{
+    return last_;
+}
+
+/**
+* Returns true if the view holds no items.
+*/
+template<class Key, class Value, class Augment>
+bool BinarySearchTree<Key, Value, Augment>::range_view::empty() const
+{
+    return first_ == last_;
+}
+
+/*
+-----------------------------------------------------
+Begin implementations for the BinarySearchTree class.
+-----------------------------------------------------
+*/
+
+/**
+* Default constructor for a BinarySearchTree, which sets the root to NULL.
+*/
+template<class Key, class Value, class Augment>
+BinarySearchTree<Key, Value, Augment>::BinarySearchTree() :
+    arena_(sizeof(Node<Key, Value, Augment>), alignof(Node<Key, Value, Augment>)),
+    nodeDestructor_(&destructNode<Node<Key, Value, Augment> >),
+    root_(NULL),
+    leftmost_(NULL),
+    rightmost_(NULL),
+    size_(0)
+{
+
+}
+
+/**
+* Constructor for derived trees whose nodes are a subclass of Node,
+* so that the arena hands out slots of the right size and nodes are
+* destroyed as their real type (Node has no virtual destructor).
+*/
+template<class Key, class Value, class Augment>
+BinarySearchTree<Key, Value, Augment>::BinarySearchTree(std::size_t nodeSize, std::size_t nodeAlign,
+                                               void (*nodeDestructor)(Node<Key, Value, Augment>*)) :
+    arena_(nodeSize, nodeAlign),
+    nodeDestructor_(nodeDestructor),
+    root_(NULL),
+    leftmost_(NULL),
+    rightmost_(NULL),
+    size_(0)
+{
+
+}
+
+/**
+* Constructor that builds a balanced tree from a sorted range, see buildFromSorted().
+*/
+template<class Key, class Value, class Augment>
+template<typename ForwardIt>
+BinarySearchTree<Key, Value, Augment>::BinarySearchTree(ForwardIt first, ForwardIt last) :
+    arena_(sizeof(Node<Key, Value, Augment>), alignof(Node<Key, Value, Augment>)),
+    nodeDestructor_(&destructNode<Node<Key, Value, Augment> >),
+    root_(NULL),
+    leftmost_(NULL),
+    rightmost_(NULL),
+    size_(0)
+{
+    buildFromSorted(first, last);
+}
+
+/**
+* Copy constructor, see cloneFrom().
+*/
+template<class Key, class Value, class Augment>
+BinarySearchTree<Key, Value, Augment>::BinarySearchTree(const BinarySearchTree<Key, Value, Augment>& other) :
+    arena_(sizeof(Node<Key, Value, Augment>), alignof(Node<Key, Value, Augment>)),
+    nodeDestructor_(&destructNode<Node<Key, Value, Augment> >),
+    root_(NULL),
+    leftmost_(NULL),
+    rightmost_(NULL),
+    size_(0)
+{
+    cloneFrom<Node<Key, Value, Augment> >(other);
+}
+
+/**
+* Move constructor, which takes over the nodes of other in O(1).
+*/
+template<class Key, class Value, class Augment>
+BinarySearchTree<Key, Value, Augment>::BinarySearchTree(BinarySearchTree<Key, Value, Augment>&& other) :
+    arena_(std::move(other.arena_)),
+    nodeDestructor_(other.nodeDestructor_),
+    root_(other.root_),
+    leftmost_(other.leftmost_),
+    rightmost_(other.rightmost_),
+    size_(other.size_)
+{
+    other.root_ = NULL;
+    other.leftmost_ = NULL;
+    other.rightmost_ = NULL;
+    other.size_ = 0;
+}
+
+/**
+* Copy assignment. The copy is made before anything is cleared, so this
+* tree is unchanged if it throws.
+*/
+template<class Key, class Value, class Augment>
+BinarySearchTree<Key, Value, Augment>&
+BinarySearchTree<Key, Value, Augment>::operator=(const BinarySearchTree<Key, Value, Augment>& other)
+{
+    if(&other != this) {
+        BinarySearchTree<Key, Value, Augment> copy(other);
+        takeFrom(copy);
+    }
+    return *this;
+}
+
+/**
+* Move assignment, which frees this tree's nodes and takes over other's.
+*/
+template<class Key, class Value, class Augment>
+BinarySearchTree<Key, Value, Augment>&
+BinarySearchTree<Key, Value, Augment>::operator=(BinarySearchTree<Key, Value, Augment>&& other)
+{
+    if(&other != this) {
+        takeFrom(other);
+    }
+    return *this;
+}
+
+template<typename Key, typename Value, typename Augment>
+BinarySearchTree<Key, Value, Augment>::~BinarySearchTree()
+{
+    // TODO
+		clear();
+
+}
+
+/**
+ * Returns true if tree is empty
+*/
+template<class Key, class Value, class Augment>
+bool BinarySearchTree<Key, Value, Augment>::empty() const
+{
+    return root_ == NULL;
+}
+
+/**
+* Returns the number of bytes of node memory currently held by the tree.
+*/
+template<class Key, class Value, class Augment>
+std::size_t BinarySearchTree<Key, Value, Augment>::memoryUsage() const
+{
+    return arena_.bytesReserved();
+}
+
+template<typename Key, typename Value, typename Augment>
+void BinarySearchTree<Key, Value, Augment>::print() const
+{
+    printRoot(root_);
+    std::cout << "\n";
+}
+
+/**
+* Returns an iterator to the "smallest" item in the tree, in O(1)
+*/
+template<class Key, class Value, class Augment>
+typename BinarySearchTree<Key, Value, Augment>::iterator
+BinarySearchTree<Key, Value, Augment>::begin() const
+{
+    BinarySearchTree<Key, Value, Augment>::iterator begin(leftmost_, this);
+    return begin;
+}
+
+/**
+* Returns an iterator whose value means INVALID
+*/
+template<class Key, class Value, class Augment>
+typename BinarySearchTree<Key, Value, Augment>::iterator
+BinarySearchTree<Key, Value, Augment>::end() const
+{
+    BinarySearchTree<Key, Value, Augment>::iterator end(NULL, this);
+    return end;
+}
+
+/**
+ * @precondition The tree is not empty
+ * Returns the item with the smallest key, in O(1)
+ */
+template<class Key, class Value, class Augment>
+std::pair<const Key, Value>& BinarySearchTree<Key, Value, Augment>::front() const
+{
+    return leftmost_->getItem();
+}
+
+/**
+ * @precondition The tree is not empty
+ * Returns the item with the largest key, in O(1)
+ */
+template<class Key, class Value, class Augment>
+std::pair<const Key, Value>& BinarySearchTree<Key, Value, Augment>::back() const
+{
+    return rightmost_->getItem();
+}
+
+/**
+* Removes the item with the smallest key, straight from the cached node.
+*/
+template<class Key, class Value, class Augment>
+void BinarySearchTree<Key, Value, Augment>::pop_min()
+{
+    if(leftmost_ != NULL) {
+        removeNode(leftmost_);
+    }
+}
+
+/**
+* Removes the item with the largest key, straight from the cached node.
+*/
+template<class Key, class Value, class Augment>
+void BinarySearchTree<Key, Value, Augment>::pop_max()
+{
+    if(rightmost_ != NULL) {
+        removeNode(rightmost_);
+    }
+}
+
+/**
+* Returns a read-only iterator to the smallest item in the tree.
+*/
+template<class Key, class Value, class Augment>
+typename BinarySearchTree<Key, Value, Augment>::const_iterator
+BinarySearchTree<Key, Value, Augment>::cbegin() const
+{
+    return begin();
+}
+
+/**
+* Returns the read-only end iterator.
+*/
+template<class Key, class Value, class Augment>
+typename BinarySearchTree<Key, Value, Augment>::const_iterator
+BinarySearchTree<Key, Value, Augment>::cend() const
+{
+    return end();
+}
+
+/**
+* Returns an iterator to the largest item that moves towards smaller keys.
+*/
+template<class Key, class Value, class Augment>
+typename BinarySearchTree<Key, Value, Augment>::reverse_iterator
+BinarySearchTree<Key, Value, Augment>::rbegin() const
+{
+    return reverse_iterator(end());
+}
+
+/**
+* Returns the end iterator for rbegin().
+*/
+template<class Key, class Value, class Augment>
+typename BinarySearchTree<Key, Value, Augment>::reverse_iterator
+BinarySearchTree<Key, Value, Augment>::rend() const
+{
+    return reverse_iterator(begin());
+}
+
+/**
+* Read-only version of rbegin().
+*/
+template<class Key, class Value, class Augment>
+typename BinarySearchTree<Key, Value, Augment>::const_reverse_iterator
+BinarySearchTree<Key, Value, Augment>::crbegin() const
+{
+    return const_reverse_iterator(cend());
+}
+
+/**
+* Read-only version of rend().
+*/
+template<class Key, class Value, class Augment>
+typename BinarySearchTree<Key, Value, Augment>::const_reverse_iterator
+BinarySearchTree<Key, Value, Augment>::crend() const
+{
+    return const_reverse_iterator(cbegin());
+}
+
+/**
+* Returns an iterator to the item with the given key, k
+* or the end iterator if k does not exist in the tree
+*/
+template<class Key, class Value, class Augment>
+typename BinarySearchTree<Key, Value, Augment>::iterator
+BinarySearchTree<Key, Value, Augment>::find(const Key & k) const
+{
+    Node<Key, Value, Augment> *curr = internalFind(k);
+    BinarySearchTree<Key, Value, Augment>::iterator it(curr, this);
+    return it;
+}
+
+/**
+ * @precondition The key exists in the map
+ * Returns the value associated with the key
+ */
+template<class Key, class Value, class Augment>
+Value& BinarySearchTree<Key, Value, Augment>::operator[](const Key& key)
+{
+    Node<Key, Value, Augment> *curr = internalFind(key);
+    if(curr == NULL) throw std::out_of_range("Invalid key");
+    return curr->getValue();
+}
+template<class Key, class Value, class Augment>
+Value const & BinarySearchTree<Key, Value, Augment>::operator[](const Key& key) const
+{
+    Node<Key, Value, Augment> *curr = internalFind(key);
+    if(curr == NULL) throw std::out_of_range("Invalid key");
+    return curr->getValue();
+}
+
+/**
+* An insert method to insert into a Binary Search Tree.
+* The tree will not remain balanced when inserting.
+* Recall: If key is already in the tree, you should 
+* overwrite the current value with the updated value.
+*/
+template<class Key, class Value, class Augment>
+void BinarySearchTree<Key, Value, Augment>::insert(const std::pair<const Key, Value> &keyValuePair)
+{
+    insert_or_assign(keyValuePair.first, keyValuePair.second);
+}
+
+/**
+* An insert method that moves the value out of keyValuePair, both into a
+* new node and when overwriting an existing one. The key is const inside
+* the pair and is copied; use insert_or_assign() to move it as well.
+*/
+template<class Key, class Value, class Augment>
+void BinarySearchTree<Key, Value, Augment>::insert(std::pair<const Key, Value>&& keyValuePair)
+{
+    insert_or_assign(keyValuePair.first, std::move(keyValuePair.second));
+}
+
+/**
+* Inserts a new item with the given key and a value constructed in place
+* from args. If the key is already in the tree nothing is constructed and
+* the existing item is left alone. Returns an iterator to the item with
+* the key and whether an insertion took place.
+*/
+template<class Key, class Value, class Augment>
+template<typename... Args>
+std::pair<typename BinarySearchTree<Key, Value, Augment>::iterator, bool>
+BinarySearchTree<Key, Value, Augment>::try_emplace(const Key& key, Args&&... args)
+{
+    std::pair<Node<Key, Value, Augment>*, bool> result =
+        internalTryEmplace(key, std::forward<Args>(args)...);
+    return std::make_pair(iterator(result.first, this), result.second);
+}
+
+/**
+* As above, but the key is moved into the new node (and left untouched
+* if the key is already in the tree).
+*/
+template<class Key, class Value, class Augment>
+template<typename... Args>
+std::pair<typename BinarySearchTree<Key, Value, Augment>::iterator, bool>
+BinarySearchTree<Key, Value, Augment>::try_emplace(Key&& key, Args&&... args)
+{
+    std::pair<Node<Key, Value, Augment>*, bool> result =
+        internalTryEmplace(std::move(key), std::forward<Args>(args)...);
+    return std::make_pair(iterator(result.first, this), result.second);
+}
+
+/**
+* Inserts the key with value obj, or assigns obj to the value if the key
+* is already in the tree. Returns an iterator to the item with the key
+* and whether an insertion (rather than an assignment) took place.
+*/
+template<class Key, class Value, class Augment>
+template<typename M>
+std::pair<typename BinarySearchTree<Key, Value, Augment>::iterator, bool>
+BinarySearchTree<Key, Value, Augment>::insert_or_assign(const Key& key, M&& obj)
+{
+    std::pair<Node<Key, Value, Augment>*, bool> result =
+        internalInsertOrAssign(key, std::forward<M>(obj));
+    return std::make_pair(iterator(result.first, this), result.second);
+}
+
+/**
+* As above, but the key is moved into the new node (and left untouched
+* if the key is already in the tree).
+*/
+template<class Key, class Value, class Augment>
+template<typename M>
+std::pair<typename BinarySearchTree<Key, Value, Augment>::iterator, bool>
+BinarySearchTree<Key, Value, Augment>::insert_or_assign(Key&& key, M&& obj)
+{
+    std::pair<Node<Key, Value, Augment>*, bool> result =
+        internalInsertOrAssign(std::move(key), std::forward<M>(obj));
+    return std::make_pair(iterator(result.first, this), result.second);
+}
+
+/**
+* Constructs an item in place from args (anything std::pair's constructors
+* accept) and inserts it if its key is not already in the tree. Otherwise
+* the new item is discarded. Returns an iterator to the item with the key
+* and whether an insertion took place.
+*/
+template<class Key, class Value, class Augment>
+template<typename... Args>
+std::pair<typename BinarySearchTree<Key, Value, Augment>::iterator, bool>
+BinarySearchTree<Key, Value, Augment>::emplace(Args&&... args)
+{
+    std::pair<Node<Key, Value, Augment>*, bool> result =
+        internalEmplace(std::forward<Args>(args)...);
+    return std::make_pair(iterator(result.first, this), result.second);
+}
+
+/**
+* Clears the tree and rebuilds it from [first, last), which must be sorted
+* by strictly increasing key. Runs in linear time: the nodes are allocated
+* as one contiguous run and linked straight into a height-balanced shape,
+* so sorted input no longer degenerates into a linked list.
+*/
+template<class Key, class Value, class Augment>
+template<typename ForwardIt>
+void BinarySearchTree<Key, Value, Augment>::buildFromSorted(ForwardIt first, ForwardIt last)
+{
+    clear();
+    std::size_t count = std::distance(first, last);
+    char* slot = static_cast<char*>(arena_.allocateRun(count));
+    int height;
+    root_ = buildSubtree(first, count, slot, NULL, height);
+    setBuiltHeight(height);
+    finishBuild(count);
+}
+
+// helper function that completes a tree of count nodes that was just built
+template<class Key, class Value, class Augment>
+void BinarySearchTree<Key, Value, Augment>::finishBuild(std::size_t count)
+{
+    size_ = count;
+#ifdef BST_THREADED_NODES
+    std::vector<Node<Key, Value, Augment>*> path;
+    pushLeftSpine(root_, path);
+    Node<Key, Value, Augment>* before = NULL;
+    while(!path.empty()) {
+        Node<Key, Value, Augment>* built = path.back();
+        path.pop_back();
+        threadNeighbours(before, built);
+        before = built;
+        pushLeftSpine(built->getRight(), path);
+    }
+    threadNeighbours(before, NULL);
+#endif
+    leftmost_ = (root_ != NULL) ? getSmallestNode() : NULL;
+    rightmost_ = root_;
+    while(rightmost_ != NULL && rightmost_->getRight() != NULL) {
+        rightmost_ = rightmost_->getRight();
+    }
+}
+
+/**
+* Builds a balanced subtree from the next count items of it, constructing
+* the nodes in key order into consecutive arena slots starting at slot.
+* The middle item becomes the root, so the two sides differ in size (and
+* height) by at most one. Sets height to the height of the subtree.
+*/
+template<class Key, class Value, class Augment>
+template<typename ForwardIt>
+Node<Key, Value, Augment>* BinarySearchTree<Key, Value, Augment>::buildSubtree(ForwardIt& it, std::size_t count, char*& slot,
+                                                             Node<Key, Value, Augment>* parent, int& height)
+{
+    if(count == 0) {
+        height = 0;
+        return NULL;
+    }
+    std::size_t leftCount = (count - 1) / 2;
+    int leftHeight;
+    int rightHeight;
+    // the left subtree comes first in key order, so build it before its parent
+    Node<Key, Value, Augment>* left = buildSubtree(it, leftCount, slot, NULL, leftHeight);
+    Node<Key, Value, Augment>* current = makeNode(slot, parent, [&it]() {
+        return std::pair<const Key, Value>(*it);
+    });
+    slot += arena_.slotSize();
+    ++it;
+    Node<Key, Value, Augment>* right = buildSubtree(it, count - 1 - leftCount, slot, current, rightHeight);
+    current->setLeft(left);
+    if(left != NULL) {
+        left->setParent(current);
+    }
+    current->setRight(right);
+    setBuiltBalance(current, rightHeight - leftHeight);
+    pullUp(current);
+    height = 1 + std::max(leftHeight, rightHeight);
+    return current;
+}
+
+/**
+* Clears the tree and rebuilds it from the unsorted items of [first,
+* last). Every step of parallelBuild() runs on one WorkStealingPool: a
+* copy of the items made in pieces, a stable merge sort of the copy that
+* works in place with room for half of it, a pass that constructs a node
+* for the last item of each key straight into its slot of one arena run,
+* and a pass that links the nodes, handing subtrees to other threads down
+* to PARALLEL_GRAIN items. Besides the nodes, it needs room for one and a
+* half times the items. The result is the same tree buildFromSorted()
+* makes from the deduplicated items, laid out the same way.
+*/
+template<class Key, class Value, class Augment>
+template<typename ForwardIt>
+void BinarySearchTree<Key, Value, Augment>::parallelBuild(ForwardIt first, ForwardIt last, unsigned threads)
+{
+    typedef std::pair<Key, Value> Item;
+    clear();
+    std::size_t total = std::distance(first, last);
+    WorkStealingPool pool(threads);
+    // a few pieces per thread lets the stealing even out the work
+    std::size_t cutoff = total / (8 * pool.threads());
+    if(cutoff < PARALLEL_GRAIN) {
+        cutoff = PARALLEL_GRAIN;
+    }
+    struct KeyLess {
+        bool operator()(const Item& a, const Item& b) const { return a.first < b.first; }
+    };
+    ParallelArray<Item> items(first, total, pool, cutoff);
+    {
+        ParallelArray<Item> scratch(items.begin(), total / 2, pool, cutoff);
+        parallelStableSort(items.begin(), items.end(), scratch.begin(), KeyLess(), pool, cutoff);
+    }
+
+    // the node of the item with rank i goes to slot i of the run, at the
+    // same offset in every slot
+    char* start = NULL;
+    std::ptrdiff_t offset = 0;
+    std::size_t slotSize = arena_.slotSize();
+    std::size_t count = parallelUniqueLast(items.begin(), items.end(), KeyLess(),
+        [this, &start](std::size_t count) {
+            start = static_cast<char*>(arena_.allocateRun(count));
+        },
+        [this, &start, &offset, slotSize](std::size_t rank, Item& item) {
+            char* slot = start + rank * slotSize;
+            Node<Key, Value, Augment>* n = makeNode(slot, NULL, [&item]() {
+                return std::pair<const Key, Value>(std::move(item));
+            });
+            if(rank == 0) {
+                offset = reinterpret_cast<char*>(n) - slot;
+            }
+        },
+        pool, cutoff);
+    int height;
+    root_ = parallelLinkRun(start + offset, count, NULL, height, pool, cutoff);
+    setBuiltHeight(height);
+    finishBuild(count);
+}
+
+/**
+* Links the count nodes laid out in key order slotSize() bytes apart from
+* the one at slot into the subtree buildSubtree() would have built from their items,
+* and sets height to its height. Above cutoff nodes the left subtree is
+* handed to the pool while this thread links the right one.
+*/
+template<class Key, class Value, class Augment>
+Node<Key, Value, Augment>* BinarySearchTree<Key, Value, Augment>::parallelLinkRun(char* slot, std::size_t count,
+                                                                Node<Key, Value, Augment>* parent, int& height,
+                                                                WorkStealingPool& pool, std::size_t cutoff)
+{
+    if(count == 0) {
+        height = 0;
+        return NULL;
+    }
+    std::size_t leftCount = (count - 1) / 2;
+    std::size_t slotSize = arena_.slotSize();
+    Node<Key, Value, Augment>* current = reinterpret_cast<Node<Key, Value, Augment>*>(slot + leftCount * slotSize);
+    current->setParent(parent);
+    Node<Key, Value, Augment>* left;
+    Node<Key, Value, Augment>* right;
+    int leftHeight;
+    int rightHeight;
+    char* rightSlot = slot + (leftCount + 1) * slotSize;
+    if(count <= cutoff) {
+        left = parallelLinkRun(slot, leftCount, current, leftHeight, pool, cutoff);
+        right = parallelLinkRun(rightSlot, count - 1 - leftCount, current, rightHeight, pool, cutoff);
+    }
+    else {
+        WorkStealingPool::TaskGroup group(pool);
+        group.run([&]() {
+            left = parallelLinkRun(slot, leftCount, current, leftHeight, pool, cutoff);
+        });
+        right = parallelLinkRun(rightSlot, count - 1 - leftCount, current, rightHeight, pool, cutoff);
+        group.wait();
+    }
+    current->setLeft(left);
+    current->setRight(right);
+    setBuiltBalance(current, rightHeight - leftHeight);
+    pullUp(current);
+    height = 1 + std::max(leftHeight, rightHeight);
+    return current;
+}
+
+/**
+* Moves the items of other into this tree, keeping this tree's value for
+* keys present in both. See union_with().
+*/
+template<class Key, class Value, class Augment>
+void BinarySearchTree<Key, Value, Augment>::merge(BinarySearchTree<Key, Value, Augment>& other)
+{
+    union_with(other, KeepExisting());
+}
+
+/**
+* Moves the items of other into this tree and leaves other empty. For a
+* key present in both trees, policy(existing, incoming) decides the value
+* that is kept. Runs in O(n + m): both trees are flattened in order, the
+* two sorted sequences are merged, and the result is relinked as a
+* balanced tree. The nodes of other are reused rather than copied.
+*
+* Reusing them needs other to build the same kind of node in the same
+* slots. Derived trees only accept their own kind, but a base reference
+* can still pass another; its items are then inserted one by one.
+*/
+template<class Key, class Value, class Augment>
+template<typename ConflictPolicy>
+void BinarySearchTree<Key, Value, Augment>::union_with(BinarySearchTree<Key, Value, Augment>& other, ConflictPolicy policy)
+{
+    if(&other == this || other.root_ == NULL) {
+        return;
+    }
+    if(typeid(*this) != typeid(other)) {
+        for(iterator theirs(other.leftmost_, &other); theirs.current_ != NULL; ++theirs) {
+            Node<Key, Value, Augment>* existing = internalFind(theirs->first);
+            if(existing == NULL) {
+                insert_or_assign(theirs->first, std::move(theirs->second));
+            }
+            else {
+                // assigned back so the aggregates above it are updated
+                Value value(existing->getValue());
+                policy(value, theirs->second);
+                insert_or_assign(theirs->first, std::move(value));
+            }
+        }
+        other.clear();
+        return;
+    }
+    // walk both trees in order before any links are changed
+    std::vector<Node<Key, Value, Augment>*> merged;
+    std::vector<Node<Key, Value, Augment>*> duplicates;
+    iterator mine(leftmost_, this);
+    iterator theirs(other.leftmost_, &other);
+    while(mine.current_ != NULL && theirs.current_ != NULL) {
+        if(mine.current_->getKey() < theirs.current_->getKey()) {
+            merged.push_back(mine.current_);
+            ++mine;
+        }
+        else if(theirs.current_->getKey() < mine.current_->getKey()) {
+            merged.push_back(theirs.current_);
+            ++theirs;
+        }
+        else {
+            policy(mine.current_->getValue(), theirs.current_->getValue());
+            merged.push_back(mine.current_);
+            duplicates.push_back(theirs.current_);
+            ++mine;
+            ++theirs;
+        }
+    }
+    for(; mine.current_ != NULL; ++mine) {
+        merged.push_back(mine.current_);
+    }
+    for(; theirs.current_ != NULL; ++theirs) {
+        merged.push_back(theirs.current_);
+    }
+
+    // other's nodes now belong to this tree's arena
+    arena_.adopt(other.arena_);
+    other.root_ = NULL;
+    other.leftmost_ = NULL;
+    other.rightmost_ = NULL;
+    other.size_ = 0;
+    for(std::size_t i = 0; i < duplicates.size(); ++i) {
+        destroyNode(duplicates[i]);
+    }
+
+    int height;
+    root_ = linkSubtree(&merged[0], merged.size(), NULL, height);
+    setBuiltHeight(height);
+    threadSequence(merged.data(), merged.size());
+    leftmost_ = merged.front();
+    rightmost_ = merged.back();
+    size_ = merged.size();
+}
+
+/**
+* Relinks count existing nodes, given in key order, into a balanced
+* subtree below parent, the same shape that buildSubtree() creates.
+* Sets height to the height of the subtree.
+*/
+template<class Key, class Value, class Augment>
+Node<Key, Value, Augment>* BinarySearchTree<Key, Value, Augment>::linkSubtree(Node<Key, Value, Augment>** nodes, std::size_t count,
+                                                            Node<Key, Value, Augment>* parent, int& height)
+{
+    if(count == 0) {
+        height = 0;
+        return NULL;
+    }
+    std::size_t leftCount = (count - 1) / 2;
+    int leftHeight;
+    int rightHeight;
+    Node<Key, Value, Augment>* current = nodes[leftCount];
+    current->setParent(parent);
+    current->setLeft(linkSubtree(nodes, leftCount, current, leftHeight));
+    current->setRight(linkSubtree(nodes + leftCount + 1, count - 1 - leftCount, current, rightHeight));
+    setBuiltBalance(current, rightHeight - leftHeight);
+    pullUp(current);
+    height = 1 + std::max(leftHeight, rightHeight);
+    return current;
+}
+
+/**
+* Returns an iterator to the first item whose key is not less than key.
+*/
+template<class Key, class Value, class Augment>
+typename BinarySearchTree<Key, Value, Augment>::iterator
+BinarySearchTree<Key, Value, Augment>::lower_bound(const Key& key) const
+{
+    return iterator(internalLowerBound(key), this);
+}
+
+/**
+* Returns an iterator to the first item whose key is greater than key.
+*/
+template<class Key, class Value, class Augment>
+typename BinarySearchTree<Key, Value, Augment>::iterator
+BinarySearchTree<Key, Value, Augment>::upper_bound(const Key& key) const
+{
+    return iterator(internalUpperBound(key), this);
+}
+
+/**
+* Returns lower_bound(key) and upper_bound(key), which span the item
+* with the given key if there is one.
+*/
+template<class Key, class Value, class Augment>
+std::pair<typename BinarySearchTree<Key, Value, Augment>::iterator,
+          typename BinarySearchTree<Key, Value, Augment>::iterator>
+BinarySearchTree<Key, Value, Augment>::equal_range(const Key& key) const
+{
+    Node<Key, Value, Augment>* first = internalLowerBound(key);
+    Node<Key, Value, Augment>* last = first;
+    // keys are unique, so the range holds at most the one item
+    if(first != NULL && !(key < first->getKey())) {
+        last = internalUpperBound(key);
+    }
+    return std::make_pair(iterator(first, this), iterator(last, this));
+}
+
+/**
+* Returns an iterator to the item with the largest key not greater than key.
+*/
+template<class Key, class Value, class Augment>
+typename BinarySearchTree<Key, Value, Augment>::iterator
+BinarySearchTree<Key, Value, Augment>::floor(const Key& key) const
+{
+    Node<Key, Value, Augment>* candidate = NULL;
+    Node<Key, Value, Augment>* current = root_;
+    while(current != NULL) {
+        if(key < current->getKey()) {
+            current = current->getLeft();
+        }
+        else {
+            candidate = current;
+            current = current->getRight();
+        }
+    }
+    return iterator(candidate, this);
+}
+
+/**
+* Returns an iterator to the item with the smallest key not less than key.
+*/
+template<class Key, class Value, class Augment>
+typename BinarySearchTree<Key, Value, Augment>::iterator
+BinarySearchTree<Key, Value, Augment>::ceiling(const Key& key) const
+{
+    return lower_bound(key);
+}
+
+/**
+* Returns a view of the items with keys in [lo, hi). Finding the ends
+* takes two descents, and walking the view visits only the items in it,
+* so scanning k items costs O(log n + k).
+*/
+template<class Key, class Value, class Augment>
+typename BinarySearchTree<Key, Value, Augment>::range_view
+BinarySearchTree<Key, Value, Augment>::range(const Key& lo, const Key& hi) const
+{
+    if(!(lo < hi)) {
+        return range_view(end(), end());
+    }
+    return range_view(lower_bound(lo), lower_bound(hi));
+}
+
+/**
+* Calls fn on every item in key order, as fn(std::pair<const Key, Value>&).
+* fn must not insert or remove items.
+*/
+template<class Key, class Value, class Augment>
+template<typename Fn>
+void BinarySearchTree<Key, Value, Augment>::for_each(Fn fn) const
+{
+    std::vector<Node<Key, Value, Augment>*> path;
+    path.reserve(64);
+    pushLeftSpine(root_, path);
+    visitFrom(path, NULL, fn);
+}
+
+/**
+* Calls fn on the items with keys in [lo, hi) in key order. Finding lo is
+* one descent, so visiting k items costs O(log n + k).
+*/
+template<class Key, class Value, class Augment>
+template<typename Fn>
+void BinarySearchTree<Key, Value, Augment>::for_each_range(const Key& lo, const Key& hi, Fn fn) const
+{
+    if(!(lo < hi)) {
+        return;
+    }
+    std::vector<Node<Key, Value, Augment>*> path;
+    path.reserve(64);
+    // keep the nodes not less than lo, which still have to be visited
+    Node<Key, Value, Augment>* current = root_;
+    while(current != NULL) {
+        if(current->getKey() < lo) {
+            current = current->getRight();
+        }
+        else {
+            BST_PREFETCH(current->getRight());
+            path.push_back(current);
+            current = current->getLeft();
+        }
+    }
+    visitFrom(path, &hi, fn);
+}
+
+/**
+* The in-order walk behind for_each() and for_each_range(). path holds the
+* nodes still to be visited whose left subtrees are done, deepest last.
+* Stops before the first key that is not less than *hi, if hi is given.
+*/
+template<class Key, class Value, class Augment>
+template<typename Fn>
+void BinarySearchTree<Key, Value, Augment>::visitFrom(std::vector<Node<Key, Value, Augment>*>& path, const Key* hi, Fn& fn)
+{
+    while(!path.empty()) {
+        Node<Key, Value, Augment>* current = path.back();
+        path.pop_back();
+        if(hi != NULL && !(current->getKey() < *hi)) {
+            return;
+        }
+        fn(current->getItem());
+        pushLeftSpine(current->getRight(), path);
+    }
+}
+
+// helper function that pushes n and its chain of left children, prefetching
+// each right child, which is visited once the nodes below it are done
+template<class Key, class Value, class Augment>
+void BinarySearchTree<Key, Value, Augment>::pushLeftSpine(Node<Key, Value, Augment>* n,
+                                                 std::vector<Node<Key, Value, Augment>*>& path)
+{
+    while(n != NULL) {
+        BST_PREFETCH(n->getRight());
+        path.push_back(n);
+        n = n->getLeft();
+    }
+}
+
+/**
+* Calls fn on every item, as fn(std::pair<const Key, Value>&), from up to
+* threads threads at once; see parallelDepth() for how the tree is split.
+* fn must be safe to call concurrently and must not insert or remove items.
+*/
+template<class Key, class Value, class Augment>
+template<typename Fn>
+void BinarySearchTree<Key, Value, Augment>::parallel_for_each(Fn fn, unsigned threads) const
+{
+    if(parallelDepth(threads) == 0) {
+        for_each(fn);
+        return;
+    }
+    WorkStealingPool pool(threads);
+    parallel_for_each(fn, pool);
+}
+
+/**
+* Calls fn on every item as above, on the threads of pool.
+*/
+template<class Key, class Value, class Augment>
+template<typename Fn>
+void BinarySearchTree<Key, Value, Augment>::parallel_for_each(Fn fn, WorkStealingPool& pool) const
+{
+    unsigned depth = parallelDepth(pool.threads());
+    if(depth == 0) {
+        for_each(fn);
+        return;
+    }
+    parallelVisit(root_, depth, fn, &pool);
+}
+
+/**
+* Folds map over the items in key order with combine, starting from init,
+* on up to threads threads. Each subtree is reduced to
+* combine(left, combine(map(root), right)), with the subtrees above the
+* split depth reduced in parallel and those below it folded left to
+* right. map and combine must be safe to call concurrently.
+*/
+template<class Key, class Value, class Augment>
+template<typename T, typename Map, typename Combine>
+T BinarySearchTree<Key, Value, Augment>::parallel_reduce(T init, Map map, Combine combine, unsigned threads) const
+{
+    if(root_ == NULL) {
+        return init;
+    }
+    if(parallelDepth(threads) == 0) {
+        return combine(init, reduceSubtree<T>(root_, 0, map, combine, NULL));
+    }
+    WorkStealingPool pool(threads);
+    return parallel_reduce(init, map, combine, pool);
+}
+
+/**
+* Folds map over the items as above, on the threads of pool.
+*/
+template<class Key, class Value, class Augment>
+template<typename T, typename Map, typename Combine>
+T BinarySearchTree<Key, Value, Augment>::parallel_reduce(T init, Map map, Combine combine, WorkStealingPool& pool) const
+{
+    if(root_ == NULL) {
+        return init;
+    }
+    unsigned depth = parallelDepth(pool.threads());
+    return combine(init, reduceSubtree<T>(root_, depth, map, combine, (depth == 0) ? NULL : &pool));
+}
+
+/**
+* Returns how many levels below the root parallel_for_each() and
+* parallel_reduce() hand subtrees to other threads, 0 for none. Deep
+* enough for about eight subtrees per thread, so stealing can even out
+* unequal ones, but no deeper than keeps a balanced tree's subtrees at
+* PARALLEL_GRAIN items or more.
+*/
+template<class Key, class Value, class Augment>
+unsigned BinarySearchTree<Key, Value, Augment>::parallelDepth(unsigned threads) const
+{
+    if(threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    if(threads == 1 || root_ == NULL) {
+        return 0;
+    }
+    std::size_t count = size();
+    unsigned depth = 0;
+    while((std::size_t(1) << depth) < 8 * std::size_t(threads) && (count >> (depth + 1)) >= PARALLEL_GRAIN) {
+        ++depth;
+    }
+    return depth;
+}
+
+/**
+* Calls fn on the items of the subtree under n. For depth levels the left
+* subtree is handed to pool while this thread does the root and the right
+* subtree; below that the subtree is walked in key order.
+*/
+template<class Key, class Value, class Augment>
+template<typename Fn>
+void BinarySearchTree<Key, Value, Augment>::parallelVisit(Node<Key, Value, Augment>* n, unsigned depth, Fn& fn,
+                                                 WorkStealingPool* pool)
+{
+    if(depth == 0 || n == NULL) {
+        std::vector<Node<Key, Value, Augment>*> path;
+        path.reserve(64);
+        pushLeftSpine(n, path);
+        visitFrom(path, NULL, fn);
+        return;
+    }
+    WorkStealingPool::TaskGroup group(*pool);
+    Node<Key, Value, Augment>* left = n->getLeft();
+    group.run([left, depth, &fn, pool]() {
+        parallelVisit(left, depth - 1, fn, pool);
+    });
+    fn(n->getItem());
+    parallelVisit(n->getRight(), depth - 1, fn, pool);
+    group.wait();
+}
+
+/**
+* Reduces the non-empty subtree under n to the in-order fold of its
+* mapped items, splitting it for depth levels as parallelVisit() does.
+* The grouping of combine() calls depends only on the tree and depth.
+*/
+template<class Key, class Value, class Augment>
+template<typename T, typename Map, typename Combine>
+T BinarySearchTree<Key, Value, Augment>::reduceSubtree(Node<Key, Value, Augment>* n, unsigned depth, Map& map,
+                                              Combine& combine, WorkStealingPool* pool)
+{
+    if(depth == 0) {
+        std::vector<Node<Key, Value, Augment>*> path;
+        path.reserve(64);
+        pushLeftSpine(n, path);
+        Node<Key, Value, Augment>* first = path.back();
+        path.pop_back();
+        T result = map(first->getItem());
+        pushLeftSpine(first->getRight(), path);
+        auto fold = [&result, &map, &combine](std::pair<const Key, Value>& item) {
+            result = combine(result, map(item));
+        };
+        visitFrom(path, NULL, fold);
+        return result;
+    }
+    Node<Key, Value, Augment>* left = n->getLeft();
+    Node<Key, Value, Augment>* right = n->getRight();
+    // holds the left result, as T need not be default constructible
+    std::vector<T> leftResult;
+    leftResult.reserve(1);
+    WorkStealingPool::TaskGroup group(*pool);
+    if(left != NULL) {
+        group.run([left, depth, &map, &combine, pool, &leftResult]() {
+            leftResult.push_back(reduceSubtree<T>(left, depth - 1, map, combine, pool));
+        });
+    }
+    T result = map(n->getItem());
+    if(right != NULL) {
+        result = combine(result, reduceSubtree<T>(right, depth - 1, map, combine, pool));
+    }
+    group.wait();
+    if(left != NULL) {
+        result = combine(leftResult.front(), result);
+    }
+    return result;
+}
+
+/**
+* Descends to the first node whose key is not less than key, or NULL.
+*/
+template<class Key, class Value, class Augment>
+Node<Key, Value, Augment>* BinarySearchTree<Key, Value, Augment>::internalLowerBound(const Key& key) const
+{
+    Node<Key, Value, Augment>* candidate = NULL;
+    Node<Key, Value, Augment>* current = root_;
+    while(current != NULL) {
+        if(current->getKey() < key) {
+            current = current->getRight();
+        }
+        else {
+            candidate = current;
+            current = current->getLeft();
+        }
+    }
+    return candidate;
+}
+
+/**
+* Descends to the first node whose key is greater than key, or NULL.
+*/
+template<class Key, class Value, class Augment>
+Node<Key, Value, Augment>* BinarySearchTree<Key, Value, Augment>::internalUpperBound(const Key& key) const
+{
+    Node<Key, Value, Augment>* candidate = NULL;
+    Node<Key, Value, Augment>* current = root_;
+    while(current != NULL) {
+        if(key < current->getKey()) {
+            candidate = current;
+            current = current->getLeft();
+        }
+        else {
+            current = current->getRight();
+        }
+    }
+    return candidate;
+}
+
+/**
+* Returns the number of items in the tree. O(1), except that the first
+* call after an unaugmented tree was split counts the items in O(n).
+*/
+template<class Key, class Value, class Augment>
+std::size_t BinarySearchTree<Key, Value, Augment>::size() const
+{
+    return knownSize(AugmentCounts<Augment>());
+}
+
+// helper function for size when the root's aggregate holds the size
+template<class Key, class Value, class Augment>
+std::size_t BinarySearchTree<Key, Value, Augment>::knownSize(std::true_type) const
+{
+    return subtreeCount(root_);
+}
+
+// helper function for size that relies on the item count
+template<class Key, class Value, class Augment>
+std::size_t BinarySearchTree<Key, Value, Augment>::knownSize(std::false_type) const
+{
+    if(size_ == UNKNOWN_SIZE) {
+        size_ = 0;
+        for(iterator it(leftmost_, this); it.current_ != NULL; ++it) {
+            ++size_;
+        }
+    }
+    return size_;
+}
+
+/**
+* Returns the number of items below and including n, from its aggregate.
+*/
+template<class Key, class Value, class Augment>
+std::size_t BinarySearchTree<Key, Value, Augment>::subtreeCount(Node<Key, Value, Augment>* n)
+{
+    static_assert(AugmentCounts<Augment>::value, "order statistics need a size-tracking augmentation such as SubtreeSize");
+    return (n != NULL) ? Augment::count(n->getAugment()) : 0;
+}
+
+/**
+* Returns how many keys in the tree are less than key, which is also the
+* position key has or would have in sorted order.
+*/
+template<class Key, class Value, class Augment>
+std::size_t BinarySearchTree<Key, Value, Augment>::rank(const Key& key) const
+{
+    std::size_t less = 0;
+    Node<Key, Value, Augment>* current = root_;
+    while(current != NULL) {
+        if(current->getKey() < key) {
+            less += subtreeCount(current->getLeft()) + 1;
+            current = current->getRight();
+        }
+        else {
+            current = current->getLeft();
+        }
+    }
+    return less;
+}
+
+/**
+* Returns an iterator to the k-th smallest item, counting from zero, or
+* end() if the tree holds k items or fewer.
+*/
+template<class Key, class Value, class Augment>
+typename BinarySearchTree<Key, Value, Augment>::iterator
+BinarySearchTree<Key, Value, Augment>::select(std::size_t k) const
+{
+    Node<Key, Value, Augment>* current = root_;
+    while(current != NULL) {
+        std::size_t leftCount = subtreeCount(current->getLeft());
+        if(k < leftCount) {
+            current = current->getLeft();
+        }
+        else if(k == leftCount) {
+            return iterator(current, this);
+        }
+        else {
+            k -= leftCount + 1;
+            current = current->getRight();
+        }
+    }
+    return end();
+}
+
+/**
+* Returns the number of keys k with lo <= k < hi.
+*/
+template<class Key, class Value, class Augment>
+std::size_t BinarySearchTree<Key, Value, Augment>::count_range(const Key& lo, const Key& hi) const
+{
+    if(!(lo < hi)) {
+        return 0;
+    }
+    return rank(hi) - rank(lo);
+}
+
+/**
+* Returns the aggregate of the items with keys in [lo, hi), combined in
+* key order. The descent stops at the first node inside the range; below
+* it, one path gathers the items >= lo from its left subtree and another
+* the items < hi from its right subtree, each taking whole subtrees'
+* aggregates where it can.
+*/
+template<class Key, class Value, class Augment>
+template<typename A>
+typename A::value_type BinarySearchTree<Key, Value, Augment>::aggregate(const Key& lo, const Key& hi) const
+{
+    if(!(lo < hi)) {
+        return A::identity();
+    }
+    Node<Key, Value, Augment>* top = root_;
+    while(top != NULL && (top->getKey() < lo || !(top->getKey() < hi))) {
+        top = (top->getKey() < lo) ? top->getRight() : top->getLeft();
+    }
+    if(top == NULL) {
+        return A::identity();
+    }
+
+    // items >= lo in the left subtree, found from right to left
+    typename A::value_type suffix = A::identity();
+    Node<Key, Value, Augment>* current = top->getLeft();
+    while(current != NULL) {
+        if(current->getKey() < lo) {
+            current = current->getRight();
+        }
+        else {
+            typename A::value_type item = A::template lift<Key, Value>(current->getKey(), current->getValue());
+            suffix = A::combine(A::combine(item, subtreeAggregate<A>(current->getRight())), suffix);
+            current = current->getLeft();
+        }
+    }
+    // items < hi in the right subtree, found from left to right
+    typename A::value_type prefix = A::identity();
+    current = top->getRight();
+    while(current != NULL) {
+        if(current->getKey() < hi) {
+            typename A::value_type item = A::template lift<Key, Value>(current->getKey(), current->getValue());
+            prefix = A::combine(prefix, A::combine(subtreeAggregate<A>(current->getLeft()), item));
+            current = current->getRight();
+        }
+        else {
+            current = current->getLeft();
+        }
+    }
+    typename A::value_type item = A::template lift<Key, Value>(top->getKey(), top->getValue());
+    return A::combine(A::combine(suffix, item), prefix);
+}
+
+/**
+* Returns the aggregate of every item in the tree, in O(1).
 */
-template<class Key, class Value>
-BinarySearchTree<Key, Value>::iterator::iterator(Node<Key,Value> *ptr)
+template<class Key, class Value, class Augment>
+template<typename A>
+typename A::value_type BinarySearchTree<Key, Value, Augment>::aggregate() const
 {
-    // TODO
-		current_ = ptr;
+    return subtreeAggregate<A>(root_);
 }
 
 /**
-* A default constructor that initializes the iterator to NULL.
+* Returns the aggregate stored in n, or the identity for an empty subtree.
 */
-template<class Key, class Value>
-BinarySearchTree<Key, Value>::iterator::iterator() 
+template<class Key, class Value, class Augment>
+template<typename A>
+typename A::value_type BinarySearchTree<Key, Value, Augment>::subtreeAggregate(Node<Key, Value, Augment>* n)
 {
-    // TODO
-		current_ = NULL;
+    return (n != NULL) ? n->getAugment() : A::identity();
 }
 
 /**
-* Provides access to the item.
+* Inserts keyValuePair using hint as the likely position: if the key
+* belongs right before hint, no descent from the root is needed.
+* A wrong hint only costs a normal insert.
 */
-template<class Key, class Value>
-std::pair<const Key,Value> &
-BinarySearchTree<Key, Value>::iterator::operator*() const
+template<class Key, class Value, class Augment>
+typename BinarySearchTree<Key, Value, Augment>::iterator
+BinarySearchTree<Key, Value, Augment>::insert(const iterator& hint, const std::pair<const Key, Value>& keyValuePair)
 {
-    return current_->getItem();
+    return iterator(internalInsertOrAssignHint(
+        hint, keyValuePair.first, keyValuePair.second).first, this);
 }
 
 /**
-* Provides access to the address of the item.
+* Hinted insert that moves the value out of keyValuePair.
 */
-template<class Key, class Value>
-std::pair<const Key,Value> *
-BinarySearchTree<Key, Value>::iterator::operator->() const
+template<class Key, class Value, class Augment>
+typename BinarySearchTree<Key, Value, Augment>::iterator
+BinarySearchTree<Key, Value, Augment>::insert(const iterator& hint, std::pair<const Key, Value>&& keyValuePair)
 {
-    return &(current_->getItem());
+    return iterator(internalInsertOrAssignHint(
+        hint, keyValuePair.first, std::move(keyValuePair.second)).first, this);
 }
 
 /**
-* Checks if 'this' iterator's internals have the same value
-* as 'rhs'
+* Helper function for the insertion methods that walks down from the root
+* once. Returns the node with the given key if there is one. Otherwise
+* returns NULL and sets parent and isLeft to the spot where a node with
+* that key should be attached (parent is NULL for an empty tree).
+* Keys past the current maximum are appended without any descent.
 */
-template<class Key, class Value>
-bool
-BinarySearchTree<Key, Value>::iterator::operator==(
-    const BinarySearchTree<Key, Value>::iterator& rhs) const
+template<class Key, class Value, class Augment>
+Node<Key, Value, Augment>*
+BinarySearchTree<Key, Value, Augment>::internalFindSlot(const Key& key, Node<Key, Value, Augment>*& parent, bool& isLeft) const
 {
-    // TODO
-		if(&(this->current_->getItem()) == &(rhs.current_->getItem())) {
-			return true;
-		}
-		return false;
+    Node<Key, Value, Augment>* current = root_;
+    parent = NULL;
+    isLeft = false;
+    // append fast path for sequential keys
+    if(rightmost_ != NULL && rightmost_->getKey() < key) {
+        parent = rightmost_;
+        return NULL;
+    }
+    while(current != NULL) {
+        if(key < current->getKey()) {
+            parent = current;
+            isLeft = true;
+            current = current->getLeft();
+        }
+        else if(current->getKey() < key) {
+            parent = current;
+            isLeft = false;
+            current = current->getRight();
+        }
+        else {
+            return current;
+        }
+    }
+    return NULL;
 }
- 
+
 /**
-* Checks if 'this' iterator's internals have a different value
-* as 'rhs'
+* Like internalFindSlot(), but first checks whether the key belongs right
+* before hint (or after the largest node if hint is NULL). Only falls back
+* to a descent from the root when the hint is wrong.
 */
-template<class Key, class Value>
-bool
-BinarySearchTree<Key, Value>::iterator::operator!=(
-    const BinarySearchTree<Key, Value>::iterator& rhs) const
+template<class Key, class Value, class Augment>
+Node<Key, Value, Augment>*
+BinarySearchTree<Key, Value, Augment>::internalFindSlotHint(Node<Key, Value, Augment>* hint, const Key& key,
+                                                   Node<Key, Value, Augment>*& parent, bool& isLeft) const
 {
-    // TODO
-		if(&(this->current_->getItem()) != &(rhs.current_->getItem())) {
-			return true;
-		}
-		return false;
+    parent = NULL;
+    isLeft = false;
+    if(hint == NULL) {
+        // internalFindSlot() already appends past the maximum directly
+        return internalFindSlot(key, parent, isLeft);
+    }
+    if(key < hint->getKey()) {
+        Node<Key, Value, Augment>* before = predecessor(hint);
+        if(before == NULL || before->getKey() < key) {
+            // the key goes between before and hint, and one of them has a free slot
+            if(hint->getLeft() == NULL) {
+                parent = hint;
+                isLeft = true;
+            }
+            else {
+                parent = before;
+                isLeft = false;
+            }
+            return NULL;
+        }
+        if(!(key < before->getKey())) {
+            return before;
+        }
+    }
+    else if(!(hint->getKey() < key)) {
+        return hint;
+    }
+    return internalFindSlot(key, parent, isLeft);
 }
 
-
 /**
-* Advances the iterator's location using an in-order sequencing
+* Links a new leaf node into the spot found by internalFindSlot(), then
+* lets the tree rebalance through afterAttach().
 */
-template<class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator&
-BinarySearchTree<Key, Value>::iterator::operator++()
+template<class Key, class Value, class Augment>
+void BinarySearchTree<Key, Value, Augment>::attachNode(Node<Key, Value, Augment>* n, Node<Key, Value, Augment>* parent, bool isLeft)
 {
-    // // TODO
-
-    if(this->current_->getRight() != NULL) {
-		this->current_ = this->current_->getRight();
-		bool isDone = false;
-		while(!isDone) {
-			if(this->current_->getLeft() != NULL) {
-				this->current_ = this->current_->getLeft(); 
-			}
-			else {
-				isDone = true;
-				return *this;
-			}
-		}
-	}
-	else {
-		Node<Key, Value>* parent = this->current_->getParent();
-		// while(parent != NULL) {
-		// 	// if the parent node is the first instance of being a right child
-		// 	// Node<Key, Value>* parent_parent = parent->getParent();
-		// 	if(parent->getParent()->getLeft() == parent) {
-		// 		this->current_ = parent->getParent();
-        //         return *this;
-		// 	}
-		// 	else {
-		// 		parent = parent->getParent();
-		// 	}
-		// }
-        while(parent != NULL && this->current_ == parent->getRight()) {
-            this->current_ = parent;
-            parent = parent->getParent();
+    n->setParent(parent);
+#ifdef BST_THREADED_NODES
+    // the new leaf takes over the thread of the slot it fills
+    if(parent != NULL && isLeft) {
+        n->setLeftThread(parent->getLeftThread());
+        n->setRightThread(parent);
+    }
+    else if(parent != NULL) {
+        n->setLeftThread(parent);
+        n->setRightThread(parent->getRightThread());
+    }
+#endif
+    if(parent == NULL) {
+        root_ = n;
+        leftmost_ = n;
+        rightmost_ = n;
+    }
+    else if(isLeft) {
+        parent->setLeft(n);
+        if(parent == leftmost_) {
+            leftmost_ = n;
         }
-        this->current_ = parent;
-        return *this;
-	}
-	// there is no predecessor
-	return *this;
+    }
+    else {
+        parent->setRight(n);
+        if(parent == rightmost_) {
+            rightmost_ = n;
+        }
+    }
+    if(size_ != UNKNOWN_SIZE) {
+        ++size_;
+    }
+    pullUpPath(n);
+    afterAttach(n);
 }
 
-
-/*
--------------------------------------------------------------
-End implementations for the BinarySearchTree::iterator class.
--------------------------------------------------------------
+/**
+* Destroys n once it has been unlinked from below parent, and updates
+* the item count, the threads and the aggregates of parent and its
+* ancestors. n's own links must still be as they were before the unlink.
 */
+template<class Key, class Value, class Augment>
+void BinarySearchTree<Key, Value, Augment>::finishRemove(Node<Key, Value, Augment>* n, Node<Key, Value, Augment>* parent)
+{
+#ifdef BST_THREADED_NODES
+    // n still knows its neighbours, which now become adjacent
+    Node<Key, Value, Augment>* before = n->getLeftThread();
+    if(n->getLeft() != NULL) {
+        before = n->getLeft();
+        while(before->getRight() != NULL) {
+            before = before->getRight();
+        }
+    }
+    Node<Key, Value, Augment>* after = n->getRightThread();
+    if(n->getRight() != NULL) {
+        after = n->getRight();
+        while(after->getLeft() != NULL) {
+            after = after->getLeft();
+        }
+    }
+    threadNeighbours(before, after);
+#endif
+    destroyNode(n);
+    if(size_ != UNKNOWN_SIZE) {
+        --size_;
+    }
+    pullUpPath(parent);
+}
 
-/*
------------------------------------------------------
-Begin implementations for the BinarySearchTree class.
------------------------------------------------------
+/**
+* Refreshes the aggregate of n from its children.
 */
+template<class Key, class Value, class Augment>
+void BinarySearchTree<Key, Value, Augment>::pullUp(Node<Key, Value, Augment>* n)
+{
+    AugmentUpdater<Key, Value, Augment>::pullUp(n);
+}
 
 /**
-* Default constructor for a BinarySearchTree, which sets the root to NULL.
+* Refreshes the aggregates of n and all of its ancestors.
 */
-template<class Key, class Value>
-BinarySearchTree<Key, Value>::BinarySearchTree() 
+template<class Key, class Value, class Augment>
+void BinarySearchTree<Key, Value, Augment>::pullUpPath(Node<Key, Value, Augment>* n)
 {
-    // TODO
-		root_ = NULL;
+    AugmentUpdater<Key, Value, Augment>::pullUpPath(n);
 }
 
-template<typename Key, typename Value>
-BinarySearchTree<Key, Value>::~BinarySearchTree()
+/**
+* Keeps the cached leftmost and rightmost nodes correct when n, which has
+* at most one child, is about to be unlinked.
+*/
+template<class Key, class Value, class Augment>
+void BinarySearchTree<Key, Value, Augment>::updateBoundsBeforeRemove(Node<Key, Value, Augment>* n)
 {
-    // TODO
-		clear();
-
+    if(n == leftmost_) {
+        // n has no left child, so its successor takes over
+        leftmost_ = successor(n);
+    }
+    if(n == rightmost_) {
+        // n has no right child, so its predecessor takes over
+        rightmost_ = predecessor(n);
+    }
 }
 
 /**
- * Returns true if tree is empty
+* The single-descent body of try_emplace(). Returns the node with the key
+* and whether it was newly attached.
 */
-template<class Key, class Value>
-bool BinarySearchTree<Key, Value>::empty() const
+template<class Key, class Value, class Augment>
+template<typename K, typename... Args>
+std::pair<Node<Key, Value, Augment>*, bool>
+BinarySearchTree<Key, Value, Augment>::internalTryEmplace(K&& key, Args&&... args)
 {
-    return root_ == NULL;
+    Node<Key, Value, Augment>* parent;
+    bool isLeft;
+    Node<Key, Value, Augment>* existing = internalFindSlot(key, parent, isLeft);
+    if(existing != NULL) {
+        return std::make_pair(existing, false);
+    }
+    Node<Key, Value, Augment>* temp = makeNode(allocateNode(), NULL, [&]() {
+        return std::pair<const Key, Value>(std::piecewise_construct, std::forward_as_tuple(std::forward<K>(key)),
+                                           std::forward_as_tuple(std::forward<Args>(args)...));
+    });
+    attachNode(temp, parent, isLeft);
+    return std::make_pair(temp, true);
 }
 
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::print() const
+/**
+* The single-descent body of insert_or_assign().
+*/
+template<class Key, class Value, class Augment>
+template<typename K, typename M>
+std::pair<Node<Key, Value, Augment>*, bool>
+BinarySearchTree<Key, Value, Augment>::internalInsertOrAssign(K&& key, M&& obj)
 {
-    printRoot(root_);
-    std::cout << "\n";
+    Node<Key, Value, Augment>* parent;
+    bool isLeft;
+    Node<Key, Value, Augment>* existing = internalFindSlot(key, parent, isLeft);
+    return placeOrAssign(existing, parent, isLeft, std::forward<K>(key), std::forward<M>(obj));
 }
 
 /**
-* Returns an iterator to the "smallest" item in the tree
+* The body of the hinted insert().
 */
-template<class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator
-BinarySearchTree<Key, Value>::begin() const
+template<class Key, class Value, class Augment>
+template<typename K, typename M>
+std::pair<Node<Key, Value, Augment>*, bool>
+BinarySearchTree<Key, Value, Augment>::internalInsertOrAssignHint(const iterator& hint, K&& key, M&& obj)
 {
-    BinarySearchTree<Key, Value>::iterator begin(getSmallestNode());
-    return begin;
+    Node<Key, Value, Augment>* parent;
+    bool isLeft;
+    Node<Key, Value, Augment>* existing = internalFindSlotHint(hint.current_, key, parent, isLeft);
+    return placeOrAssign(existing, parent, isLeft, std::forward<K>(key), std::forward<M>(obj));
 }
 
 /**
-* Returns an iterator whose value means INVALID
+* Finishes an insert_or_assign once the slot is known: overwrites the
+* existing node's value, or attaches a new node at parent/isLeft.
 */
-template<class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator
-BinarySearchTree<Key, Value>::end() const
+template<class Key, class Value, class Augment>
+template<typename K, typename M>
+std::pair<Node<Key, Value, Augment>*, bool>
+BinarySearchTree<Key, Value, Augment>::placeOrAssign(Node<Key, Value, Augment>* existing, Node<Key, Value, Augment>* parent,
+                                            bool isLeft, K&& key, M&& obj)
 {
-    BinarySearchTree<Key, Value>::iterator end(NULL);
-    return end;
+    // if there is a duplicate, replace (or move over) the value
+    if(existing != NULL) {
+        existing->getValue() = std::forward<M>(obj);
+        pullUpPath(existing);
+        return std::make_pair(existing, false);
+    }
+    Node<Key, Value, Augment>* temp = makeNode(allocateNode(), NULL, [&]() {
+        return std::pair<const Key, Value>(std::piecewise_construct, std::forward_as_tuple(std::forward<K>(key)),
+                                           std::forward_as_tuple(std::forward<M>(obj)));
+    });
+    attachNode(temp, parent, isLeft);
+    return std::make_pair(temp, true);
 }
 
 /**
-* Returns an iterator to the item with the given key, k
-* or the end iterator if k does not exist in the tree
+* The body of emplace(). The node has to be built before the descent
+* since the key is only known afterwards.
 */
-template<class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator
-BinarySearchTree<Key, Value>::find(const Key & k) const
+template<class Key, class Value, class Augment>
+template<typename... Args>
+std::pair<Node<Key, Value, Augment>*, bool>
+BinarySearchTree<Key, Value, Augment>::internalEmplace(Args&&... args)
 {
-    Node<Key, Value> *curr = internalFind(k);
-    BinarySearchTree<Key, Value>::iterator it(curr);
-    return it;
+    Node<Key, Value, Augment>* temp = makeNode(allocateNode(), NULL, [&]() {
+        return std::pair<const Key, Value>(std::forward<Args>(args)...);
+    });
+    Node<Key, Value, Augment>* parent;
+    bool isLeft;
+    Node<Key, Value, Augment>* existing = internalFindSlot(temp->getKey(), parent, isLeft);
+    if(existing != NULL) {
+        destroyNode(temp);
+        return std::make_pair(existing, false);
+    }
+    attachNode(temp, parent, isLeft);
+    return std::make_pair(temp, true);
 }
 
 /**
- * @precondition The key exists in the map
- * Returns the value associated with the key
- */
-template<class Key, class Value>
-Value& BinarySearchTree<Key, Value>::operator[](const Key& key)
+* Makes this empty tree a copy of other with the same shape, in O(n) and
+* without any comparisons. The nodes are copied as NodeType, so whatever
+* a derived node keeps (such as the AVL balance) and the aggregates come
+* along and nothing needs rebalancing. All of them are allocated as one
+* run, laid out in pre-order. The walk keeps its own stack, so other may
+* be a degenerate tree of any depth.
+*/
+template<class Key, class Value, class Augment>
+template<typename NodeType>
+void BinarySearchTree<Key, Value, Augment>::cloneFrom(const BinarySearchTree<Key, Value, Augment>& other)
 {
-    Node<Key, Value> *curr = internalFind(key);
-    if(curr == NULL) throw std::out_of_range("Invalid key");
-    return curr->getValue();
+    std::size_t count = other.size();
+    if(count == 0) {
+        return;
+    }
+    char* slot = static_cast<char*>(arena_.allocateRun(count));
+    // a node still to copy, the copy it hangs below and on which side
+    struct Pending {
+        Node<Key, Value, Augment>* source;
+        Node<Key, Value, Augment>* parent;
+        bool isLeft;
+    };
+    std::vector<Pending> pending;
+    Pending top = { other.root_, NULL, false };
+    pending.push_back(top);
+    while(!pending.empty()) {
+        Pending next = pending.back();
+        pending.pop_back();
+        Node<Key, Value, Augment>* source = next.source;
+        Node<Key, Value, Augment>* copy = new (slot) NodeType(static_cast<const NodeType&>(*source));
+        slot += arena_.slotSize();
+        copy->setParent(next.parent);
+        copy->setLeft(NULL);
+        copy->setRight(NULL);
+        if(next.parent == NULL) {
+            root_ = copy;
+        }
+        else if(next.isLeft) {
+            next.parent->setLeft(copy);
+        }
+        else {
+            next.parent->setRight(copy);
+        }
+        if(source == other.leftmost_) {
+            leftmost_ = copy;
+        }
+        if(source == other.rightmost_) {
+            rightmost_ = copy;
+        }
+        // the right child waits on the stack behind the whole left subtree,
+        // so fetching it now hides the miss
+        if(source->getRight() != NULL) {
+            BST_PREFETCH(source->getRight());
+            Pending right = { source->getRight(), copy, false };
+            pending.push_back(right);
+        }
+        if(source->getLeft() != NULL) {
+            BST_PREFETCH(source->getLeft());
+            Pending left = { source->getLeft(), copy, true };
+            pending.push_back(left);
+        }
+    }
+    size_ = count;
+    setBuiltHeight(UNKNOWN_HEIGHT);
+#ifdef BST_THREADED_NODES
+    Node<Key, Value, Augment>* before = NULL;
+    for(Node<Key, Value, Augment>* n = leftmost_; n != NULL; n = successor(n)) {
+        threadNeighbours(before, n);
+        before = n;
+    }
+    threadNeighbours(before, NULL);
+#endif
 }
-template<class Key, class Value>
-Value const & BinarySearchTree<Key, Value>::operator[](const Key& key) const
+
+/**
+* Frees this tree's nodes and moves other's nodes and bookkeeping here
+* in O(1), leaving other empty. Both trees must hold the same node type.
+*/
+template<class Key, class Value, class Augment>
+void BinarySearchTree<Key, Value, Augment>::takeFrom(BinarySearchTree<Key, Value, Augment>& other)
 {
-    Node<Key, Value> *curr = internalFind(key);
-    if(curr == NULL) throw std::out_of_range("Invalid key");
-    return curr->getValue();
+    clear();
+    arena_.swap(other.arena_);
+    root_ = other.root_;
+    leftmost_ = other.leftmost_;
+    rightmost_ = other.rightmost_;
+    size_ = other.size_;
+    setBuiltHeight(UNKNOWN_HEIGHT);
+    other.root_ = NULL;
+    other.leftmost_ = NULL;
+    other.rightmost_ = NULL;
+    other.size_ = 0;
 }
 
 /**
-* An insert method to insert into a Binary Search Tree.
-* The tree will not remain balanced when inserting.
-* Recall: If key is already in the tree, you should 
-* overwrite the current value with the updated value.
+* Wraps a node in an iterator, for derived trees that cannot reach the
+* iterator's protected constructor.
 */
-template<class Key, class Value>
-void BinarySearchTree<Key, Value>::insert(const std::pair<const Key, Value> &keyValuePair)
+template<class Key, class Value, class Augment>
+typename BinarySearchTree<Key, Value, Augment>::iterator
+BinarySearchTree<Key, Value, Augment>::makeIterator(Node<Key, Value, Augment>* n) const
 {
-    // TODO
-		Node<Key, Value>* duplicates = internalFind(keyValuePair.first);
-		// if there is a duplicate, replace the value
-		if(duplicates != NULL) {
-			duplicates->setValue(keyValuePair.second);
-		}
-		// if root is NULL, then insert a new node with keyValuePair's variables to root
-		else if(root_ == NULL) {
-			Node<Key, Value>* temp = new Node<Key, Value>(keyValuePair.first, keyValuePair.second, NULL);
-			root_ = temp; 
-		}
-		// otherwise, create a new Node with keyValuePair's variables and insert into the BST
-		else {
-			Node<Key, Value>* temp = new Node<Key, Value>(keyValuePair.first, keyValuePair.second, NULL);
-			Node<Key, Value>* parent = root_;
-			bool isDone = false;
-			while(!isDone) {
-				// if the current key value is less than the root's key value
-				if(temp->getKey() < parent->getKey()) {
-					// if parent node's left child is NULL, then sets it to the new value
-					if(parent->getLeft() == NULL) {
-						 temp->setParent(parent);
-						 parent->setLeft(temp);  
-						 isDone = true; 
-					}
-					// if the parent's left child is not NULL, then continues down the BST
-					else {
-						parent = parent->getLeft();
-					}
-				}
-				// if the current key value is greater than  the root's key value
-				else if(temp->getKey() > parent->getKey()) {
-					// if parent node's right child is NULL, then sets it to the new value
-					if(parent->getRight() == NULL) {
-						 temp->setParent(parent);
-						 parent->setRight(temp);  
-						 isDone = true; 
-					}
-					// if the parent's right child is not NULL, then continues down the BST
-					else {
-						parent = parent->getRight();
-					}
-				}
-			}
-		}
+    return iterator(n, this);
 }
 
 
@@ -545,21 +2929,33 @@ void BinarySearchTree<Key, Value>::insert(const std::pair<const Key, Value> &key
 * Recall: The writeup specifies that if a node has 2 children you
 * should swap with the predecessor and then remove.
 */
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::remove(const Key& key)
+template<typename Key, typename Value, typename Augment>
+void BinarySearchTree<Key, Value, Augment>::remove(const Key& key)
 {
     // TODO
-		Node<Key, Value>* current = internalFind(key);
+		Node<Key, Value, Augment>* current = internalFind(key);
 		
 		// if there are no nodes, do nothing
 		if(current == NULL) {
 			return;
 		}
+		removeNode(current);
+}
+
+/**
+* Unlinks and destroys current, which is in this tree. Derived trees
+* override this to rebalance afterwards.
+*/
+template<typename Key, typename Value, typename Augment>
+void BinarySearchTree<Key, Value, Augment>::removeNode(Node<Key, Value, Augment>* current)
+{
 		// if there are two children
 		if(current->getRight() != NULL && current->getLeft() != NULL) {
-			Node<Key, Value>* pred = predecessor(current);
+			Node<Key, Value, Augment>* pred = predecessor(current);
 			nodeSwap(current, pred);
 		}
+		updateBoundsBeforeRemove(current);
+		Node<Key, Value, Augment>* parent = current->getParent();
 		// if there are no children
 		if(current->getLeft() == NULL && current->getRight() == NULL) {
 			if(current == root_) {
@@ -571,7 +2967,7 @@ void BinarySearchTree<Key, Value>::remove(const Key& key)
 			else {
 				current->getParent()->setRight(NULL);
 			}
-			delete current;
+			finishRemove(current, parent);
 			current = nullptr;
 			return;
 		}
@@ -587,7 +2983,7 @@ void BinarySearchTree<Key, Value>::remove(const Key& key)
 			else {
 				current->getParent()->setLeft(current->getLeft());
 			}
-			delete current;
+			finishRemove(current, parent);
 			current = nullptr;
 			return;
 		}
@@ -602,7 +2998,7 @@ void BinarySearchTree<Key, Value>::remove(const Key& key)
 			else {
 				current->getParent()->setLeft(current->getRight());
 			}
-			delete current;
+			finishRemove(current, parent);
 			current = nullptr;
 			return;
 		}
@@ -610,9 +3006,9 @@ void BinarySearchTree<Key, Value>::remove(const Key& key)
 
 
 
-template<class Key, class Value>
-Node<Key, Value>*
-BinarySearchTree<Key, Value>::predecessor(Node<Key, Value>* current)
+template<class Key, class Value, class Augment>
+Node<Key, Value, Augment>*
+BinarySearchTree<Key, Value, Augment>::predecessor(Node<Key, Value, Augment>* current)
 {
     // TODO
 		if(current->getLeft() != NULL) {
@@ -629,66 +3025,265 @@ BinarySearchTree<Key, Value>::predecessor(Node<Key, Value>* current)
 			}
 		}
 		else {
-			Node<Key, Value>* parent = current->getParent();
-			while(parent != NULL) {
-				// checks if the parent is a right child
-				if(parent->getParent()->getRight() == parent) {
-					return parent->getParent();
-				}
-				else {
-					parent = parent->getParent();
-				}
+			// climb until we come up out of a right subtree
+			Node<Key, Value, Augment>* parent = current->getParent();
+			while(parent != NULL && current == parent->getLeft()) {
+				current = parent;
+				parent = parent->getParent();
 			}
-			// while(parent != NULL) {
-			// 	// if the parent node is the first instance of being a right child
-			// 	Node<Key, Value>* parent_parent = parent->getParent();
-			// 	if(parent_parent->getRight() == parent) {
-			// 		return parent_parent;
-			// 	}
-			// 	else {
-			// 		parent = parent_parent;
-			// 	}
-			// }
+			return parent;
 		}
 		// there is no predecessor
 		return NULL;
 }
 
+/**
+* Returns the next node in key order, or NULL for the largest node.
+* Only follows real links, so it works while threads are out of date.
+*/
+template<class Key, class Value, class Augment>
+Node<Key, Value, Augment>*
+BinarySearchTree<Key, Value, Augment>::successor(Node<Key, Value, Augment>* current)
+{
+    if(current->getRight() != NULL) {
+        current = current->getRight();
+        while(current->getLeft() != NULL) {
+            current = current->getLeft();
+        }
+        return current;
+    }
+    // climb until we come up out of a left subtree
+    Node<Key, Value, Augment>* parent = current->getParent();
+    while(parent != NULL && current == parent->getRight()) {
+        current = parent;
+        parent = parent->getParent();
+    }
+    return parent;
+}
+
+/**
+* Links two nodes that are adjacent in key order through whichever of
+* their facing slots are empty. Either node may be NULL at the ends.
+*/
+template<class Key, class Value, class Augment>
+void BinarySearchTree<Key, Value, Augment>::threadNeighbours(Node<Key, Value, Augment>* before,
+                                                             Node<Key, Value, Augment>* after)
+{
+#ifdef BST_THREADED_NODES
+    if(before != NULL && before->getRight() == NULL) {
+        before->setRightThread(after);
+    }
+    if(after != NULL && after->getLeft() == NULL) {
+        after->setLeftThread(before);
+    }
+#endif
+}
+
+/**
+* Rebuilds the threads between n and both of its neighbours in key order,
+* after n has been moved or relinked. O(log n) in a balanced tree.
+*/
+template<class Key, class Value, class Augment>
+void BinarySearchTree<Key, Value, Augment>::rethread(Node<Key, Value, Augment>* n)
+{
+#ifdef BST_THREADED_NODES
+    threadNeighbours(predecessor(n), n);
+    threadNeighbours(n, successor(n));
+#endif
+}
+
+/**
+* Threads count freshly linked nodes, given in key order, to each other.
+*/
+template<class Key, class Value, class Augment>
+void BinarySearchTree<Key, Value, Augment>::threadSequence(Node<Key, Value, Augment>* const* nodes, std::size_t count)
+{
+#ifdef BST_THREADED_NODES
+    Node<Key, Value, Augment>* before = NULL;
+    for(std::size_t i = 0; i < count; ++i) {
+        threadNeighbours(before, nodes[i]);
+        before = nodes[i];
+    }
+    threadNeighbours(before, NULL);
+#endif
+}
+
 
 /**
 * A method to remove all contents of the tree and
 * reset the values in the tree for use again.
+* The node memory is returned by releasing the arena's blocks, so
+* the nodes only have to be visited when their items or aggregates
+* need destructors.
 */
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::clear()
+template<typename Key, typename Value, typename Augment>
+void BinarySearchTree<Key, Value, Augment>::clear()
 {
     // TODO
-		clear_helper(root_);
+		if(!std::is_trivially_destructible<Key>::value || !std::is_trivially_destructible<Value>::value ||
+		   !AugmentSlot<Augment>::trivially_destructible) {
+			destroyAll(root_);
+		}
+		arena_.release();
 		root_ = NULL;
+		leftmost_ = NULL;
+		rightmost_ = NULL;
+		size_ = 0;
 }
 
 
-// helper function for clear that uses recursion
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::clear_helper(Node<Key, Value> *curr) {
+// helper function for clear that runs the destructors of every node below
+// curr, without recursion or heap memory. Destruction order does not
+// matter, so several independent walks ("lanes") take turns, each one
+// prefetching its next node while the others work; this overlaps the cache
+// misses of a large tree instead of taking them one at a time. A node is
+// destroyed on the way down once its children are known. The right child
+// of a node with two children starts a new lane, or waits in a small fixed
+// stack; when both are full the node is rotated right instead, leaving it
+// one child, so a tree of any shape and depth is fine. The memory itself
+// is freed all at once by clear()
+template<typename Key, typename Value, typename Augment>
+void BinarySearchTree<Key, Value, Augment>::destroyAll(Node<Key, Value, Augment> *curr) {
+	static const std::size_t LANES = 8;
+	static const std::size_t STACK_SLOTS = 64;
+	Node<Key, Value, Augment>* lanes[LANES];
+	Node<Key, Value, Augment>* pending[STACK_SLOTS];
+	std::size_t active = 0;
+	std::size_t depth = 0;
 	if(curr != NULL) {
-		clear_helper(curr->getLeft());
-		clear_helper(curr->getRight());
-		delete curr;
+		lanes[active++] = curr;
+	}
+	while(active > 0) {
+		std::size_t i = 0;
+		while(i < active) {
+			Node<Key, Value, Augment>* n = lanes[i];
+			Node<Key, Value, Augment>* left = n->getLeft();
+			Node<Key, Value, Augment>* right = n->getRight();
+			if(left != NULL && right != NULL) {
+				if(active < LANES) {
+					BST_PREFETCH(right);
+					lanes[active++] = right;
+				}
+				else if(depth < STACK_SLOTS) {
+					pending[depth++] = right;
+				}
+				else {
+					n->setLeft(left->getRight());
+					left->setRight(n);
+					lanes[i++] = left;
+					continue;
+				}
+				right = NULL;
+			}
+			nodeDestructor_(n);
+			Node<Key, Value, Augment>* next = (left != NULL) ? left : right;
+			if(next == NULL && depth > 0) {
+				next = pending[--depth];
+			}
+			if(next == NULL) {
+				// this lane is done; the last lane moves into its place
+				lanes[i] = lanes[--active];
+				continue;
+			}
+			BST_PREFETCH(next);
+			lanes[i++] = next;
+		}
 	}
 }
 
+/**
+* Constructs a plain Node in slot, taking the item from source. Derived
+* trees construct their own node type instead.
+*/
+template<typename Key, typename Value, typename Augment>
+Node<Key, Value, Augment>* BinarySearchTree<Key, Value, Augment>::createNode(void* slot, Node<Key, Value, Augment>* parent,
+                                                          ItemSource<Key, Value>& source)
+{
+    return new (slot) Node<Key, Value, Augment>(parent, source);
+}
+
+/**
+* Called once a new node n is linked in. An unbalanced tree has nothing
+* to restore.
+*/
+template<typename Key, typename Value, typename Augment>
+void BinarySearchTree<Key, Value, Augment>::afterAttach(Node<Key, Value, Augment>*)
+{
+
+}
+
+/**
+* Called with the height difference of each node the linear-time
+* builders place, for trees that store it.
+*/
+template<typename Key, typename Value, typename Augment>
+void BinarySearchTree<Key, Value, Augment>::setBuiltBalance(Node<Key, Value, Augment>*, int)
+{
+
+}
+
+/**
+* Called with the height of the whole tree after a bulk build or a move,
+* for trees that keep it.
+*/
+template<typename Key, typename Value, typename Augment>
+void BinarySearchTree<Key, Value, Augment>::setBuiltHeight(int)
+{
+
+}
+
+// helper function that creates a node in slot through createNode(), with
+// the item that fn returns
+template<typename Key, typename Value, typename Augment>
+template<typename Fn>
+Node<Key, Value, Augment>* BinarySearchTree<Key, Value, Augment>::makeNode(void* slot, Node<Key, Value, Augment>* parent, Fn fn)
+{
+    ItemSourceFn<Key, Value, Fn> source(fn);
+    return createNode(slot, parent, source);
+}
+
+/**
+* Returns uninitialized memory for one node from the tree's arena.
+* Callers construct the node in place with placement new.
+*/
+template<typename Key, typename Value, typename Augment>
+void* BinarySearchTree<Key, Value, Augment>::allocateNode()
+{
+    return arena_.allocate();
+}
+
+/**
+* Destroys a single node and recycles its slot in the arena.
+*/
+template<typename Key, typename Value, typename Augment>
+void BinarySearchTree<Key, Value, Augment>::destroyNode(Node<Key, Value, Augment>* n)
+{
+    nodeDestructor_(n);
+    arena_.deallocate(n);
+}
+
+/**
+* Runs the destructor of the node as the given node type. The tree keeps
+* a pointer to the right instantiation instead of each node carrying a vptr.
+*/
+template<typename Key, typename Value, typename Augment>
+template<typename NodeType>
+void BinarySearchTree<Key, Value, Augment>::destructNode(Node<Key, Value, Augment>* n)
+{
+    static_cast<NodeType*>(n)->~NodeType();
+}
+
 
 
 /**
 * A helper function to find the smallest node in the tree.
 */
-template<typename Key, typename Value>
-Node<Key, Value>*
-BinarySearchTree<Key, Value>::getSmallestNode() const
+template<typename Key, typename Value, typename Augment>
+Node<Key, Value, Augment>*
+BinarySearchTree<Key, Value, Augment>::getSmallestNode() const
 {
     // TODO
-		Node<Key, Value>* current = root_;
+		Node<Key, Value, Augment>* current = root_;
 		while(current->getLeft()) {
 			current = current->getLeft();
 		}
@@ -700,11 +3295,11 @@ BinarySearchTree<Key, Value>::getSmallestNode() const
 * return a pointer to it or NULL if no item with that key
 * exists
 */
-template<typename Key, typename Value>
-Node<Key, Value>* BinarySearchTree<Key, Value>::internalFind(const Key& key) const
+template<typename Key, typename Value, typename Augment>
+Node<Key, Value, Augment>* BinarySearchTree<Key, Value, Augment>::internalFind(const Key& key) const
 {
     // TODO
-		Node<Key, Value>* current = root_;
+		Node<Key, Value, Augment>* current = root_;
 
 		while(current != NULL) {
 			if(current->getKey() == key) {
@@ -726,68 +3321,103 @@ Node<Key, Value>* BinarySearchTree<Key, Value>::internalFind(const Key& key) con
 
 
 /**
- * Return true iff the BST is balanced.
+ * Return true iff the BST is balanced, meaning the heights of the two
+ * subtrees of every node differ by at most one. One O(n) pass.
  */
-template<typename Key, typename Value>
-bool BinarySearchTree<Key, Value>::isBalanced() const
+template<typename Key, typename Value, typename Augment>
+bool BinarySearchTree<Key, Value, Augment>::isBalanced() const
 {
-	if(root_ == NULL) {
-		return true;
-	}
-	if((root_->getLeft() == NULL && root_->getRight() == NULL) || (root_->getLeft() == NULL && balanced_helper(root_->getRight(), 0) == 0) || (root_->getLeft() == NULL && balanced_helper(root_->getLeft(), 0) == 0)) {
-    return true;
-  }
-	if(balanced_helper2(root_) && balanced_helper2(root_->getLeft()) && balanced_helper2(root_->getRight())) {
-		return true;
-	}
-	return false;
-}
-
-template<typename Key, typename Value>
-bool BinarySearchTree<Key, Value>::balanced_helper2(Node<Key, Value> *curr) const {
-		int left = balanced_helper(curr->getLeft(), 0);
-		int right = balanced_helper(curr->getRight(), 0);
-		if(left - right == 1 || left - right == 0 || right - left == 1 || right - left == 0) {
-			return true;
-		}
-		return false;
+	return stats().imbalancedNodes == 0;
 }
 
-template<typename Key, typename Value>
-int BinarySearchTree<Key, Value>::balanced_helper(Node<Key, Value> *curr, int val) const {
-		if(curr == NULL) {
-        return val-1;
+/**
+ * Measures the shape of the tree in a single post-order pass. The pass
+ * keeps its own stack rather than recursing, so a degenerate tree of any
+ * depth is fine.
+ */
+template<typename Key, typename Value, typename Augment>
+TreeStats BinarySearchTree<Key, Value, Augment>::stats() const
+{
+    TreeStats result;
+    result.nodes = 0;
+    result.height = 0;
+    result.imbalancedNodes = 0;
+    result.averageSearchDepth = 0.0;
+
+    // A node is first seen unfinished: it is counted, then pushed back as
+    // finished underneath its children, so it comes off again after both.
+    struct Frame
+    {
+        Node<Key, Value, Augment>* node;
+        int depth;
+        bool finished;
+    };
+    std::vector<Frame> pending;
+    // heights of finished subtrees whose parent has not finished yet
+    std::vector<int> heights;
+    std::size_t depthTotal = 0;
+    Frame top = { root_, 0, false };
+    pending.push_back(top);
+    while(!pending.empty()) {
+        Frame current = pending.back();
+        pending.pop_back();
+        if(current.node == NULL) {
+            heights.push_back(0);
+        }
+        else if(!current.finished) {
+            ++result.nodes;
+            depthTotal += current.depth;
+            if(result.depthHistogram.size() <= static_cast<std::size_t>(current.depth)) {
+                result.depthHistogram.resize(current.depth + 1, 0);
+            }
+            ++result.depthHistogram[current.depth];
+            Frame self = { current.node, current.depth, true };
+            Frame right = { current.node->getRight(), current.depth + 1, false };
+            Frame left = { current.node->getLeft(), current.depth + 1, false };
+            pending.push_back(self);
+            pending.push_back(right);
+            pending.push_back(left);
+        }
+        else {
+            // the left subtree finished first, so its height is underneath
+            int rightHeight = heights.back();
+            heights.pop_back();
+            int leftHeight = heights.back();
+            heights.pop_back();
+            if(leftHeight - rightHeight > 1 || rightHeight - leftHeight > 1) {
+                ++result.imbalancedNodes;
+            }
+            heights.push_back(1 + std::max(leftHeight, rightHeight));
+        }
     }
-    // recursive call to balanced_helper
-    int left = balanced_helper(curr->getLeft(), val+1);
-    int right = balanced_helper(curr->getRight(), val+1);
-    if(left >= right) {
-        return left;
+    result.height = heights.back();
+    if(result.nodes > 0) {
+        result.averageSearchDepth = static_cast<double>(depthTotal + result.nodes) / result.nodes;
     }
-    return right;
+    return result;
 }
 
 
 
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::nodeSwap( Node<Key,Value>* n1, Node<Key,Value>* n2)
+template<typename Key, typename Value, typename Augment>
+void BinarySearchTree<Key, Value, Augment>::nodeSwap( Node<Key, Value, Augment>* n1, Node<Key, Value, Augment>* n2)
 {
     if((n1 == n2) || (n1 == NULL) || (n2 == NULL) ) {
         return;
     }
-    Node<Key, Value>* n1p = n1->getParent();
-    Node<Key, Value>* n1r = n1->getRight();
-    Node<Key, Value>* n1lt = n1->getLeft();
+    Node<Key, Value, Augment>* n1p = n1->getParent();
+    Node<Key, Value, Augment>* n1r = n1->getRight();
+    Node<Key, Value, Augment>* n1lt = n1->getLeft();
     bool n1isLeft = false;
     if(n1p != NULL && (n1 == n1p->getLeft())) n1isLeft = true;
-    Node<Key, Value>* n2p = n2->getParent();
-    Node<Key, Value>* n2r = n2->getRight();
-    Node<Key, Value>* n2lt = n2->getLeft();
+    Node<Key, Value, Augment>* n2p = n2->getParent();
+    Node<Key, Value, Augment>* n2r = n2->getRight();
+    Node<Key, Value, Augment>* n2lt = n2->getLeft();
     bool n2isLeft = false;
     if(n2p != NULL && (n2 == n2p->getLeft())) n2isLeft = true;
 
 
-    Node<Key, Value>* temp;
+    Node<Key, Value, Augment>* temp;
     temp = n1->getParent();
     n1->setParent(n2->getParent());
     n2->setParent(temp);
@@ -850,7 +3480,11 @@ void BinarySearchTree<Key, Value>::nodeSwap( Node<Key,Value>* n1, Node<Key,Value
     else if(this->root_ == n2) {
         this->root_ = n1;
     }
-
+    AugmentUpdater<Key, Value, Augment>::swapAggregates(n1, n2);
+    // the swap copied only real children; every thread into or out of
+    // the two nodes comes from one of their new neighbours
+    rethread(n1);
+    rethread(n2);
 }
 
 /**
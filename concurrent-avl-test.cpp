@@ -0,0 +1,260 @@
+#include <iostream>
+#include <map>
+#include <random>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <cstdlib>
+#include "concurrent_avl.h"
+#include "test_check.h"
+
+using namespace std;
+
+typedef map<int, int> Model;
+
+// Opens up the tree's links for the structural checks
+class CheckedTree : public ConcurrentAVLTree<int, int>
+{
+public:
+    explicit CheckedTree(size_t maxPending = EpochManager::DEFAULT_MAX_PENDING) :
+        ConcurrentAVLTree<int, int>(maxPending)
+    {
+
+    }
+
+    // Checks order, heights, balance, that every absent node routes
+    // between two children, and the contents against model. Writers must
+    // be idle.
+    void checkAgainst(const Model& model)
+    {
+        Model present;
+        checkSubtree(root_.load(), NULL, NULL, present);
+        CHECK(present == model);
+        CHECK(size() == model.size());
+    }
+
+    // Runs fn with the tree's epoch pinned, as a lookup would
+    template<typename Fn>
+    void whilePinned(Fn fn) const
+    {
+        EpochManager::Guard guard(epochs_);
+        fn();
+    }
+
+    // Frees what the readers allow; writers must be idle
+    void collect()
+    {
+        epochs_.collect();
+    }
+
+private:
+    int checkSubtree(NodeType* n, const int* lo, const int* hi, Model& present)
+    {
+        if(n == NULL) {
+            return 0;
+        }
+        CHECK(lo == NULL || *lo < n->getKey());
+        CHECK(hi == NULL || n->getKey() < *hi);
+        int left = checkSubtree(n->getLeft(), lo, &n->getKey(), present);
+        if(n->isPresent()) {
+            present.insert(n->getItem());
+        }
+        else {
+            CHECK(n->getLeft() != NULL && n->getRight() != NULL);
+        }
+        int right = checkSubtree(n->getRight(), &n->getKey(), hi, present);
+        CHECK(abs(right - left) <= 1);
+        CHECK(n->getHeight() == 1 + max(left, right));
+        return n->getHeight();
+    }
+};
+
+// Random inserts and removals over a small key space, so removals often
+// leave routing nodes that later rotations move around, checked after
+// every change
+void testRandomOps()
+{
+    mt19937 rng(21);
+    for(int round = 0; round < 10; ++round) {
+        CheckedTree tree;
+        Model model;
+        int keys = 50 + 150 * round;
+        for(int op = 0; op < 4000; ++op) {
+            int key = static_cast<int>(rng() % keys);
+            if(rng() % 2 == 0) {
+                int value = static_cast<int>(rng());
+                tree.insert(make_pair(key, value));
+                model[key] = value;
+            }
+            else {
+                tree.remove(key);
+                model.erase(key);
+            }
+            tree.checkAgainst(model);
+            int value;
+            Model::iterator it = model.find(key);
+            CHECK(tree.find(key, value) == (it != model.end()));
+            CHECK(it == model.end() || value == it->second);
+        }
+        tree.clear();
+        model.clear();
+        tree.checkAgainst(model);
+    }
+}
+
+// Sorted runs drive long chains of rotations; removing every other key
+// first fills the tree with routing nodes for them to move down
+void testSortedRuns()
+{
+    CheckedTree tree;
+    Model model;
+    for(int i = 0; i < 20000; ++i) {
+        tree.insert(make_pair(i, i));
+        model[i] = i;
+    }
+    for(int i = 0; i < 20000; i += 2) {
+        tree.remove(i);
+        model.erase(i);
+    }
+    tree.checkAgainst(model);
+    for(int i = 20000; i < 40000; ++i) {
+        tree.insert(make_pair(i, i));
+        model[i] = i;
+    }
+    tree.checkAgainst(model);
+    for(int i = 39999; i >= 0; i -= 3) {
+        tree.remove(i);
+        model.erase(i);
+    }
+    tree.checkAgainst(model);
+}
+
+// Readers look up keys that are never removed while a writer churns the
+// rest, with a small retire bound so the writer keeps waiting on them;
+// every lookup of a stable key must succeed with its one value
+void testConcurrent()
+{
+    static const int READERS = 3;
+    static const int KEYS = 20000;
+    CheckedTree tree(256);
+    Model model;
+    for(int i = 0; i < KEYS; i += 2) {
+        tree.insert(make_pair(i, -i));
+        model[i] = -i;
+    }
+    atomic<bool> done(false);
+    atomic<int> failures(0);
+    vector<thread> readers;
+    for(int r = 0; r < READERS; ++r) {
+        readers.push_back(thread([&tree, &done, &failures, r]() {
+            mt19937 rng(100 + r);
+            while(!done.load()) {
+                int key = static_cast<int>(rng() % (KEYS / 2)) * 2;
+                int value;
+                if(!tree.find(key, value) || value != -key) {
+                    failures.fetch_add(1);
+                }
+            }
+        }));
+    }
+    mt19937 rng(7);
+    for(int op = 0; op < 200000; ++op) {
+        int key = static_cast<int>(rng() % (KEYS / 2)) * 2 + 1;
+        if(rng() % 2 == 0) {
+            tree.insert(make_pair(key, key));
+            model[key] = key;
+        }
+        else {
+            tree.remove(key);
+            model.erase(key);
+        }
+    }
+    done.store(true);
+    for(size_t i = 0; i < readers.size(); ++i) {
+        readers[i].join();
+    }
+    CHECK(failures.load() == 0);
+    tree.checkAgainst(model);
+}
+
+// clear() retires the whole tree as one batch that counts every node and
+// is kept while a reader is pinned, then freed in full once it is not
+void testClearReclaims()
+{
+    static const size_t NODES = 5000;
+    CheckedTree tree;
+    for(size_t i = 0; i < NODES; ++i) {
+        tree.insert(make_pair(static_cast<int>(i), 0));
+    }
+    CHECK(tree.reclamationStats().retired == 0);
+    tree.whilePinned([&tree]() {
+        tree.clear();
+        EpochStats stats = tree.reclamationStats();
+        CHECK(stats.retired == NODES);
+        CHECK(stats.pending == NODES);
+        CHECK(stats.reclaimed == 0);
+        CHECK(tree.empty() && !tree.contains(0));
+    });
+    for(int i = 0; i < 3; ++i) {
+        tree.collect();
+    }
+    EpochStats stats = tree.reclamationStats();
+    CHECK(stats.pending == 0 && stats.pendingBytes == 0);
+    CHECK(stats.reclaimed == NODES);
+    tree.checkAgainst(Model());
+}
+
+// A writer that would take the retired nodes past maxPending waits for a
+// pinned reader, and carries on once the reader lets go; clear() does so
+// with the whole tree retired
+void testRetireBlocks()
+{
+    CheckedTree tree(256);
+    for(int i = 0; i < 1000; ++i) {
+        tree.insert(make_pair(i, i));
+    }
+    atomic<bool> pinned(false);
+    atomic<bool> release(false);
+    atomic<bool> cleared(false);
+    thread reader([&]() {
+        tree.whilePinned([&]() {
+            pinned.store(true);
+            while(!release.load()) {
+                this_thread::yield();
+            }
+        });
+    });
+    while(!pinned.load()) {
+        this_thread::yield();
+    }
+    thread writer([&]() {
+        tree.clear();
+        cleared.store(true);
+    });
+    while(tree.reclamationStats().writerWaits == 0) {
+        this_thread::yield();
+    }
+    CHECK(!cleared.load());
+    // the whole tree went in as one batch, not node by node up to the bound
+    CHECK(tree.reclamationStats().pending == 1000);
+    release.store(true);
+    reader.join();
+    writer.join();
+    CHECK(cleared.load());
+    CHECK(tree.reclamationStats().pending < 256);
+    tree.insert(make_pair(1, 1));
+    Model model;
+    model[1] = 1;
+    tree.checkAgainst(model);
+}
+
+int main()
+{
+    testRandomOps();
+    testSortedRuns();
+    testConcurrent();
+    testClearReclaims();
+    testRetireBlocks();
+    cout << "concurrent-avl-test: all passed" << endl;
+    return 0;
+}
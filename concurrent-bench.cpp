@@ -0,0 +1,170 @@
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <algorithm>
+#include <random>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include "bst.h"
+#include "avlbst.h"
+#include "concurrent_avl.h"
+#include "sharded_avl.h"
+
+using namespace std;
+
+// Number of keys the map starts with; the workload touches twice as many
+static const size_t NUM_KEYS = 1000000;
+// Operations each thread runs per measurement
+static const size_t OPS_PER_THREAD = 500000;
+// Shares of operations that are lookups, in percent, one table each
+static const unsigned READ_PERCENTS[] = { 90, 10 };
+
+// Returns the seconds elapsed since start
+static double secondsSince(chrono::steady_clock::time_point start)
+{
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+// The way a plain AVLTree is shared today: one mutex around every call
+class LockedAVLTree
+{
+public:
+    bool find(uint64_t key, uint64_t& value)
+    {
+        lock_guard<mutex> guard(mutex_);
+        AVLTree<uint64_t, uint64_t>::iterator it = tree_.find(key);
+        if(it == tree_.end()) {
+            return false;
+        }
+        value = it->second;
+        return true;
+    }
+    void insert(const pair<const uint64_t, uint64_t>& item)
+    {
+        lock_guard<mutex> guard(mutex_);
+        tree_.insert(item);
+    }
+    void remove(uint64_t key)
+    {
+        lock_guard<mutex> guard(mutex_);
+        tree_.remove(key);
+    }
+
+private:
+    AVLTree<uint64_t, uint64_t> tree_;
+    mutex mutex_;
+};
+
+// Runs OPS_PER_THREAD mixed operations, readPercent of them lookups, on
+// each of threads threads and returns the total throughput in millions of
+// operations per second
+template<typename Map>
+double runMix(Map& map, unsigned threads, unsigned readPercent)
+{
+    atomic<bool> go(false);
+    atomic<uint64_t> checksum(0);
+    vector<thread> workers;
+    for(unsigned t = 0; t < threads; ++t) {
+        workers.push_back(thread([&map, &go, &checksum, t, readPercent]() {
+            mt19937_64 rng(1000 + t);
+            uint64_t sum = 0;
+            while(!go.load()) {
+                this_thread::yield();
+            }
+            for(size_t i = 0; i < OPS_PER_THREAD; ++i) {
+                uint64_t r = rng();
+                uint64_t key = (r >> 8) % (2 * NUM_KEYS);
+                unsigned op = r % 100;
+                uint64_t value;
+                if(op < readPercent) {
+                    if(map.find(key, value)) {
+                        sum += value;
+                    }
+                }
+                else if(op % 2 == 0) {
+                    map.insert(make_pair(key, key));
+                }
+                else {
+                    map.remove(key);
+                }
+            }
+            checksum += sum;
+        }));
+    }
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    go.store(true);
+    for(unsigned t = 0; t < threads; ++t) {
+        workers[t].join();
+    }
+    double seconds = secondsSince(start);
+    if(checksum.load() == 0) cout << "unexpected checksum" << endl;
+    return (threads * OPS_PER_THREAD / seconds) / 1e6;
+}
+
+// Fills a map with every other key in [0, 2 * NUM_KEYS), in random order
+template<typename Map>
+void fill(Map& map)
+{
+    vector<uint64_t> keys(NUM_KEYS);
+    for(size_t i = 0; i < NUM_KEYS; ++i) {
+        keys[i] = 2 * i;
+    }
+    mt19937_64 rng(104);
+    shuffle(keys.begin(), keys.end(), rng);
+    for(size_t i = 0; i < NUM_KEYS; ++i) {
+        map.insert(make_pair(keys[i], keys[i] + 1));
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned cores = thread::hardware_concurrency();
+    unsigned maxThreads = max(cores, 4u);
+    LockedAVLTree locked;
+    ConcurrentAVLTree<uint64_t, uint64_t> concurrent;
+    ShardedAVLMap<uint64_t, uint64_t> sharded;
+    fill(locked);
+    fill(concurrent);
+    fill(sharded);
+    for(size_t mix = 0; mix < sizeof(READ_PERCENTS) / sizeof(READ_PERCENTS[0]); ++mix) {
+        cout << READ_PERCENTS[mix] << "% lookups on " << NUM_KEYS << " keys, "
+             << cores << " hardware threads" << endl;
+        cout << left << setw(10) << "threads" << right << setw(20) << "mutex AVLTree"
+             << setw(20) << "ConcurrentAVLTree" << setw(20) << "ShardedAVLMap" << "  (Mops/s)" << endl;
+        for(unsigned threads = 1; threads <= maxThreads; threads *= 2) {
+            double lockedRate = runMix(locked, threads, READ_PERCENTS[mix]);
+            double concurrentRate = runMix(concurrent, threads, READ_PERCENTS[mix]);
+            double shardedRate = runMix(sharded, threads, READ_PERCENTS[mix]);
+            cout << left << setw(10) << threads << right << fixed << setprecision(2)
+                 << setw(20) << lockedRate << setw(20) << concurrentRate << setw(20) << shardedRate
+                 << (threads > cores ? "  oversubscribed" : "") << endl;
+        }
+        cout << endl;
+    }
+
+    vector<size_t> shardSizes = sharded.shardSizes();
+    cout << "ShardedAVLMap shards after " << sharded.rebalances() << " moves:";
+    for(size_t i = 0; i < shardSizes.size(); ++i) {
+        cout << " " << shardSizes[i];
+    }
+    cout << endl;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    uint64_t previous = 0;
+    size_t visited = 0;
+    for(ShardedAVLMap<uint64_t, uint64_t>::iterator it = sharded.begin(); it != sharded.end(); ++it) {
+        if(visited++ > 0 && it->first <= previous) cout << "merged iteration out of order" << endl;
+        previous = it->first;
+    }
+    cout << "ShardedAVLMap ordered scan: " << visited << " items in "
+         << fixed << setprecision(1) << secondsSince(start) * 1e3 << " ms" << endl;
+
+    EpochStats stats = concurrent.reclamationStats();
+    cout << "ConcurrentAVLTree reclamation: " << stats.retired << " nodes retired, "
+         << stats.reclaimed << " freed, " << stats.pending << " pending ("
+         << stats.pendingBytes << " bytes), " << stats.writerWaits << " writer waits, epoch "
+         << stats.epoch << endl;
+    return 0;
+}
@@ -0,0 +1,849 @@
+#ifndef CONCURRENT_AVL_H
+#define CONCURRENT_AVL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <algorithm>
+#include <new>
+#include "node_arena.h"
+#include "epoch.h"
+
+/**
+* A version word for optimistic lock coupling. Readers take no lock: they
+* note the version, read what they need, and then check that the version
+* has not moved. A writer makes the version odd while it changes the
+* protected data and even again afterwards, so a reader that overlapped a
+* change sees a different version and retries.
+*
+* Only one writer may hold any lock at a time (the tree serializes its
+* writers), so lock() needs no atomic read-modify-write.
+*/
+class OptimisticLock
+{
+public:
+    OptimisticLock();
+
+    // Waits out a writer and returns the version to validate against
+    uint64_t readVersion() const;
+    bool validate(uint64_t version) const;
+    void lock();
+    void unlock();
+
+private:
+    std::atomic<uint64_t> version_;
+};
+
+inline OptimisticLock::OptimisticLock() :
+    version_(0)
+{
+
+}
+
+inline uint64_t OptimisticLock::readVersion() const
+{
+    uint64_t version = version_.load(std::memory_order_acquire);
+    while(version & 1) {
+        // a writer holds this lock for a few stores; let it run
+        std::this_thread::yield();
+        version = version_.load(std::memory_order_acquire);
+    }
+    return version;
+}
+
+/**
+* True if no writer has locked this since readVersion() returned version.
+* The fence keeps the reads being validated from moving after the check.
+*/
+inline bool OptimisticLock::validate(uint64_t version) const
+{
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return version_.load(std::memory_order_relaxed) == version;
+}
+
+inline void OptimisticLock::lock()
+{
+    version_.store(version_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+}
+
+inline void OptimisticLock::unlock()
+{
+    version_.store(version_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+
+/**
+* A node of a ConcurrentAVLTree. It has the item, children and height of
+* an AVL node plus the OptimisticLock that readers validate against. The
+* item never changes after construction: a new value for the key gets a
+* new node, so readers can copy a value without racing a writer. There is
+* no parent pointer; writers record their path on the way down instead.
+*/
+template <typename Key, typename Value>
+class ConcurrentAVLNode
+{
+public:
+    ConcurrentAVLNode(const std::pair<const Key, Value>& item, ConcurrentAVLNode<Key, Value>* left,
+                      ConcurrentAVLNode<Key, Value>* right, int height);
+
+    const std::pair<const Key, Value>& getItem() const;
+    const Key& getKey() const;
+    const Value& getValue() const;
+    // Children are read concurrently, so they are atomic; a reader must
+    // validate the node's lock after reading one
+    ConcurrentAVLNode<Key, Value>* getLeft() const;
+    ConcurrentAVLNode<Key, Value>* getRight() const;
+    ConcurrentAVLNode<Key, Value>* getChild(bool right) const;
+    void setLeft(ConcurrentAVLNode<Key, Value>* left);
+    void setRight(ConcurrentAVLNode<Key, Value>* right);
+    // Only the writer reads or writes the height
+    int getHeight() const;
+    void setHeight(int height);
+    // A removed node that still has two children stays as a routing node,
+    // marked absent, until a later removal leaves it with at most one
+    bool isPresent() const;
+    void markAbsent();
+    OptimisticLock& getLock() const;
+
+private:
+    // what a lookup step reads comes first, to share its cache line
+    mutable OptimisticLock lock_;
+    // the left child, then the right
+    std::atomic<ConcurrentAVLNode<Key, Value>*> children_[2];
+    std::pair<const Key, Value> item_;
+    int height_;
+    std::atomic<bool> present_;
+};
+
+/*
+  -------------------------------------------------
+  Begin implementations for the ConcurrentAVLNode class.
+  -------------------------------------------------
+*/
+
+template<typename Key, typename Value>
+ConcurrentAVLNode<Key, Value>::ConcurrentAVLNode(const std::pair<const Key, Value>& item, ConcurrentAVLNode<Key, Value>* left,
+                                                 ConcurrentAVLNode<Key, Value>* right, int height) :
+    item_(item),
+    height_(height),
+    present_(true)
+{
+    children_[0].store(left, std::memory_order_relaxed);
+    children_[1].store(right, std::memory_order_relaxed);
+}
+
+template<typename Key, typename Value>
+const std::pair<const Key, Value>& ConcurrentAVLNode<Key, Value>::getItem() const
+{
+    return item_;
+}
+
+template<typename Key, typename Value>
+const Key& ConcurrentAVLNode<Key, Value>::getKey() const
+{
+    return item_.first;
+}
+
+template<typename Key, typename Value>
+const Value& ConcurrentAVLNode<Key, Value>::getValue() const
+{
+    return item_.second;
+}
+
+template<typename Key, typename Value>
+ConcurrentAVLNode<Key, Value>* ConcurrentAVLNode<Key, Value>::getLeft() const
+{
+    return children_[0].load(std::memory_order_acquire);
+}
+
+template<typename Key, typename Value>
+ConcurrentAVLNode<Key, Value>* ConcurrentAVLNode<Key, Value>::getRight() const
+{
+    return children_[1].load(std::memory_order_acquire);
+}
+
+/**
+* Returns the right child if right is true, else the left. Indexing by
+* the comparison result keeps a lookup step free of branches.
+*/
+template<typename Key, typename Value>
+ConcurrentAVLNode<Key, Value>* ConcurrentAVLNode<Key, Value>::getChild(bool right) const
+{
+    return children_[right].load(std::memory_order_acquire);
+}
+
+/**
+* Links in a new left child. The release store publishes the child's
+* fields to any reader that loads the pointer.
+*/
+template<typename Key, typename Value>
+void ConcurrentAVLNode<Key, Value>::setLeft(ConcurrentAVLNode<Key, Value>* left)
+{
+    children_[0].store(left, std::memory_order_release);
+}
+
+template<typename Key, typename Value>
+void ConcurrentAVLNode<Key, Value>::setRight(ConcurrentAVLNode<Key, Value>* right)
+{
+    children_[1].store(right, std::memory_order_release);
+}
+
+template<typename Key, typename Value>
+int ConcurrentAVLNode<Key, Value>::getHeight() const
+{
+    return height_;
+}
+
+template<typename Key, typename Value>
+void ConcurrentAVLNode<Key, Value>::setHeight(int height)
+{
+    height_ = height;
+}
+
+template<typename Key, typename Value>
+bool ConcurrentAVLNode<Key, Value>::isPresent() const
+{
+    return present_.load(std::memory_order_acquire);
+}
+
+template<typename Key, typename Value>
+void ConcurrentAVLNode<Key, Value>::markAbsent()
+{
+    present_.store(false, std::memory_order_release);
+}
+
+template<typename Key, typename Value>
+OptimisticLock& ConcurrentAVLNode<Key, Value>::getLock() const
+{
+    return lock_;
+}
+
+/*
+  -----------------------------------------------
+  End implementations for the ConcurrentAVLNode class.
+  -----------------------------------------------
+*/
+
+
+/**
+* An AVL tree for read-mostly workloads shared between threads.
+*
+* Lookups take no locks. They descend with optimistic lock coupling:
+* the version of each node is noted before its child is read and
+* validated once the child's version is in hand, and any failed check
+* restarts from the root. Readers therefore never block one another, and
+* never write to shared memory, so read throughput scales with cores.
+*
+* Writers are serialized among themselves by one mutex. They lock, in the
+* optimistic sense above, only the nodes whose links they change: the
+* nodes a rotation moves, the parent of a node being unlinked or
+* replaced, and a node being marked absent. Attaching a new leaf changes
+* a single NULL link and locks nothing. Keys are never moved between
+* nodes, and rotations keep the key range of every subtree they do not
+* restructure. So a reader that is validated into a node can keep
+* searching below it even if rotations happen above.
+*
+* Nodes a writer unlinks may still be under a reader, so they are not
+* freed on the spot. Lookups pin an epoch of the tree's EpochManager, and
+* unlinked nodes are retired to it and freed once every lookup that could
+* have reached them has finished. At most maxPending of them wait at once,
+* and this bound blocks: a writer that would exceed it waits until the
+* lookups in progress finish, so writers stall for as long as a slow
+* lookup runs.
+*
+* The tree has its own node type rather than reusing AVLNode. Readers
+* need the children to be atomic and a version lock in every node, and
+* items that never change; AVLNode has none of these, and its parent
+* links and packed balance would be one more thing for a reader to race
+* on. Writers record the path instead of following parent links, and
+* keep exact heights, which a rotation can update from the children
+* without knowing which way the subtree changed. The single writer mutex
+* is deliberate too: the tree is meant for read-mostly use, and with one
+* writer at a time a node lock can be taken with plain stores and no two
+* rebalancing passes can meet on the same path.
+*/
+template <typename Key, typename Value>
+class ConcurrentAVLTree
+{
+public:
+    explicit ConcurrentAVLTree(std::size_t maxPending = EpochManager::DEFAULT_MAX_PENDING);
+    ~ConcurrentAVLTree();
+
+    // Safe to call from any number of threads at once
+    bool find(const Key& key, Value& value) const;
+    bool contains(const Key& key) const;
+    std::size_t size() const;
+    bool empty() const;
+
+    // Inserts the item, or replaces the value if the key is present.
+    // Writers may be called from any thread and run one at a time; each
+    // blocks while maxPending retired nodes wait on running lookups.
+    void insert(const std::pair<const Key, Value>& item);
+    void remove(const Key& key);
+    void clear();
+
+    // The number of unlinked nodes kept alive for readers
+    std::size_t retiredNodes() const;
+    // Counters of the node reclamation
+    EpochStats reclamationStats() const;
+
+protected:
+    typedef ConcurrentAVLNode<Key, Value> NodeType;
+
+    bool internalFind(const Key& key, Value* value) const;
+
+    // Writer side, under writeMutex_; path runs from the root down
+    NodeType* findPath(const Key& key, std::vector<NodeType*>& path) const;
+    OptimisticLock& lockAbove(const std::vector<NodeType*>& path, std::size_t index);
+    void replaceChild(const std::vector<NodeType*>& path, std::size_t index, NodeType* replacement);
+    void unlinkNode(std::vector<NodeType*>& path, std::size_t index);
+    void unlinkChain(std::vector<NodeType*>& path, NodeType* n);
+    void pruneRoutingNodes();
+    void rebalance(std::vector<NodeType*>& path, std::size_t index);
+    void rotateLeft(std::vector<NodeType*>& path, std::size_t index);
+    void rotateRight(std::vector<NodeType*>& path, std::size_t index);
+    NodeType* createNode(const std::pair<const Key, Value>& item, NodeType* left, NodeType* right, int height);
+    void destroyNode(NodeType* n);
+    void retire(NodeType* n);
+    static void reclaimNode(void* node, void* tree);
+    static void reclaimSubtree(void* root, void* tree);
+    static int heightOf(const NodeType* n);
+    static void updateHeight(NodeType* n);
+
+    // root_ is guarded by rootLock_ the way a child link is guarded by
+    // its node's lock
+    std::atomic<NodeType*> root_;
+    mutable OptimisticLock rootLock_;
+    std::atomic<std::size_t> size_;
+    mutable std::mutex writeMutex_;
+    // nodes linked into the tree, absent ones included; under writeMutex_
+    std::size_t nodes_;
+    // only writers allocate and free nodes, so the arena needs no locking
+    NodeArena arena_;
+    // frees retired nodes into arena_; reclaims only run inside retire(),
+    // so they too happen under writeMutex_
+    EpochManager epochs_;
+    // keys of absent nodes a rotation moved down in the current write,
+    // which may have lost a child; kept by key, as the node may be
+    // unlinked and freed before it is looked at
+    std::vector<Key> demoted_;
+
+private:
+    // Not copyable
+    ConcurrentAVLTree(const ConcurrentAVLTree<Key, Value>& other);
+    ConcurrentAVLTree<Key, Value>& operator=(const ConcurrentAVLTree<Key, Value>& other);
+};
+
+/*
+  -------------------------------------------------
+  Begin implementations for the ConcurrentAVLTree class.
+  -------------------------------------------------
+*/
+
+/**
+* Constructor. maxPending bounds the unlinked nodes kept for readers;
+* writers block while that many are waiting.
+*/
+template<typename Key, typename Value>
+ConcurrentAVLTree<Key, Value>::ConcurrentAVLTree(std::size_t maxPending) :
+    root_(NULL),
+    size_(0),
+    nodes_(0),
+    arena_(sizeof(NodeType), alignof(NodeType)),
+    epochs_(maxPending)
+{
+
+}
+
+/**
+* Destructor. No reader may still be using the tree, so both the linked
+* and the retired nodes can go.
+*/
+template<typename Key, typename Value>
+ConcurrentAVLTree<Key, Value>::~ConcurrentAVLTree()
+{
+    clear();
+    epochs_.drain();
+}
+
+/**
+* Copies the value for key into value and returns true, or returns false
+* if the key is absent. Takes no locks; the epoch guard keeps every node
+* the descent may reach from being freed under it.
+*/
+template<typename Key, typename Value>
+bool ConcurrentAVLTree<Key, Value>::find(const Key& key, Value& value) const
+{
+    EpochManager::Guard guard(epochs_);
+    return internalFind(key, &value);
+}
+
+template<typename Key, typename Value>
+bool ConcurrentAVLTree<Key, Value>::contains(const Key& key) const
+{
+    EpochManager::Guard guard(epochs_);
+    return internalFind(key, NULL);
+}
+
+template<typename Key, typename Value>
+std::size_t ConcurrentAVLTree<Key, Value>::size() const
+{
+    return size_.load(std::memory_order_relaxed);
+}
+
+template<typename Key, typename Value>
+bool ConcurrentAVLTree<Key, Value>::empty() const
+{
+    return size() == 0;
+}
+
+template<typename Key, typename Value>
+std::size_t ConcurrentAVLTree<Key, Value>::retiredNodes() const
+{
+    return epochs_.stats().pending;
+}
+
+template<typename Key, typename Value>
+EpochStats ConcurrentAVLTree<Key, Value>::reclamationStats() const
+{
+    return epochs_.stats();
+}
+
+/**
+* The lock-free descent. Each step reads the child's version before
+* validating the parent, so the child was linked under the parent when
+* its version was taken; any later change to it fails the next check.
+* Copies the value out if value is not NULL.
+*/
+template<typename Key, typename Value>
+bool ConcurrentAVLTree<Key, Value>::internalFind(const Key& key, Value* value) const
+{
+    while(true) {
+        const OptimisticLock* parentLock = &rootLock_;
+        uint64_t parentVersion = rootLock_.readVersion();
+        NodeType* current = root_.load(std::memory_order_acquire);
+        bool restart = false;
+        while(!restart) {
+            if(current == NULL) {
+                if(parentLock->validate(parentVersion)) {
+                    return false;
+                }
+                break;
+            }
+            uint64_t version = current->getLock().readVersion();
+            if(!parentLock->validate(parentVersion)) {
+                break;
+            }
+            // as in BinarySearchTree::internalFind(), test for the match
+            // first; the child is then indexed by the comparison, so a
+            // random lookup has no branch to mispredict at each level
+            if(current->getKey() == key) {
+                bool present = current->isPresent();
+                if(present && value != NULL) {
+                    *value = current->getValue();
+                }
+                if(current->getLock().validate(version)) {
+                    return present;
+                }
+                restart = true;
+                continue;
+            }
+            NodeType* next = current->getChild(current->getKey() < key);
+            parentLock = &current->getLock();
+            parentVersion = version;
+            current = next;
+        }
+    }
+}
+
+/**
+* Inserts the item. A new key is attached as a leaf and the path is
+* rebalanced; an existing key gets a new node in place of the old one,
+* which keeps every node's item immutable.
+*/
+template<typename Key, typename Value>
+void ConcurrentAVLTree<Key, Value>::insert(const std::pair<const Key, Value>& item)
+{
+    std::lock_guard<std::mutex> guard(writeMutex_);
+    std::vector<NodeType*> path;
+    NodeType* existing = findPath(item.first, path);
+    if(existing != NULL) {
+        NodeType* replacement = createNode(item, existing->getLeft(), existing->getRight(), existing->getHeight());
+        if(!existing->isPresent()) {
+            size_.fetch_add(1, std::memory_order_relaxed);
+        }
+        path.push_back(existing);
+        replaceChild(path, path.size() - 1, replacement);
+        retire(existing);
+        return;
+    }
+    NodeType* leaf = createNode(item, NULL, NULL, 1);
+    if(path.empty()) {
+        root_.store(leaf, std::memory_order_release);
+    }
+    else if(item.first < path.back()->getKey()) {
+        path.back()->setLeft(leaf);
+    }
+    else {
+        path.back()->setRight(leaf);
+    }
+    size_.fetch_add(1, std::memory_order_relaxed);
+    if(!path.empty()) {
+        rebalance(path, path.size() - 1);
+        pruneRoutingNodes();
+    }
+}
+
+/**
+* Removes the key. A node with at most one child is unlinked; one with
+* two children is only marked absent and stays as a routing node, so no
+* key ever moves to another node under a reader. Every absent node keeps
+* two children: one that a removal or a rotation leaves with fewer is
+* unlinked as well.
+*/
+template<typename Key, typename Value>
+void ConcurrentAVLTree<Key, Value>::remove(const Key& key)
+{
+    std::lock_guard<std::mutex> guard(writeMutex_);
+    std::vector<NodeType*> path;
+    NodeType* n = findPath(key, path);
+    if(n == NULL || !n->isPresent()) {
+        return;
+    }
+    size_.fetch_sub(1, std::memory_order_relaxed);
+    if(n->getLeft() != NULL && n->getRight() != NULL) {
+        n->getLock().lock();
+        n->markAbsent();
+        n->getLock().unlock();
+        return;
+    }
+    unlinkChain(path, n);
+    pruneRoutingNodes();
+}
+
+/**
+* Unlinks n, which has at most one child and hangs below the end of path,
+* and rebalances. Each unlink shortens a subtree by at most one level,
+* which one rebalance pass can absorb, so a routing parent that is left
+* with at most one child is found again and unlinked in a pass of its own.
+*/
+template<typename Key, typename Value>
+void ConcurrentAVLTree<Key, Value>::unlinkChain(std::vector<NodeType*>& path, NodeType* n)
+{
+    while(true) {
+        path.push_back(n);
+        unlinkNode(path, path.size() - 1);
+        if(path.empty()) {
+            return;
+        }
+        NodeType* parent = path.back();
+        rebalance(path, path.size() - 1);
+        if(parent->isPresent() || (parent->getLeft() != NULL && parent->getRight() != NULL)) {
+            return;
+        }
+        path.clear();
+        n = findPath(parent->getKey(), path);
+    }
+}
+
+/**
+* Unlinks the routing nodes that rotations in this write moved down and
+* left with at most one child. The rebalancing that follows may rotate
+* more of them down, so it goes on until none is left.
+*/
+template<typename Key, typename Value>
+void ConcurrentAVLTree<Key, Value>::pruneRoutingNodes()
+{
+    std::vector<NodeType*> path;
+    while(!demoted_.empty()) {
+        Key key = demoted_.back();
+        demoted_.pop_back();
+        path.clear();
+        NodeType* n = findPath(key, path);
+        if(n != NULL && !n->isPresent() && (n->getLeft() == NULL || n->getRight() == NULL)) {
+            unlinkChain(path, n);
+        }
+    }
+}
+
+/**
+* Unlinks every node at once. Readers already inside the tree finish on
+* the detached nodes, so the whole subtree is retired as one batch and
+* freed in a single walk once the epochs move past it. The batch counts
+* as all of its nodes towards maxPending.
+*/
+template<typename Key, typename Value>
+void ConcurrentAVLTree<Key, Value>::clear()
+{
+    std::lock_guard<std::mutex> guard(writeMutex_);
+    NodeType* root = root_.load(std::memory_order_relaxed);
+    if(root == NULL) {
+        return;
+    }
+    rootLock_.lock();
+    root_.store(NULL, std::memory_order_release);
+    rootLock_.unlock();
+    size_.store(0, std::memory_order_relaxed);
+    std::size_t count = nodes_;
+    nodes_ = 0;
+    epochs_.retire(root, &ConcurrentAVLTree<Key, Value>::reclaimSubtree, this, count * sizeof(NodeType), count);
+}
+
+/**
+* Descends to key, recording the nodes passed in path. Returns the node
+* with the key, which is not added to path, or NULL with path ending at
+* the node a new leaf would hang from.
+*/
+template<typename Key, typename Value>
+ConcurrentAVLNode<Key, Value>* ConcurrentAVLTree<Key, Value>::findPath(const Key& key, std::vector<NodeType*>& path) const
+{
+    NodeType* current = root_.load(std::memory_order_relaxed);
+    while(current != NULL) {
+        if(key < current->getKey()) {
+            path.push_back(current);
+            current = current->getLeft();
+        }
+        else if(current->getKey() < key) {
+            path.push_back(current);
+            current = current->getRight();
+        }
+        else {
+            return current;
+        }
+    }
+    return NULL;
+}
+
+// helper function that returns the lock guarding the link to path[index]
+template<typename Key, typename Value>
+OptimisticLock& ConcurrentAVLTree<Key, Value>::lockAbove(const std::vector<NodeType*>& path, std::size_t index)
+{
+    return index == 0 ? rootLock_ : path[index - 1]->getLock();
+}
+
+/**
+* Points the link to path[index] at replacement instead, under the locks
+* of the parent and of path[index], which readers must then leave.
+*/
+template<typename Key, typename Value>
+void ConcurrentAVLTree<Key, Value>::replaceChild(const std::vector<NodeType*>& path, std::size_t index, NodeType* replacement)
+{
+    NodeType* n = path[index];
+    OptimisticLock& parentLock = lockAbove(path, index);
+    parentLock.lock();
+    n->getLock().lock();
+    if(index == 0) {
+        root_.store(replacement, std::memory_order_release);
+    }
+    else if(path[index - 1]->getLeft() == n) {
+        path[index - 1]->setLeft(replacement);
+    }
+    else {
+        path[index - 1]->setRight(replacement);
+    }
+    n->getLock().unlock();
+    parentLock.unlock();
+}
+
+/**
+* Unlinks path[index], which has at most one child, putting that child in
+* its place, and drops it from the end of path.
+*/
+template<typename Key, typename Value>
+void ConcurrentAVLTree<Key, Value>::unlinkNode(std::vector<NodeType*>& path, std::size_t index)
+{
+    NodeType* n = path[index];
+    NodeType* child = (n->getLeft() != NULL) ? n->getLeft() : n->getRight();
+    replaceChild(path, index, child);
+    path.pop_back();
+    retire(n);
+}
+
+/**
+* Walks up from path[index] restoring heights and the AVL balance. Stops
+* once a subtree comes out as tall as it was, since nothing above it can
+* have changed. path is cut back as the walk rises.
+*/
+template<typename Key, typename Value>
+void ConcurrentAVLTree<Key, Value>::rebalance(std::vector<NodeType*>& path, std::size_t index)
+{
+    for(std::size_t i = index + 1; i-- > 0; ) {
+        path.resize(i + 1);
+        NodeType* n = path[i];
+        int oldHeight = n->getHeight();
+        int balance = heightOf(n->getRight()) - heightOf(n->getLeft());
+        if(balance > 1) {
+            NodeType* right = n->getRight();
+            if(heightOf(right->getLeft()) > heightOf(right->getRight())) {
+                path.push_back(right);
+                rotateRight(path, i + 1);
+                path.pop_back();
+            }
+            rotateLeft(path, i);
+        }
+        else if(balance < -1) {
+            NodeType* left = n->getLeft();
+            if(heightOf(left->getRight()) > heightOf(left->getLeft())) {
+                path.push_back(left);
+                rotateLeft(path, i + 1);
+                path.pop_back();
+            }
+            rotateRight(path, i);
+        }
+        else {
+            updateHeight(n);
+        }
+        if(path[i]->getHeight() == oldHeight) {
+            return;
+        }
+    }
+}
+
+/**
+* Rotates path[index] down to the left, under the locks of its parent,
+* itself and its right child, and puts that child in its place in path.
+* path[index] trades its right child for that child's left one, so if it
+* is a routing node it is noted for pruneRoutingNodes().
+*/
+template<typename Key, typename Value>
+void ConcurrentAVLTree<Key, Value>::rotateLeft(std::vector<NodeType*>& path, std::size_t index)
+{
+    NodeType* n = path[index];
+    NodeType* right = n->getRight();
+    OptimisticLock& parentLock = lockAbove(path, index);
+    parentLock.lock();
+    n->getLock().lock();
+    right->getLock().lock();
+    n->setRight(right->getLeft());
+    right->setLeft(n);
+    if(index == 0) {
+        root_.store(right, std::memory_order_release);
+    }
+    else if(path[index - 1]->getLeft() == n) {
+        path[index - 1]->setLeft(right);
+    }
+    else {
+        path[index - 1]->setRight(right);
+    }
+    right->getLock().unlock();
+    n->getLock().unlock();
+    parentLock.unlock();
+    updateHeight(n);
+    updateHeight(right);
+    path[index] = right;
+    if(!n->isPresent()) {
+        demoted_.push_back(n->getKey());
+    }
+}
+
+/**
+* Mirror image of rotateLeft().
+*/
+template<typename Key, typename Value>
+void ConcurrentAVLTree<Key, Value>::rotateRight(std::vector<NodeType*>& path, std::size_t index)
+{
+    NodeType* n = path[index];
+    NodeType* left = n->getLeft();
+    OptimisticLock& parentLock = lockAbove(path, index);
+    parentLock.lock();
+    n->getLock().lock();
+    left->getLock().lock();
+    n->setLeft(left->getRight());
+    left->setRight(n);
+    if(index == 0) {
+        root_.store(left, std::memory_order_release);
+    }
+    else if(path[index - 1]->getLeft() == n) {
+        path[index - 1]->setLeft(left);
+    }
+    else {
+        path[index - 1]->setRight(left);
+    }
+    left->getLock().unlock();
+    n->getLock().unlock();
+    parentLock.unlock();
+    updateHeight(n);
+    updateHeight(left);
+    path[index] = left;
+    if(!n->isPresent()) {
+        demoted_.push_back(n->getKey());
+    }
+}
+
+// helper function that builds a node in the arena
+template<typename Key, typename Value>
+ConcurrentAVLNode<Key, Value>* ConcurrentAVLTree<Key, Value>::createNode(const std::pair<const Key, Value>& item, NodeType* left,
+                                                                         NodeType* right, int height)
+{
+    NodeType* n = new (arena_.allocate()) NodeType(item, left, right, height);
+    ++nodes_;
+    return n;
+}
+
+// helper function that destroys a node no reader can reach any more
+template<typename Key, typename Value>
+void ConcurrentAVLTree<Key, Value>::destroyNode(NodeType* n)
+{
+    n->~NodeType();
+    arena_.deallocate(n);
+}
+
+// helper function that keeps an unlinked node for any reader still on it
+template<typename Key, typename Value>
+void ConcurrentAVLTree<Key, Value>::retire(NodeType* n)
+{
+    --nodes_;
+    epochs_.retire(n, &ConcurrentAVLTree<Key, Value>::reclaimNode, this, sizeof(NodeType));
+}
+
+// helper function the EpochManager calls once no reader can reach node
+template<typename Key, typename Value>
+void ConcurrentAVLTree<Key, Value>::reclaimNode(void* node, void* tree)
+{
+    static_cast<ConcurrentAVLTree<Key, Value>*>(tree)->destroyNode(static_cast<NodeType*>(node));
+}
+
+// helper function the EpochManager calls once no reader can reach the
+// subtree under root that clear() detached; frees all of it
+template<typename Key, typename Value>
+void ConcurrentAVLTree<Key, Value>::reclaimSubtree(void* root, void* tree)
+{
+    ConcurrentAVLTree<Key, Value>* self = static_cast<ConcurrentAVLTree<Key, Value>*>(tree);
+    std::vector<NodeType*> pending(1, static_cast<NodeType*>(root));
+    while(!pending.empty()) {
+        NodeType* n = pending.back();
+        pending.pop_back();
+        if(n->getLeft() != NULL) {
+            pending.push_back(n->getLeft());
+        }
+        if(n->getRight() != NULL) {
+            pending.push_back(n->getRight());
+        }
+        self->destroyNode(n);
+    }
+}
+
+template<typename Key, typename Value>
+int ConcurrentAVLTree<Key, Value>::heightOf(const NodeType* n)
+{
+    return n == NULL ? 0 : n->getHeight();
+}
+
+template<typename Key, typename Value>
+void ConcurrentAVLTree<Key, Value>::updateHeight(NodeType* n)
+{
+    n->setHeight(1 + std::max(heightOf(n->getLeft()), heightOf(n->getRight())));
+}
+
+/*
+  -----------------------------------------------
+  End implementations for the ConcurrentAVLTree class.
+  -----------------------------------------------
+*/
+
+#endif
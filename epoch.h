@@ -0,0 +1,300 @@
+#ifndef EPOCH_H
+#define EPOCH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+/**
+* Counters describing an EpochManager, as returned by stats().
+*/
+struct EpochStats
+{
+    uint64_t epoch;             // the global epoch
+    std::size_t retired;        // objects retired so far, counting each
+                                // object of a batch
+    std::size_t reclaimed;      // objects freed so far
+    std::size_t pending;        // retired but not yet freed
+    std::size_t pendingBytes;   // bytes of the pending objects
+    std::size_t writerWaits;    // retire() calls that waited on readers
+};
+
+/**
+* Epoch-based reclamation for structures whose readers take no locks.
+*
+* A reader pins the current global epoch for as long as it may hold
+* pointers into the structure (see Guard). A writer that unlinks an
+* object retires it instead of freeing it, tagged with the epoch of the
+* moment. The global epoch only advances once every pinned reader has
+* caught up with it, so an object retired in epoch e can no longer be
+* reached by anyone once the epoch reaches e + 2, and is freed then.
+*
+* A batch of objects that become unreachable together, such as a whole
+* detached subtree, can be retired as one entry whose reclaim frees them
+* all; it costs one retire() call but counts as all of its objects.
+*
+* Pending objects are bounded: once maxPending of them are waiting,
+* retire() blocks, yielding until the readers move on far enough for the
+* backlog to drop below the bound. A reader that stays pinned
+* indefinitely therefore stalls writers indefinitely rather than growing
+* the backlog without limit. A batch larger than maxPending makes its
+* retire() wait until the batch itself is freed. Each wait is counted in
+* writerWaits.
+*
+* Up to MAX_READERS threads can be pinned at once; more wait for a slot.
+*/
+class EpochManager
+{
+public:
+    static const std::size_t MAX_READERS = 128;
+    static const std::size_t DEFAULT_MAX_PENDING = 1 << 16;
+
+    // Pins the epoch for the lifetime of the guard
+    class Guard
+    {
+    public:
+        explicit Guard(const EpochManager& manager);
+        ~Guard();
+
+    private:
+        Guard(const Guard& other);
+        Guard& operator=(const Guard& other);
+
+        const EpochManager& manager_;
+        std::size_t slot_;
+    };
+
+    explicit EpochManager(std::size_t maxPending = DEFAULT_MAX_PENDING);
+    ~EpochManager();
+
+    // Hands object to the manager, which calls reclaim(object, context)
+    // once no pinned reader can still see it; count is the number of
+    // objects reclaim frees. Blocks while maxPending objects are waiting.
+    void retire(void* object, void (*reclaim)(void*, void*), void* context, std::size_t bytes,
+                std::size_t count = 1);
+    // Advances the epoch if the readers allow it and frees what is safe;
+    // returns the number of objects freed
+    std::size_t collect();
+    // Frees every pending object now; no reader may be pinned
+    void drain();
+    EpochStats stats() const;
+
+private:
+    EpochManager(const EpochManager& other);
+    EpochManager& operator=(const EpochManager& other);
+
+    // a reader's pinned epoch, alone on its cache line
+    struct Slot {
+        alignas(64) std::atomic<uint64_t> epoch;
+    };
+    struct Retired {
+        void* object;
+        void (*reclaim)(void*, void*);
+        void* context;
+        std::size_t bytes;
+        std::size_t count;
+        uint64_t epoch;
+    };
+    // marks a slot no reader holds
+    static const uint64_t QUIESCENT = ~static_cast<uint64_t>(0);
+    // retire() collects on every this many calls
+    static const std::size_t COLLECT_INTERVAL = 64;
+
+    std::size_t pin() const;
+    void unpin(std::size_t slot) const;
+    bool tryAdvance();
+    std::size_t freeUpTo(uint64_t epoch);
+
+    std::atomic<uint64_t> epoch_;
+    mutable Slot slots_[MAX_READERS];
+    // everything below is guarded by mutex_
+    mutable std::mutex mutex_;
+    std::vector<Retired> pending_;
+    std::size_t maxPending_;
+    std::size_t retireCalls_;
+    std::size_t retired_;
+    std::size_t pendingObjects_;
+    std::size_t reclaimed_;
+    std::size_t pendingBytes_;
+    std::size_t writerWaits_;
+};
+
+/*
+  -------------------------------------------------
+  Begin implementations for the EpochManager class.
+  -------------------------------------------------
+*/
+
+inline EpochManager::Guard::Guard(const EpochManager& manager) :
+    manager_(manager),
+    slot_(manager.pin())
+{
+
+}
+
+inline EpochManager::Guard::~Guard()
+{
+    manager_.unpin(slot_);
+}
+
+inline EpochManager::EpochManager(std::size_t maxPending) :
+    epoch_(0),
+    maxPending_(maxPending),
+    retireCalls_(0),
+    retired_(0),
+    pendingObjects_(0),
+    reclaimed_(0),
+    pendingBytes_(0),
+    writerWaits_(0)
+{
+    for(std::size_t i = 0; i < MAX_READERS; ++i) {
+        slots_[i].epoch.store(QUIESCENT, std::memory_order_relaxed);
+    }
+}
+
+/**
+* Destructor, which frees whatever is still pending.
+*/
+inline EpochManager::~EpochManager()
+{
+    drain();
+}
+
+/**
+* Retires object, or a batch of count objects, freeing older objects
+* first if it is time to collect. Blocks, with the mutex released, until
+* readers move on if maxPending objects are then waiting; this does not
+* return while a pinned reader holds the epoch back.
+*/
+inline void EpochManager::retire(void* object, void (*reclaim)(void*, void*), void* context, std::size_t bytes,
+                                 std::size_t count)
+{
+    std::unique_lock<std::mutex> guard(mutex_);
+    Retired entry = { object, reclaim, context, bytes, count, epoch_.load(std::memory_order_seq_cst) };
+    pending_.push_back(entry);
+    pendingBytes_ += bytes;
+    pendingObjects_ += count;
+    retired_ += count;
+    if(++retireCalls_ % COLLECT_INTERVAL != 0 && pendingObjects_ < maxPending_) {
+        return;
+    }
+    tryAdvance();
+    freeUpTo(epoch_.load(std::memory_order_relaxed));
+    if(pendingObjects_ >= maxPending_) {
+        ++writerWaits_;
+        while(pendingObjects_ >= maxPending_) {
+            guard.unlock();
+            std::this_thread::yield();
+            guard.lock();
+            tryAdvance();
+            freeUpTo(epoch_.load(std::memory_order_relaxed));
+        }
+    }
+}
+
+inline std::size_t EpochManager::collect()
+{
+    std::lock_guard<std::mutex> guard(mutex_);
+    tryAdvance();
+    return freeUpTo(epoch_.load(std::memory_order_relaxed));
+}
+
+inline void EpochManager::drain()
+{
+    std::lock_guard<std::mutex> guard(mutex_);
+    freeUpTo(QUIESCENT);
+}
+
+inline EpochStats EpochManager::stats() const
+{
+    std::lock_guard<std::mutex> guard(mutex_);
+    EpochStats result;
+    result.epoch = epoch_.load(std::memory_order_relaxed);
+    result.retired = retired_;
+    result.reclaimed = reclaimed_;
+    result.pending = pendingObjects_;
+    result.pendingBytes = pendingBytes_;
+    result.writerWaits = writerWaits_;
+    return result;
+}
+
+/**
+* Claims a free slot and publishes the current epoch in it. The claim is
+* a sequentially consistent exchange, so it is visible to tryAdvance()
+* before this reader loads any pointer from the structure. Each thread
+* starts looking at the slot it last used, so readers do not share lines.
+*/
+inline std::size_t EpochManager::pin() const
+{
+    static thread_local std::size_t hint = 0;
+    while(true) {
+        for(std::size_t i = 0; i < MAX_READERS; ++i) {
+            std::size_t slot = (hint + i) % MAX_READERS;
+            uint64_t expected = QUIESCENT;
+            if(slots_[slot].epoch.load(std::memory_order_relaxed) == QUIESCENT
+               && slots_[slot].epoch.compare_exchange_strong(expected, epoch_.load(std::memory_order_seq_cst))) {
+                hint = slot;
+                return slot;
+            }
+        }
+        std::this_thread::yield();
+    }
+}
+
+inline void EpochManager::unpin(std::size_t slot) const
+{
+    slots_[slot].epoch.store(QUIESCENT, std::memory_order_release);
+}
+
+/**
+* Moves the global epoch on by one if every pinned reader has seen the
+* current one. A reader that pinned an epoch just before it advanced
+* holds the epoch back one step, which is what keeps its objects alive.
+*/
+inline bool EpochManager::tryAdvance()
+{
+    uint64_t current = epoch_.load(std::memory_order_seq_cst);
+    for(std::size_t i = 0; i < MAX_READERS; ++i) {
+        uint64_t pinned = slots_[i].epoch.load(std::memory_order_seq_cst);
+        if(pinned != QUIESCENT && pinned != current) {
+            return false;
+        }
+    }
+    epoch_.store(current + 1, std::memory_order_seq_cst);
+    return true;
+}
+
+// helper function that frees the pending objects retired at least two
+// epochs before epoch, and returns how many it freed, counting each
+// object of a batch
+inline std::size_t EpochManager::freeUpTo(uint64_t epoch)
+{
+    std::size_t kept = 0;
+    std::size_t freed = 0;
+    for(std::size_t i = 0; i < pending_.size(); ++i) {
+        Retired& entry = pending_[i];
+        if(epoch == QUIESCENT || entry.epoch + 2 <= epoch) {
+            entry.reclaim(entry.object, entry.context);
+            pendingBytes_ -= entry.bytes;
+            pendingObjects_ -= entry.count;
+            freed += entry.count;
+        }
+        else {
+            pending_[kept++] = entry;
+        }
+    }
+    pending_.resize(kept);
+    reclaimed_ += freed;
+    return freed;
+}
+
+/*
+  -----------------------------------------------
+  End implementations for the EpochManager class.
+  -----------------------------------------------
+*/
+
+#endif
@@ -0,0 +1,552 @@
+#ifndef NODE_ARENA_H
+#define NODE_ARENA_H
+
+#include <cstddef>
+#include <new>
+#include <utility>
+
+/**
+* A slab allocator for the fixed-size nodes of a single search tree.
+* Nodes are carved out of large contiguous blocks instead of being
+* allocated one at a time, freed nodes are recycled through an intrusive
+* free list, and release() hands every block back at once without
+* visiting the individual nodes.
+*
+* The arena only manages raw memory: constructing and destroying the
+* objects that live in it is up to the tree that owns it.
+*
+* Operations that hand part of a tree to another tree without moving its
+* nodes can share() the blocks between two arenas. Shared blocks are
+* freed once every arena holding them has been released, so until then
+* each arena keeps the other's memory alive. A group of blocks that only
+* one arena still holds becomes that arena's own again, and repeated
+* sharing between the same two arenas reuses one group, so the
+* bookkeeping does not grow with the number of splits.
+*
+* Every list the arena keeps also keeps its tail, and unused stretches of
+* blocks are kept as whole runs, so adopting another arena splices lists
+* instead of walking them: it costs O(1) plus a pass over the few shared
+* groups, however many free slots and blocks either arena has.
+*/
+class NodeArena
+{
+public:
+    NodeArena(std::size_t slotSize, std::size_t slotAlign);
+    NodeArena(NodeArena&& other);
+    ~NodeArena();
+
+    void* allocate();
+    void* allocateRun(std::size_t count);
+    void deallocate(void* slot);
+    void release();
+    void adopt(NodeArena& other);
+    void share(NodeArena& other);
+    void swap(NodeArena& other);
+    std::size_t bytesReserved() const;
+    std::size_t slotSize() const;
+
+private:
+    // Not copyable: a block can only ever have one owner
+    NodeArena(const NodeArena& other);
+    NodeArena& operator=(const NodeArena& other);
+
+    void addBlock();
+    void addBlock(std::size_t slots);
+    void keepRun(char* cursor, char* limit);
+    void takeRun();
+
+    // Every block starts with this header, followed by its slots
+    struct Block
+    {
+        Block* next;
+    };
+    // A slot that is on the free list holds the link to the next free slot
+    struct FreeSlot
+    {
+        FreeSlot* next;
+    };
+    // The first slot of a run of never used slots holds the link to the
+    // next run and the end of its own
+    struct FreeRun
+    {
+        FreeRun* next;
+        char* limit;
+    };
+    // Blocks kept alive by several arenas, each holding one SharedRef to them
+    struct SharedBlocks
+    {
+        Block* blocks;
+        Block* lastBlock;
+        std::size_t bytes;
+        std::size_t owners;
+    };
+    struct SharedRef
+    {
+        SharedRef* next;
+        SharedBlocks* group;
+    };
+
+    static void freeBlocks(Block* block);
+    bool holds(const SharedBlocks* group) const;
+    void reclaimSoleGroups();
+
+    static const std::size_t FIRST_BLOCK_SLOTS = 32;
+    static const std::size_t MAX_BLOCK_SLOTS = 4096;
+
+    std::size_t slotSize_;
+    std::size_t headerSize_;
+    std::size_t nextBlockSlots_;
+    std::size_t bytesReserved_;
+    std::size_t ownBytes_;
+    // the tails below are only meaningful while their list is non-empty
+    Block* blocks_;
+    Block* lastBlock_;
+    SharedRef* shared_;
+    FreeSlot* freeList_;
+    FreeSlot* lastFree_;
+    FreeRun* runs_;
+    FreeRun* lastRun_;
+    char* cursor_;
+    char* limit_;
+};
+
+/*
+  -----------------------------------------
+  Begin implementations for the NodeArena class.
+  -----------------------------------------
+*/
+
+/**
+* Constructor for an empty arena. No memory is requested until the
+* first call to allocate(). Slots are padded so that every one of them
+* is suitably aligned and large enough to hold a free list or run link.
+*/
+inline NodeArena::NodeArena(std::size_t slotSize, std::size_t slotAlign) :
+    slotSize_(slotSize),
+    headerSize_(sizeof(Block)),
+    nextBlockSlots_(FIRST_BLOCK_SLOTS),
+    bytesReserved_(0),
+    ownBytes_(0),
+    blocks_(NULL),
+    lastBlock_(NULL),
+    shared_(NULL),
+    freeList_(NULL),
+    lastFree_(NULL),
+    runs_(NULL),
+    lastRun_(NULL),
+    cursor_(NULL),
+    limit_(NULL)
+{
+    if(slotAlign < alignof(FreeRun)) {
+        slotAlign = alignof(FreeRun);
+    }
+    if(slotSize_ < sizeof(FreeRun)) {
+        slotSize_ = sizeof(FreeRun);
+    }
+    slotSize_ = (slotSize_ + slotAlign - 1) / slotAlign * slotAlign;
+    headerSize_ = (headerSize_ + slotAlign - 1) / slotAlign * slotAlign;
+}
+
+/**
+* Move constructor, which takes over every block of other in O(1) and
+* leaves other empty, with the same slot size.
+*/
+inline NodeArena::NodeArena(NodeArena&& other) :
+    slotSize_(other.slotSize_),
+    headerSize_(other.headerSize_),
+    nextBlockSlots_(FIRST_BLOCK_SLOTS),
+    bytesReserved_(0),
+    ownBytes_(0),
+    blocks_(NULL),
+    lastBlock_(NULL),
+    shared_(NULL),
+    freeList_(NULL),
+    lastFree_(NULL),
+    runs_(NULL),
+    lastRun_(NULL),
+    cursor_(NULL),
+    limit_(NULL)
+{
+    swap(other);
+}
+
+/**
+* Destructor, which returns every block to the system.
+*/
+inline NodeArena::~NodeArena()
+{
+    release();
+}
+
+/**
+* Returns uninitialized memory for one node, preferring recycled slots
+* over fresh ones, and unused runs over a new block.
+*/
+inline void* NodeArena::allocate()
+{
+    if(freeList_ != NULL) {
+        FreeSlot* slot = freeList_;
+        freeList_ = slot->next;
+        return slot;
+    }
+    if(cursor_ == limit_) {
+        if(runs_ != NULL) {
+            takeRun();
+        }
+        else {
+            addBlock();
+        }
+    }
+    void* slot = cursor_;
+    cursor_ += slotSize_;
+    return slot;
+}
+
+/**
+* Returns uninitialized memory for count nodes laid out back to back,
+* slotSize() bytes apart, for trees that build many nodes at once.
+*/
+inline void* NodeArena::allocateRun(std::size_t count)
+{
+    if(count == 0) {
+        return NULL;
+    }
+    if(static_cast<std::size_t>(limit_ - cursor_) < count * slotSize_) {
+        // start a block just for this run, keeping the remainder of the
+        // current one for allocate()
+        keepRun(cursor_, limit_);
+        addBlock(count > nextBlockSlots_ ? count : nextBlockSlots_);
+    }
+    void* run = cursor_;
+    cursor_ += count * slotSize_;
+    return run;
+}
+
+/**
+* Puts a slot back on the free list. The object that lived in it must
+* already have been destroyed.
+*/
+inline void NodeArena::deallocate(void* slot)
+{
+    FreeSlot* freed = static_cast<FreeSlot*>(slot);
+    if(freeList_ == NULL) {
+        lastFree_ = freed;
+    }
+    freed->next = freeList_;
+    freeList_ = freed;
+}
+
+/**
+* Frees every block at once and resets the arena for use again.
+* Any objects still living in the arena are simply forgotten.
+*/
+inline void NodeArena::release()
+{
+    freeBlocks(blocks_);
+    blocks_ = NULL;
+    while(shared_ != NULL) {
+        SharedRef* next = shared_->next;
+        if(--shared_->group->owners == 0) {
+            freeBlocks(shared_->group->blocks);
+            delete shared_->group;
+        }
+        delete shared_;
+        shared_ = next;
+    }
+    freeList_ = NULL;
+    runs_ = NULL;
+    cursor_ = NULL;
+    limit_ = NULL;
+    nextBlockSlots_ = FIRST_BLOCK_SLOTS;
+    bytesReserved_ = 0;
+    ownBytes_ = 0;
+}
+
+/**
+* Takes over every block and free slot of other, which must hold slots
+* of the same size, and leaves other empty. The objects living in the
+* adopted blocks stay where they are, so pointers to them remain valid.
+* The lists of the two arenas are spliced through their tails, so this
+* does not depend on how many blocks or free slots either one has.
+*/
+inline void NodeArena::adopt(NodeArena& other)
+{
+    if(&other == this) {
+        return;
+    }
+    if(other.blocks_ != NULL) {
+        if(blocks_ == NULL) {
+            lastBlock_ = other.lastBlock_;
+        }
+        other.lastBlock_->next = blocks_;
+        blocks_ = other.blocks_;
+    }
+    while(other.shared_ != NULL) {
+        SharedRef* ref = other.shared_;
+        other.shared_ = ref->next;
+        if(holds(ref->group)) {
+            // both arenas were keeping this group alive; now one does
+            --ref->group->owners;
+            bytesReserved_ -= ref->group->bytes;
+            delete ref;
+        }
+        else {
+            ref->next = shared_;
+            shared_ = ref;
+        }
+    }
+    if(other.freeList_ != NULL) {
+        if(freeList_ == NULL) {
+            lastFree_ = other.lastFree_;
+        }
+        other.lastFree_->next = freeList_;
+        freeList_ = other.freeList_;
+    }
+    if(other.runs_ != NULL) {
+        if(runs_ == NULL) {
+            lastRun_ = other.lastRun_;
+        }
+        other.lastRun_->next = runs_;
+        runs_ = other.runs_;
+    }
+    // keep bump allocating from whichever block has more room left, and
+    // keep the unused slots of the other as one run
+    if(other.limit_ - other.cursor_ > limit_ - cursor_) {
+        std::swap(cursor_, other.cursor_);
+        std::swap(limit_, other.limit_);
+    }
+    keepRun(other.cursor_, other.limit_);
+    if(other.nextBlockSlots_ > nextBlockSlots_) {
+        nextBlockSlots_ = other.nextBlockSlots_;
+    }
+    bytesReserved_ += other.bytesReserved_;
+    ownBytes_ += other.ownBytes_;
+
+    other.blocks_ = NULL;
+    other.shared_ = NULL;
+    other.freeList_ = NULL;
+    other.runs_ = NULL;
+    other.release();
+    reclaimSoleGroups();
+}
+
+/**
+* Makes other keep every block of this arena alive as well, for when
+* some of the objects living here now belong to other's owner. Both
+* arenas go on allocating from blocks of their own, and either one may
+* recycle a slot it is handed back. Costs one small record per group
+* of blocks, not per block.
+*/
+inline void NodeArena::share(NodeArena& other)
+{
+    if(&other == this) {
+        return;
+    }
+    reclaimSoleGroups();
+    // turn the blocks owned by this arena alone into a shared group, or
+    // add them to one that only the two arenas share already
+    if(blocks_ != NULL) {
+        for(SharedRef* ref = shared_; ref != NULL; ref = ref->next) {
+            if(ref->group->owners == 2 && other.holds(ref->group)) {
+                lastBlock_->next = ref->group->blocks;
+                ref->group->blocks = blocks_;
+                ref->group->bytes += ownBytes_;
+                other.bytesReserved_ += ownBytes_;
+                blocks_ = NULL;
+                ownBytes_ = 0;
+                break;
+            }
+        }
+    }
+    if(blocks_ != NULL) {
+        SharedBlocks* group = new SharedBlocks;
+        group->blocks = blocks_;
+        group->lastBlock = lastBlock_;
+        group->bytes = ownBytes_;
+        group->owners = 1;
+        SharedRef* ref = new SharedRef;
+        ref->next = shared_;
+        ref->group = group;
+        shared_ = ref;
+        blocks_ = NULL;
+        ownBytes_ = 0;
+    }
+    // an arena with nothing to allocate from takes a few of this one's
+    // free slots or unused runs, or else half of its unused slots, rather
+    // than starting a block of its own that would outlive every node it
+    // ever held
+    if(other.freeList_ == NULL && other.runs_ == NULL && other.cursor_ == other.limit_) {
+        std::size_t given = 0;
+        for(; given < FIRST_BLOCK_SLOTS && freeList_ != NULL; ++given) {
+            FreeSlot* slot = freeList_;
+            freeList_ = slot->next;
+            other.deallocate(slot);
+        }
+        for(std::size_t i = 0; i < FIRST_BLOCK_SLOTS && given < FIRST_BLOCK_SLOTS && runs_ != NULL; ++i) {
+            FreeRun* run = runs_;
+            runs_ = run->next;
+            given += static_cast<std::size_t>(run->limit - reinterpret_cast<char*>(run)) / slotSize_;
+            other.keepRun(reinterpret_cast<char*>(run), run->limit);
+        }
+        if(given == 0) {
+            std::size_t slots = static_cast<std::size_t>(limit_ - cursor_) / slotSize_;
+            other.limit_ = limit_;
+            other.cursor_ = limit_ - (slots + 1) / 2 * slotSize_;
+            limit_ = other.cursor_;
+        }
+    }
+    for(SharedRef* ref = shared_; ref != NULL; ref = ref->next) {
+        if(other.holds(ref->group)) {
+            continue;
+        }
+        SharedRef* copy = new SharedRef;
+        copy->next = other.shared_;
+        copy->group = ref->group;
+        ++ref->group->owners;
+        other.shared_ = copy;
+        other.bytesReserved_ += ref->group->bytes;
+    }
+}
+
+/**
+* Exchanges the blocks, free slots and slot sizes of the two arenas in O(1).
+*/
+inline void NodeArena::swap(NodeArena& other)
+{
+    std::swap(slotSize_, other.slotSize_);
+    std::swap(headerSize_, other.headerSize_);
+    std::swap(nextBlockSlots_, other.nextBlockSlots_);
+    std::swap(bytesReserved_, other.bytesReserved_);
+    std::swap(ownBytes_, other.ownBytes_);
+    std::swap(blocks_, other.blocks_);
+    std::swap(lastBlock_, other.lastBlock_);
+    std::swap(shared_, other.shared_);
+    std::swap(freeList_, other.freeList_);
+    std::swap(lastFree_, other.lastFree_);
+    std::swap(runs_, other.runs_);
+    std::swap(lastRun_, other.lastRun_);
+    std::swap(cursor_, other.cursor_);
+    std::swap(limit_, other.limit_);
+}
+
+/**
+* Returns the distance in bytes between neighbouring slots.
+*/
+inline std::size_t NodeArena::slotSize() const
+{
+    return slotSize_;
+}
+
+/**
+* Returns the total size of the blocks currently held by the arena,
+* including slots that are free or not handed out yet, and blocks
+* shared with other arenas.
+*/
+inline std::size_t NodeArena::bytesReserved() const
+{
+    return bytesReserved_;
+}
+
+// helper function for allocate that grabs a new, bigger block
+inline void NodeArena::addBlock()
+{
+    addBlock(nextBlockSlots_);
+}
+
+// helper function that grabs a new block with room for the given number of slots
+inline void NodeArena::addBlock(std::size_t slots)
+{
+    std::size_t bytes = headerSize_ + slots * slotSize_;
+    char* raw = static_cast<char*>(::operator new(bytes));
+    bytesReserved_ += bytes;
+    ownBytes_ += bytes;
+    Block* block = reinterpret_cast<Block*>(raw);
+    if(blocks_ == NULL) {
+        lastBlock_ = block;
+    }
+    block->next = blocks_;
+    blocks_ = block;
+    cursor_ = raw + headerSize_;
+    limit_ = cursor_ + slots * slotSize_;
+    if(nextBlockSlots_ < MAX_BLOCK_SLOTS) {
+        nextBlockSlots_ *= 2;
+    }
+}
+
+// helper function that checks whether this arena already shares group
+inline bool NodeArena::holds(const SharedBlocks* group) const
+{
+    for(SharedRef* ref = shared_; ref != NULL; ref = ref->next) {
+        if(ref->group == group) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// helper function that takes back as its own every shared group that no
+// other arena holds any more
+inline void NodeArena::reclaimSoleGroups()
+{
+    SharedRef** link = &shared_;
+    while(*link != NULL) {
+        SharedRef* ref = *link;
+        if(ref->group->owners == 1) {
+            if(blocks_ == NULL) {
+                lastBlock_ = ref->group->lastBlock;
+            }
+            ref->group->lastBlock->next = blocks_;
+            blocks_ = ref->group->blocks;
+            ownBytes_ += ref->group->bytes;
+            delete ref->group;
+            *link = ref->next;
+            delete ref;
+        }
+        else {
+            link = &ref->next;
+        }
+    }
+}
+
+// helper function that keeps the unused slots from cursor to limit as a
+// run for allocate() to bump through later
+inline void NodeArena::keepRun(char* cursor, char* limit)
+{
+    if(cursor == limit) {
+        return;
+    }
+    FreeRun* run = reinterpret_cast<FreeRun*>(cursor);
+    run->limit = limit;
+    if(runs_ == NULL) {
+        lastRun_ = run;
+    }
+    run->next = runs_;
+    runs_ = run;
+}
+
+// helper function for allocate that bump allocates from the next kept run
+inline void NodeArena::takeRun()
+{
+    FreeRun* run = runs_;
+    runs_ = run->next;
+    cursor_ = reinterpret_cast<char*>(run);
+    limit_ = run->limit;
+}
+
+// helper function that returns a list of blocks to the system
+inline void NodeArena::freeBlocks(Block* block)
+{
+    while(block != NULL) {
+        Block* next = block->next;
+        ::operator delete(block);
+        block = next;
+    }
+}
+
+/*
+  ---------------------------------------
+  End implementations for the NodeArena class.
+  ---------------------------------------
+*/
+
+#endif
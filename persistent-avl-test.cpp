@@ -0,0 +1,190 @@
+#include <iostream>
+#include <map>
+#include <random>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <vector>
+#include <cmath>
+#include "persistent_avl.h"
+#include "test_check.h"
+
+using namespace std;
+
+typedef PersistentAVLTree<int, int> Tree;
+typedef map<int, int> Model;
+
+// Checks a version of the tree against model: the items in order, point
+// and range lookups, and a height within the AVL bound
+template<class Version>
+void checkSame(const Version& version, const Model& model)
+{
+    CHECK(version.size() == model.size());
+    CHECK(version.empty() == model.empty());
+    CHECK(version.height() <= 1.45 * log2(model.size() + 2.0));
+    Model::const_iterator expected = model.begin();
+    version.for_each([&expected, &model](const pair<const int, int>& item) {
+        CHECK(expected != model.end());
+        CHECK(item.first == expected->first && item.second == expected->second);
+        ++expected;
+    });
+    CHECK(expected == model.end());
+    for(Model::const_iterator it = model.begin(); it != model.end(); ++it) {
+        const pair<const int, int>* found = version.find(it->first);
+        CHECK(found != NULL && found->second == it->second);
+        if(model.count(it->first + 1) == 0) {
+            CHECK(version.find(it->first + 1) == NULL);
+        }
+    }
+    if(model.size() >= 2) {
+        int lo = model.begin()->first + 1;
+        int hi = model.rbegin()->first;
+        Model::const_iterator inRange = model.lower_bound(lo);
+        version.for_each_range(lo, hi, [&inRange, hi](const pair<const int, int>& item) {
+            CHECK(inRange->first < hi);
+            CHECK(item.first == inRange->first);
+            ++inRange;
+        });
+        CHECK(inRange == model.lower_bound(hi));
+    }
+}
+
+// Random inserts and removals with snapshots taken along the way; every
+// snapshot must keep showing the tree as it was, however the tree and the
+// other snapshots change, and dropping them in any order must be safe
+void testSnapshots()
+{
+    mt19937 rng(20);
+    for(int round = 0; round < 5; ++round) {
+        Tree tree;
+        Model model;
+        vector<pair<Tree::Snapshot, Model> > held;
+        for(int op = 0; op < 3000; ++op) {
+            int key = static_cast<int>(rng() % 500);
+            if(rng() % 3 != 0) {
+                int value = static_cast<int>(rng());
+                tree.insert(make_pair(key, value));
+                model[key] = value;
+            }
+            else {
+                tree.remove(key);
+                model.erase(key);
+            }
+            if(op % 100 == 0) {
+                checkSame(tree, model);
+                held.push_back(make_pair(tree.snapshot(), model));
+            }
+            if(op % 250 == 0 && !held.empty()) {
+                held.erase(held.begin() + rng() % held.size());
+            }
+            if(op % 500 == 0) {
+                for(size_t i = 0; i < held.size(); ++i) {
+                    checkSame(held[i].first, held[i].second);
+                }
+            }
+        }
+        checkSame(tree, model);
+        for(size_t i = 0; i < held.size(); ++i) {
+            checkSame(held[i].first, held[i].second);
+        }
+        // copies and moves share the same version
+        Tree::Snapshot copy = held.back().first;
+        Tree::Snapshot moved = std::move(copy);
+        checkSame(moved, held.back().second);
+        tree.clear();
+        checkSame(tree, Model());
+        for(size_t i = 0; i < held.size(); ++i) {
+            checkSame(held[i].first, held[i].second);
+        }
+    }
+}
+
+// retainedMemory() counts exactly the nodes of a snapshot the tree no
+// longer shares
+void testRetainedMemory()
+{
+    Tree tree;
+    Model model;
+    for(int i = 0; i < 1000; ++i) {
+        tree.insert(make_pair(i, i));
+        model[i] = i;
+    }
+    size_t nodeBytes = tree.memoryUsage() / tree.size();
+    Tree::Snapshot s = tree.snapshot();
+    CHECK(tree.retainedMemory(s) == 0);
+    tree.insert(make_pair(500, -1));
+    size_t copied = tree.retainedMemory(s) / nodeBytes;
+    CHECK(copied >= 1 && copied <= static_cast<size_t>(tree.height()));
+    for(int i = 0; i < 1000; ++i) {
+        tree.remove(i);
+    }
+    CHECK(tree.memoryUsage() == 0);
+    CHECK(tree.retainedMemory(s) == s.size() * nodeBytes);
+    checkSame(s, model);
+}
+
+// Readers copy and walk published snapshots on their own threads while the
+// writer keeps updating; every key maps to twice itself, and each snapshot
+// holds as many items as the writer counted when it took it
+void testConcurrentReaders()
+{
+    static const int READERS = 3;
+    Tree tree;
+    mutex publishMutex;
+    Tree::Snapshot published = tree.snapshot();
+    atomic<bool> done(false);
+    atomic<int> failures(0);
+    vector<thread> readers;
+    for(int r = 0; r < READERS; ++r) {
+        readers.push_back(thread([&]() {
+            while(!done.load()) {
+                Tree::Snapshot view;
+                {
+                    lock_guard<mutex> guard(publishMutex);
+                    view = published;
+                }
+                size_t count = 0;
+                int last = -1;
+                view.for_each([&](const pair<const int, int>& item) {
+                    if(item.second != 2 * item.first || item.first <= last) {
+                        failures.fetch_add(1);
+                    }
+                    last = item.first;
+                    ++count;
+                });
+                if(count != view.size()) {
+                    failures.fetch_add(1);
+                }
+            }
+        }));
+    }
+    mt19937 rng(2);
+    for(int op = 0; op < 50000; ++op) {
+        int key = static_cast<int>(rng() % 2000);
+        if(rng() % 2 == 0) {
+            tree.insert(make_pair(key, 2 * key));
+        }
+        else {
+            tree.remove(key);
+        }
+        if(op % 16 == 0) {
+            Tree::Snapshot view = tree.snapshot();
+            lock_guard<mutex> guard(publishMutex);
+            published = view;
+        }
+    }
+    done.store(true);
+    for(size_t i = 0; i < readers.size(); ++i) {
+        readers[i].join();
+    }
+    CHECK(failures.load() == 0);
+}
+
+int main()
+{
+    testSnapshots();
+    testRetainedMemory();
+    testConcurrentReaders();
+    cout << "persistent-avl-test: all passed" << endl;
+    return 0;
+}
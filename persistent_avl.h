@@ -0,0 +1,690 @@
+#ifndef PERSISTENT_AVL_H
+#define PERSISTENT_AVL_H
+
+#include <cstddef>
+#include <utility>
+#include <vector>
+#include <atomic>
+#include <algorithm>
+#include "bst.h"
+
+/**
+* A node of a PersistentAVLTree. Nodes are never changed once built, so a
+* subtree can be shared by any number of versions of the tree. Each node
+* counts the parents and versions that refer to it and is freed when the
+* last of them lets go. There is no parent pointer, since a shared node has
+* a different parent in each version.
+*/
+template <typename Key, typename Value>
+class PersistentNode
+{
+public:
+    PersistentNode(const std::pair<const Key, Value>& item, const PersistentNode<Key, Value>* left,
+                   const PersistentNode<Key, Value>* right);
+
+    const std::pair<const Key, Value>& getItem() const;
+    const Key& getKey() const;
+    const Value& getValue() const;
+    const PersistentNode<Key, Value>* getLeft() const;
+    const PersistentNode<Key, Value>* getRight() const;
+    int getHeight() const;
+
+    // Reference counting; release() frees the node, and whatever only it
+    // kept alive, when the count drops to zero. Both are thread safe.
+    static void acquire(const PersistentNode<Key, Value>* n);
+    static void release(const PersistentNode<Key, Value>* n);
+    static void releaseIfUnused(const PersistentNode<Key, Value>* n);
+
+private:
+    ~PersistentNode();
+
+    std::pair<const Key, Value> item_;
+    const PersistentNode<Key, Value>* left_;
+    const PersistentNode<Key, Value>* right_;
+    int height_;
+    mutable std::atomic<std::size_t> refs_;
+};
+
+/*
+  -------------------------------------------------
+  Begin implementations for the PersistentNode class.
+  -------------------------------------------------
+*/
+
+/**
+* Constructor, which takes a reference to each child. The new node itself
+* starts unreferenced.
+*/
+template<typename Key, typename Value>
+PersistentNode<Key, Value>::PersistentNode(const std::pair<const Key, Value>& item, const PersistentNode<Key, Value>* left,
+                                           const PersistentNode<Key, Value>* right) :
+    item_(item),
+    left_(left),
+    right_(right),
+    height_(1 + std::max(left == NULL ? 0 : left->height_, right == NULL ? 0 : right->height_)),
+    refs_(0)
+{
+    acquire(left);
+    acquire(right);
+}
+
+/**
+* Destructor, which drops the references to the children.
+*/
+template<typename Key, typename Value>
+PersistentNode<Key, Value>::~PersistentNode()
+{
+    release(left_);
+    release(right_);
+}
+
+template<typename Key, typename Value>
+const std::pair<const Key, Value>& PersistentNode<Key, Value>::getItem() const
+{
+    return item_;
+}
+
+template<typename Key, typename Value>
+const Key& PersistentNode<Key, Value>::getKey() const
+{
+    return item_.first;
+}
+
+template<typename Key, typename Value>
+const Value& PersistentNode<Key, Value>::getValue() const
+{
+    return item_.second;
+}
+
+template<typename Key, typename Value>
+const PersistentNode<Key, Value>* PersistentNode<Key, Value>::getLeft() const
+{
+    return left_;
+}
+
+template<typename Key, typename Value>
+const PersistentNode<Key, Value>* PersistentNode<Key, Value>::getRight() const
+{
+    return right_;
+}
+
+template<typename Key, typename Value>
+int PersistentNode<Key, Value>::getHeight() const
+{
+    return height_;
+}
+
+template<typename Key, typename Value>
+void PersistentNode<Key, Value>::acquire(const PersistentNode<Key, Value>* n)
+{
+    if(n != NULL) {
+        n->refs_.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+/**
+* Drops one reference to n. The last one frees n, which in turn releases
+* its children, so a subtree goes exactly as far down as it is unshared.
+*/
+template<typename Key, typename Value>
+void PersistentNode<Key, Value>::release(const PersistentNode<Key, Value>* n)
+{
+    if(n != NULL && n->refs_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        delete n;
+    }
+}
+
+/**
+* Frees n if nothing refers to it. The writer builds nodes that a
+* rebalance may take apart again before linking them anywhere; this
+* reclaims those. Only the writer can see such a node, so the check
+* cannot race.
+*/
+template<typename Key, typename Value>
+void PersistentNode<Key, Value>::releaseIfUnused(const PersistentNode<Key, Value>* n)
+{
+    if(n != NULL && n->refs_.load(std::memory_order_relaxed) == 0) {
+        delete n;
+    }
+}
+
+/*
+  -----------------------------------------------
+  End implementations for the PersistentNode class.
+  -----------------------------------------------
+*/
+
+
+/**
+* An AVL tree whose updates copy only the O(log n) nodes on the path they
+* change and share every other subtree with the previous version. That
+* makes snapshot() O(1): a snapshot is just a counted reference to the
+* current root, and later updates never touch the nodes it can see.
+*
+* One thread (or one lock holder) owns the tree and makes all calls on
+* it, including snapshot(). The snapshots it hands out can be read,
+* copied and dropped from any thread at any time, with no locking and
+* without ever blocking the writer.
+*
+* Every update copies its path's items, so Value should be cheap to copy
+* (or a pointer to something larger).
+*/
+template <typename Key, typename Value>
+class PersistentAVLTree
+{
+public:
+    // A read-only view of the tree as it was when snapshot() was taken
+    class Snapshot
+    {
+    public:
+        Snapshot();
+        Snapshot(const Snapshot& other);
+        Snapshot(Snapshot&& other);
+        Snapshot& operator=(Snapshot other);
+        ~Snapshot();
+
+        bool empty() const;
+        std::size_t size() const;
+        int height() const;
+        // The item with the given key, or NULL if there is none
+        const std::pair<const Key, Value>* find(const Key& key) const;
+        template<typename Fn>
+        void for_each(Fn fn) const;
+        template<typename Fn>
+        void for_each_range(const Key& lo, const Key& hi, Fn fn) const;
+
+    private:
+        friend class PersistentAVLTree<Key, Value>;
+        Snapshot(const PersistentNode<Key, Value>* root, std::size_t size);
+
+        const PersistentNode<Key, Value>* root_;
+        std::size_t size_;
+    };
+
+    PersistentAVLTree();
+    ~PersistentAVLTree();
+
+    bool empty() const;
+    std::size_t size() const;
+    int height() const;
+    void clear();
+
+    // Inserts the item, or replaces the value if the key is present
+    void insert(const std::pair<const Key, Value>& item);
+    void remove(const Key& key);
+    const std::pair<const Key, Value>* find(const Key& key) const;
+    template<typename Fn>
+    void for_each(Fn fn) const;
+    template<typename Fn>
+    void for_each_range(const Key& lo, const Key& hi, Fn fn) const;
+
+    // The current version, in O(1)
+    Snapshot snapshot() const;
+
+    // Bytes of node memory used by the current version, and the bytes that
+    // s keeps alive beyond it: the nodes of s that this tree no longer
+    // shares. A node that several snapshots hold, but the tree does not,
+    // counts for each of them. Costs O(k log n) for k such nodes.
+    std::size_t memoryUsage() const;
+    std::size_t retainedMemory(const Snapshot& s) const;
+
+private:
+    // Not copyable; take a snapshot() instead
+    PersistentAVLTree(const PersistentAVLTree<Key, Value>& other);
+    PersistentAVLTree<Key, Value>& operator=(const PersistentAVLTree<Key, Value>& other);
+
+    typedef PersistentNode<Key, Value> NodeType;
+
+    static int heightOf(const NodeType* n);
+    static const NodeType* balance(const std::pair<const Key, Value>& item, const NodeType* left, const NodeType* right);
+    static const NodeType* insertInto(const NodeType* n, const std::pair<const Key, Value>& item, bool& added);
+    static const NodeType* removeFrom(const NodeType* n, const Key& key, bool& removed);
+    static const NodeType* removeSmallest(const NodeType* n, const NodeType*& smallest);
+    static const NodeType* findIn(const NodeType* n, const Key& key);
+    void replaceRoot(const NodeType* root);
+
+    template<typename Fn>
+    static void visit(const NodeType* root, const Key* lo, const Key* hi, Fn& fn);
+
+    const NodeType* root_;
+    std::size_t size_;
+};
+
+/*
+  -------------------------------------------------
+  Begin implementations for the Snapshot class.
+  -------------------------------------------------
+*/
+
+/**
+* Default constructor, for a snapshot of an empty tree.
+*/
+template<typename Key, typename Value>
+PersistentAVLTree<Key, Value>::Snapshot::Snapshot() :
+    root_(NULL),
+    size_(0)
+{
+
+}
+
+template<typename Key, typename Value>
+PersistentAVLTree<Key, Value>::Snapshot::Snapshot(const PersistentNode<Key, Value>* root, std::size_t size) :
+    root_(root),
+    size_(size)
+{
+    NodeType::acquire(root_);
+}
+
+template<typename Key, typename Value>
+PersistentAVLTree<Key, Value>::Snapshot::Snapshot(const Snapshot& other) :
+    root_(other.root_),
+    size_(other.size_)
+{
+    NodeType::acquire(root_);
+}
+
+template<typename Key, typename Value>
+PersistentAVLTree<Key, Value>::Snapshot::Snapshot(Snapshot&& other) :
+    root_(other.root_),
+    size_(other.size_)
+{
+    other.root_ = NULL;
+    other.size_ = 0;
+}
+
+/**
+* Assignment, which takes other by value so copies and moves share it.
+*/
+template<typename Key, typename Value>
+typename PersistentAVLTree<Key, Value>::Snapshot&
+PersistentAVLTree<Key, Value>::Snapshot::operator=(Snapshot other)
+{
+    std::swap(root_, other.root_);
+    std::swap(size_, other.size_);
+    return *this;
+}
+
+/**
+* Destructor, which frees whatever nodes no other version still uses.
+*/
+template<typename Key, typename Value>
+PersistentAVLTree<Key, Value>::Snapshot::~Snapshot()
+{
+    NodeType::release(root_);
+}
+
+template<typename Key, typename Value>
+bool PersistentAVLTree<Key, Value>::Snapshot::empty() const
+{
+    return root_ == NULL;
+}
+
+template<typename Key, typename Value>
+std::size_t PersistentAVLTree<Key, Value>::Snapshot::size() const
+{
+    return size_;
+}
+
+template<typename Key, typename Value>
+int PersistentAVLTree<Key, Value>::Snapshot::height() const
+{
+    return heightOf(root_);
+}
+
+template<typename Key, typename Value>
+const std::pair<const Key, Value>* PersistentAVLTree<Key, Value>::Snapshot::find(const Key& key) const
+{
+    const NodeType* n = findIn(root_, key);
+    return n == NULL ? NULL : &n->getItem();
+}
+
+/**
+* Calls fn(const std::pair<const Key, Value>&) on every item in key order.
+*/
+template<typename Key, typename Value>
+template<typename Fn>
+void PersistentAVLTree<Key, Value>::Snapshot::for_each(Fn fn) const
+{
+    visit(root_, NULL, NULL, fn);
+}
+
+/**
+* Calls fn on the items with keys in [lo, hi) in key order.
+*/
+template<typename Key, typename Value>
+template<typename Fn>
+void PersistentAVLTree<Key, Value>::Snapshot::for_each_range(const Key& lo, const Key& hi, Fn fn) const
+{
+    visit(root_, &lo, &hi, fn);
+}
+
+/*
+  -----------------------------------------------
+  End implementations for the Snapshot class.
+  -----------------------------------------------
+*/
+
+/*
+  -------------------------------------------------
+  Begin implementations for the PersistentAVLTree class.
+  -------------------------------------------------
+*/
+
+template<typename Key, typename Value>
+PersistentAVLTree<Key, Value>::PersistentAVLTree() :
+    root_(NULL),
+    size_(0)
+{
+
+}
+
+/**
+* Destructor, which frees the nodes no snapshot still uses.
+*/
+template<typename Key, typename Value>
+PersistentAVLTree<Key, Value>::~PersistentAVLTree()
+{
+    NodeType::release(root_);
+}
+
+template<typename Key, typename Value>
+bool PersistentAVLTree<Key, Value>::empty() const
+{
+    return root_ == NULL;
+}
+
+template<typename Key, typename Value>
+std::size_t PersistentAVLTree<Key, Value>::size() const
+{
+    return size_;
+}
+
+template<typename Key, typename Value>
+int PersistentAVLTree<Key, Value>::height() const
+{
+    return heightOf(root_);
+}
+
+template<typename Key, typename Value>
+void PersistentAVLTree<Key, Value>::clear()
+{
+    replaceRoot(NULL);
+    size_ = 0;
+}
+
+/**
+* Inserts the item, copying the nodes on the path to it.
+*/
+template<typename Key, typename Value>
+void PersistentAVLTree<Key, Value>::insert(const std::pair<const Key, Value>& item)
+{
+    bool added = false;
+    replaceRoot(insertInto(root_, item, added));
+    if(added) {
+        ++size_;
+    }
+}
+
+/**
+* Removes the key, copying the nodes on the path to it. A missing key
+* copies nothing.
+*/
+template<typename Key, typename Value>
+void PersistentAVLTree<Key, Value>::remove(const Key& key)
+{
+    bool removed = false;
+    const NodeType* root = removeFrom(root_, key, removed);
+    if(removed) {
+        replaceRoot(root);
+        --size_;
+    }
+}
+
+template<typename Key, typename Value>
+const std::pair<const Key, Value>* PersistentAVLTree<Key, Value>::find(const Key& key) const
+{
+    const NodeType* n = findIn(root_, key);
+    return n == NULL ? NULL : &n->getItem();
+}
+
+template<typename Key, typename Value>
+template<typename Fn>
+void PersistentAVLTree<Key, Value>::for_each(Fn fn) const
+{
+    visit(root_, NULL, NULL, fn);
+}
+
+template<typename Key, typename Value>
+template<typename Fn>
+void PersistentAVLTree<Key, Value>::for_each_range(const Key& lo, const Key& hi, Fn fn) const
+{
+    visit(root_, &lo, &hi, fn);
+}
+
+template<typename Key, typename Value>
+typename PersistentAVLTree<Key, Value>::Snapshot PersistentAVLTree<Key, Value>::snapshot() const
+{
+    return Snapshot(root_, size_);
+}
+
+template<typename Key, typename Value>
+std::size_t PersistentAVLTree<Key, Value>::memoryUsage() const
+{
+    return size_ * sizeof(NodeType);
+}
+
+/**
+* Walks the nodes of s, stopping at any that the current version also
+* reaches. Nodes never change, so the tree holds the same pointer for a
+* key exactly when it shares that node's whole subtree with s.
+*/
+template<typename Key, typename Value>
+std::size_t PersistentAVLTree<Key, Value>::retainedMemory(const Snapshot& s) const
+{
+    std::size_t nodes = 0;
+    std::vector<const NodeType*> pending;
+    if(s.root_ != NULL) {
+        pending.push_back(s.root_);
+    }
+    while(!pending.empty()) {
+        const NodeType* n = pending.back();
+        pending.pop_back();
+        if(findIn(root_, n->getKey()) == n) {
+            continue;
+        }
+        ++nodes;
+        if(n->getLeft() != NULL) {
+            pending.push_back(n->getLeft());
+        }
+        if(n->getRight() != NULL) {
+            pending.push_back(n->getRight());
+        }
+    }
+    return nodes * sizeof(NodeType);
+}
+
+// helper function that swaps in a new root, taking its reference before
+// dropping the old one, which may share most of its nodes
+template<typename Key, typename Value>
+void PersistentAVLTree<Key, Value>::replaceRoot(const NodeType* root)
+{
+    NodeType::acquire(root);
+    NodeType::release(root_);
+    root_ = root;
+}
+
+template<typename Key, typename Value>
+int PersistentAVLTree<Key, Value>::heightOf(const NodeType* n)
+{
+    return n == NULL ? 0 : n->getHeight();
+}
+
+/**
+* Builds a node for item over left and right, whose heights differ by at
+* most two, rotating once or twice if they differ by two. left and right
+* may be new nodes that the rotation takes apart; those are freed here.
+*/
+template<typename Key, typename Value>
+const PersistentNode<Key, Value>* PersistentAVLTree<Key, Value>::balance(const std::pair<const Key, Value>& item,
+                                                                        const NodeType* left, const NodeType* right)
+{
+    int leftHeight = heightOf(left);
+    int rightHeight = heightOf(right);
+    const NodeType* result;
+    if(leftHeight > rightHeight + 1) {
+        const NodeType* inner = left->getRight();
+        if(heightOf(left->getLeft()) >= heightOf(inner)) {
+            result = new NodeType(left->getItem(), left->getLeft(), new NodeType(item, inner, right));
+        }
+        else {
+            result = new NodeType(inner->getItem(),
+                                  new NodeType(left->getItem(), left->getLeft(), inner->getLeft()),
+                                  new NodeType(item, inner->getRight(), right));
+        }
+    }
+    else if(rightHeight > leftHeight + 1) {
+        const NodeType* inner = right->getLeft();
+        if(heightOf(right->getRight()) >= heightOf(inner)) {
+            result = new NodeType(right->getItem(), new NodeType(item, left, inner), right->getRight());
+        }
+        else {
+            result = new NodeType(inner->getItem(),
+                                  new NodeType(item, left, inner->getLeft()),
+                                  new NodeType(right->getItem(), inner->getRight(), right->getRight()));
+        }
+    }
+    else {
+        return new NodeType(item, left, right);
+    }
+    NodeType::releaseIfUnused(left);
+    NodeType::releaseIfUnused(right);
+    return result;
+}
+
+/**
+* Returns the root of n with item inserted, built from new copies of the
+* nodes on the path and the untouched subtrees of n.
+*/
+template<typename Key, typename Value>
+const PersistentNode<Key, Value>* PersistentAVLTree<Key, Value>::insertInto(const NodeType* n, const std::pair<const Key, Value>& item,
+                                                                           bool& added)
+{
+    if(n == NULL) {
+        added = true;
+        return new NodeType(item, NULL, NULL);
+    }
+    if(item.first < n->getKey()) {
+        return balance(n->getItem(), insertInto(n->getLeft(), item, added), n->getRight());
+    }
+    else if(n->getKey() < item.first) {
+        return balance(n->getItem(), n->getLeft(), insertInto(n->getRight(), item, added));
+    }
+    return new NodeType(item, n->getLeft(), n->getRight());
+}
+
+/**
+* Returns the root of n without key. When key is missing, returns n
+* itself and builds nothing.
+*/
+template<typename Key, typename Value>
+const PersistentNode<Key, Value>* PersistentAVLTree<Key, Value>::removeFrom(const NodeType* n, const Key& key, bool& removed)
+{
+    if(n == NULL) {
+        return NULL;
+    }
+    if(key < n->getKey()) {
+        const NodeType* left = removeFrom(n->getLeft(), key, removed);
+        return removed ? balance(n->getItem(), left, n->getRight()) : n;
+    }
+    else if(n->getKey() < key) {
+        const NodeType* right = removeFrom(n->getRight(), key, removed);
+        return removed ? balance(n->getItem(), n->getLeft(), right) : n;
+    }
+    removed = true;
+    if(n->getLeft() == NULL) {
+        return n->getRight();
+    }
+    if(n->getRight() == NULL) {
+        return n->getLeft();
+    }
+    // the successor takes the removed node's place
+    const NodeType* smallest = NULL;
+    const NodeType* right = removeSmallest(n->getRight(), smallest);
+    return balance(smallest->getItem(), n->getLeft(), right);
+}
+
+// helper function that returns n without its smallest node, which it
+// points smallest at
+template<typename Key, typename Value>
+const PersistentNode<Key, Value>* PersistentAVLTree<Key, Value>::removeSmallest(const NodeType* n, const NodeType*& smallest)
+{
+    if(n->getLeft() == NULL) {
+        smallest = n;
+        return n->getRight();
+    }
+    return balance(n->getItem(), removeSmallest(n->getLeft(), smallest), n->getRight());
+}
+
+template<typename Key, typename Value>
+const PersistentNode<Key, Value>* PersistentAVLTree<Key, Value>::findIn(const NodeType* n, const Key& key)
+{
+    while(n != NULL) {
+        if(key < n->getKey()) {
+            n = n->getLeft();
+        }
+        else if(n->getKey() < key) {
+            n = n->getRight();
+        }
+        else {
+            return n;
+        }
+    }
+    return NULL;
+}
+
+/**
+* In-order walk of root calling fn on the items with keys in [*lo, *hi);
+* a NULL bound is open. Nodes have no parent links, so the path is kept on
+* a stack, with each right subtree prefetched as its parent is pushed.
+*/
+template<typename Key, typename Value>
+template<typename Fn>
+void PersistentAVLTree<Key, Value>::visit(const NodeType* root, const Key* lo, const Key* hi, Fn& fn)
+{
+    if(lo != NULL && hi != NULL && !(*lo < *hi)) {
+        return;
+    }
+    std::vector<const NodeType*> path;
+    path.reserve(64);
+    const NodeType* current = root;
+    while(current != NULL) {
+        if(lo != NULL && current->getKey() < *lo) {
+            current = current->getRight();
+        }
+        else {
+            BST_PREFETCH(current->getRight());
+            path.push_back(current);
+            current = current->getLeft();
+        }
+    }
+    while(!path.empty()) {
+        current = path.back();
+        path.pop_back();
+        if(hi != NULL && !(current->getKey() < *hi)) {
+            return;
+        }
+        fn(current->getItem());
+        for(current = current->getRight(); current != NULL; current = current->getLeft()) {
+            BST_PREFETCH(current->getRight());
+            path.push_back(current);
+        }
+    }
+}
+
+/*
+  -----------------------------------------------
+  End implementations for the PersistentAVLTree class.
+  -----------------------------------------------
+*/
+
+#endif
@@ -0,0 +1,169 @@
+#include <iostream>
+#include <map>
+#include <random>
+#include <thread>
+#include <vector>
+#include "sharded_avl.h"
+#include "test_check.h"
+
+using namespace std;
+
+// Checks that iterating m gives exactly the items of model, in order
+void checkSame(const ShardedAVLMap<int, int>& m, const map<int, int>& model)
+{
+    CHECK(m.size() == model.size());
+    map<int, int>::const_iterator expected = model.begin();
+    for(ShardedAVLMap<int, int>::iterator it = m.begin(); it != m.end(); ++it, ++expected) {
+        CHECK(expected != model.end());
+        CHECK(it->first == expected->first && it->second == expected->second);
+    }
+    CHECK(expected == model.end());
+    size_t total = 0;
+    vector<size_t> sizes = m.shardSizes();
+    for(size_t i = 0; i < sizes.size(); ++i) {
+        total += sizes[i];
+    }
+    CHECK(total == model.size());
+}
+
+// Ascending inserts, then removal from the top down, which empties the
+// low shards' neighbours first and once crashed a cut move
+void testSkewedRemoval()
+{
+    ShardedAVLMap<int, int> m(4);
+    map<int, int> model;
+    for(int i = 0; i < 200000; ++i) {
+        m.insert(make_pair(i, i));
+        model[i] = i;
+    }
+    checkSame(m, model);
+    for(int i = 199999; i >= 0; --i) {
+        m.remove(i);
+        model.erase(i);
+        if(i % 20000 == 0) {
+            checkSame(m, model);
+        }
+    }
+    CHECK(m.empty());
+    CHECK(m.begin() == m.end());
+}
+
+// Descending inserts, then removal from the bottom up
+void testSkewedInsert()
+{
+    ShardedAVLMap<int, int> m(8);
+    map<int, int> model;
+    for(int i = 150000; i > 0; --i) {
+        m.insert(make_pair(i, -i));
+        model[i] = -i;
+    }
+    checkSame(m, model);
+    CHECK(m.rebalances() > 0);
+    for(int i = 1; i <= 120000; ++i) {
+        m.remove(i);
+        model.erase(i);
+    }
+    checkSame(m, model);
+    for(int i = 0; i < 50000; ++i) {
+        m.insert(make_pair(i, i));
+        model[i] = i;
+    }
+    checkSame(m, model);
+}
+
+// Random operations on a key space that drifts upwards, against std::map
+void testRandomDrift()
+{
+    ShardedAVLMap<int, int> m(6);
+    map<int, int> model;
+    mt19937 rng(23);
+    for(int round = 0; round < 400000; ++round) {
+        int base = round / 4;
+        int key = base + static_cast<int>(rng() % 5000);
+        int value;
+        switch(rng() % 4) {
+        case 0:
+        case 1:
+            m.insert(make_pair(key, round));
+            model[key] = round;
+            break;
+        case 2:
+            m.remove(key);
+            model.erase(key);
+            break;
+        default:
+            CHECK(m.find(key, value) == (model.count(key) == 1));
+            if(model.count(key) == 1) {
+                CHECK(value == model[key]);
+            }
+            // drop what fell behind the window
+            m.remove(base - 1);
+            model.erase(base - 1);
+            break;
+        }
+        if(round % 50000 == 0) {
+            checkSame(m, model);
+        }
+    }
+    checkSame(m, model);
+    m.clear();
+    model.clear();
+    checkSame(m, model);
+}
+
+// Writers on interleaved keys while readers iterate; each reader must see
+// strictly increasing keys, and the final contents must be exact
+void testConcurrent()
+{
+    static const int WRITERS = 4;
+    static const int PER_WRITER = 40000;
+    ShardedAVLMap<int, int> m(8);
+    vector<thread> threads;
+    for(int w = 0; w < WRITERS; ++w) {
+        threads.push_back(thread([&m, w]() {
+            for(int i = 0; i < PER_WRITER; ++i) {
+                m.insert(make_pair(i * WRITERS + w, w));
+            }
+            // remove the odd half again
+            for(int i = 1; i < PER_WRITER; i += 2) {
+                m.remove(i * WRITERS + w);
+            }
+        }));
+    }
+    bool ordered = true;
+    thread reader([&m, &ordered]() {
+        for(int pass = 0; pass < 20; ++pass) {
+            bool first = true;
+            int last = 0;
+            for(ShardedAVLMap<int, int>::iterator it = m.begin(); it != m.end(); ++it) {
+                if(!first && !(last < it->first)) {
+                    ordered = false;
+                }
+                first = false;
+                last = it->first;
+            }
+        }
+    });
+    for(size_t i = 0; i < threads.size(); ++i) {
+        threads[i].join();
+    }
+    reader.join();
+    CHECK(ordered);
+    map<int, int> model;
+    for(int w = 0; w < WRITERS; ++w) {
+        for(int i = 0; i < PER_WRITER; i += 2) {
+            model[i * WRITERS + w] = w;
+        }
+    }
+    checkSame(m, model);
+}
+
+int main()
+{
+    testSkewedRemoval();
+    testSkewedInsert();
+    testRandomDrift();
+    testConcurrent();
+    cout << "sharded-avl-test: all passed" << endl;
+    return 0;
+}
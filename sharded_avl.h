@@ -0,0 +1,663 @@
+#ifndef SHARDED_AVL_H
+#define SHARDED_AVL_H
+
+#include <cstddef>
+#include <utility>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <iterator>
+#include <algorithm>
+#include <cassert>
+#include "avlbst.h"
+#include "epoch.h"
+
+/**
+* An ordered map for write-heavy workloads shared between threads. The key
+* space is cut into ranges, each held by its own AVLTree behind its own
+* mutex, so writers to different ranges never wait for one another.
+*
+* The cuts move on their own. Every REBALANCE_INTERVAL changes a shard
+* checks the cuts on both of its sides against an even spread, where the
+* cut after shard i has (i + 1) / shardCount() of the items below it. A
+* cut that is off by more than MIN_IMBALANCE plus an eighth of a shard is
+* moved to its target with one select(), one split() and one join(), in
+* O(log n) however many items change shards; the shard trees track their
+* subtree sizes for the select(). The shard that took the items then
+* checks its other cut, so a surplus travels as far as it needs to. An
+* empty map starts with every range but the first empty, and the ranges
+* fill as the data grows.
+*
+* A key is routed to its shard through an immutable table of the cuts. A
+* move publishes a new table while it still holds both shard locks, and
+* the old table is freed through an EpochManager once no thread can still
+* be reading it. Each shard also keeps its own bounds, which the operation
+* checks under the shard lock, so a stale table only costs a retry.
+*
+* Iteration is in global key order. It is weakly consistent: it visits
+* every key that is present for the whole iteration exactly once, and may
+* or may not see keys changed meanwhile.
+*/
+template <typename Key, typename Value>
+class ShardedAVLMap
+{
+public:
+    static const std::size_t DEFAULT_SHARDS = 16;
+    // Cuts this close to their target are never worth a move
+    static const std::size_t MIN_IMBALANCE = 1024;
+    // Changes to a shard between checks of its balance
+    static const std::size_t REBALANCE_INTERVAL = 64;
+
+    class iterator;
+
+    explicit ShardedAVLMap(std::size_t shards = DEFAULT_SHARDS);
+    ~ShardedAVLMap();
+
+    // Safe to call from any number of threads at once
+    bool find(const Key& key, Value& value) const;
+    bool contains(const Key& key) const;
+    // Inserts the item, or replaces the value if the key is present
+    void insert(const std::pair<const Key, Value>& item);
+    void remove(const Key& key);
+    void clear();
+    std::size_t size() const;
+    bool empty() const;
+
+    iterator begin() const;
+    iterator end() const;
+
+    std::size_t shardCount() const;
+    // The item count of each shard, in key order
+    std::vector<std::size_t> shardSizes() const;
+    // The number of times a cut has moved
+    std::size_t rebalances() const;
+
+    /**
+    * A forward iterator over copies of the items. It fetches up to BATCH
+    * items at a time under the shard locks and then reads from its own
+    * buffer, so no lock is held between increments.
+    */
+    class iterator
+    {
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef std::pair<Key, Value> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const value_type* pointer;
+        typedef const value_type& reference;
+
+        iterator();
+
+        reference operator*() const;
+        pointer operator->() const;
+        iterator& operator++();
+        iterator operator++(int);
+        bool operator==(const iterator& rhs) const;
+        bool operator!=(const iterator& rhs) const;
+
+    private:
+        friend class ShardedAVLMap<Key, Value>;
+        static const std::size_t BATCH = 256;
+
+        explicit iterator(const ShardedAVLMap<Key, Value>* map);
+        void fill(const Key* after);
+
+        const ShardedAVLMap<Key, Value>* map_;
+        std::vector<value_type> items_;
+        std::size_t index_;
+    };
+
+protected:
+    // sizes let a move find its cut with select() instead of a walk
+    typedef AVLTree<Key, Value, SubtreeSize> Tree;
+
+    // One end of a shard's range; an infinite upper end is +infinity, and
+    // so is an infinite lower end except on the first shard
+    struct Bound {
+        Key key;
+        bool infinite;
+    };
+    struct Shard {
+        std::mutex mutex;
+        Tree tree;
+        Bound lower;
+        Bound upper;
+        // mirrors the tree's item count for lock-free reads
+        std::atomic<std::size_t> count;
+        // changes since the map was built, to pace the balance checks
+        std::size_t changes;
+        // keeps the next shard's lock off this shard's cache lines
+        char padding[64];
+    };
+    // The lower bound of every shard, shared with readers and never changed
+    struct Routing {
+        std::vector<Bound> lower;
+    };
+
+    std::size_t lockShardFor(const Key& key) const;
+    bool covers(std::size_t index, const Key& key) const;
+    void maybeRebalance(std::size_t index);
+    void rebalanceFrom(std::size_t index);
+    std::size_t moveCut(std::size_t index);
+    void moveUp(Shard& from, Shard& to, std::size_t count);
+    void moveDown(Shard& from, Shard& to, std::size_t count);
+    void publishCut(std::size_t index, const Key& key);
+    static void appendTree(Tree& left, Tree& right);
+    static void destroyRouting(void* routing, void* context);
+
+    std::vector<Shard*> shards_;
+    std::atomic<Routing*> routing_;
+    // serializes moves, and with them changes to routing_
+    std::mutex rebalanceMutex_;
+    std::atomic<std::size_t> rebalances_;
+    mutable EpochManager epochs_;
+
+private:
+    // Not copyable
+    ShardedAVLMap(const ShardedAVLMap<Key, Value>& other);
+    ShardedAVLMap<Key, Value>& operator=(const ShardedAVLMap<Key, Value>& other);
+};
+
+/*
+  -------------------------------------------------
+  Begin implementations for the ShardedAVLMap class.
+  -------------------------------------------------
+*/
+
+/**
+* Constructor. The first shard takes every key until the first move.
+*/
+template<typename Key, typename Value>
+ShardedAVLMap<Key, Value>::ShardedAVLMap(std::size_t shards) :
+    routing_(NULL),
+    rebalances_(0)
+{
+    if(shards == 0) {
+        shards = 1;
+    }
+    Routing* routing = new Routing;
+    for(std::size_t i = 0; i < shards; ++i) {
+        Shard* shard = new Shard;
+        shard->lower.key = Key();
+        shard->lower.infinite = true;
+        shard->upper.key = Key();
+        shard->upper.infinite = true;
+        shard->count.store(0, std::memory_order_relaxed);
+        shard->changes = 0;
+        shards_.push_back(shard);
+        routing->lower.push_back(shard->lower);
+    }
+    routing_.store(routing, std::memory_order_release);
+}
+
+/**
+* Destructor. No other thread may still be using the map.
+*/
+template<typename Key, typename Value>
+ShardedAVLMap<Key, Value>::~ShardedAVLMap()
+{
+    epochs_.drain();
+    delete routing_.load(std::memory_order_relaxed);
+    for(std::size_t i = 0; i < shards_.size(); ++i) {
+        delete shards_[i];
+    }
+}
+
+template<typename Key, typename Value>
+bool ShardedAVLMap<Key, Value>::find(const Key& key, Value& value) const
+{
+    Shard& shard = *shards_[lockShardFor(key)];
+    std::lock_guard<std::mutex> guard(shard.mutex, std::adopt_lock);
+    typename Tree::iterator it = shard.tree.find(key);
+    if(it == shard.tree.end()) {
+        return false;
+    }
+    value = it->second;
+    return true;
+}
+
+template<typename Key, typename Value>
+bool ShardedAVLMap<Key, Value>::contains(const Key& key) const
+{
+    Shard& shard = *shards_[lockShardFor(key)];
+    std::lock_guard<std::mutex> guard(shard.mutex, std::adopt_lock);
+    return shard.tree.find(key) != shard.tree.end();
+}
+
+template<typename Key, typename Value>
+void ShardedAVLMap<Key, Value>::insert(const std::pair<const Key, Value>& item)
+{
+    std::size_t index = lockShardFor(item.first);
+    bool check = false;
+    {
+        Shard& shard = *shards_[index];
+        std::lock_guard<std::mutex> guard(shard.mutex, std::adopt_lock);
+        if(shard.tree.insert_or_assign(item.first, item.second).second) {
+            shard.count.store(shard.count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            check = (++shard.changes % REBALANCE_INTERVAL == 0);
+        }
+    }
+    if(check) {
+        maybeRebalance(index);
+    }
+}
+
+template<typename Key, typename Value>
+void ShardedAVLMap<Key, Value>::remove(const Key& key)
+{
+    std::size_t index = lockShardFor(key);
+    bool check;
+    {
+        Shard& shard = *shards_[index];
+        std::lock_guard<std::mutex> guard(shard.mutex, std::adopt_lock);
+        if(shard.tree.find(key) == shard.tree.end()) {
+            return;
+        }
+        shard.tree.remove(key);
+        shard.count.store(shard.count.load(std::memory_order_relaxed) - 1, std::memory_order_relaxed);
+        check = (++shard.changes % REBALANCE_INTERVAL == 0);
+    }
+    if(check) {
+        maybeRebalance(index);
+    }
+}
+
+/**
+* Empties every shard. The cuts stay where they are.
+*/
+template<typename Key, typename Value>
+void ShardedAVLMap<Key, Value>::clear()
+{
+    for(std::size_t i = 0; i < shards_.size(); ++i) {
+        std::lock_guard<std::mutex> guard(shards_[i]->mutex);
+        shards_[i]->tree.clear();
+        shards_[i]->count.store(0, std::memory_order_relaxed);
+    }
+}
+
+/**
+* Returns the number of items. Concurrent changes may or may not be counted.
+*/
+template<typename Key, typename Value>
+std::size_t ShardedAVLMap<Key, Value>::size() const
+{
+    std::size_t total = 0;
+    for(std::size_t i = 0; i < shards_.size(); ++i) {
+        total += shards_[i]->count.load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+template<typename Key, typename Value>
+bool ShardedAVLMap<Key, Value>::empty() const
+{
+    return size() == 0;
+}
+
+template<typename Key, typename Value>
+typename ShardedAVLMap<Key, Value>::iterator ShardedAVLMap<Key, Value>::begin() const
+{
+    return iterator(this);
+}
+
+template<typename Key, typename Value>
+typename ShardedAVLMap<Key, Value>::iterator ShardedAVLMap<Key, Value>::end() const
+{
+    return iterator();
+}
+
+template<typename Key, typename Value>
+std::size_t ShardedAVLMap<Key, Value>::shardCount() const
+{
+    return shards_.size();
+}
+
+template<typename Key, typename Value>
+std::vector<std::size_t> ShardedAVLMap<Key, Value>::shardSizes() const
+{
+    std::vector<std::size_t> sizes;
+    for(std::size_t i = 0; i < shards_.size(); ++i) {
+        sizes.push_back(shards_[i]->count.load(std::memory_order_relaxed));
+    }
+    return sizes;
+}
+
+template<typename Key, typename Value>
+std::size_t ShardedAVLMap<Key, Value>::rebalances() const
+{
+    return rebalances_.load(std::memory_order_relaxed);
+}
+
+/**
+* Locks the shard whose range holds key and returns its index. The routing
+* table is only read under an epoch guard, and a table that went stale
+* before the lock was taken is caught by the shard's own bounds.
+*/
+template<typename Key, typename Value>
+std::size_t ShardedAVLMap<Key, Value>::lockShardFor(const Key& key) const
+{
+    while(true) {
+        std::size_t index;
+        {
+            EpochManager::Guard guard(epochs_);
+            const std::vector<Bound>& lower = routing_.load(std::memory_order_acquire)->lower;
+            // the last shard whose lower bound is not above key
+            std::size_t lo = 1;
+            std::size_t hi = lower.size();
+            while(lo < hi) {
+                std::size_t mid = lo + (hi - lo) / 2;
+                if(!lower[mid].infinite && !(key < lower[mid].key)) {
+                    lo = mid + 1;
+                }
+                else {
+                    hi = mid;
+                }
+            }
+            index = lo - 1;
+        }
+        shards_[index]->mutex.lock();
+        if(covers(index, key)) {
+            return index;
+        }
+        shards_[index]->mutex.unlock();
+        std::this_thread::yield();
+    }
+}
+
+// helper function that checks key against a shard's bounds, under its lock
+template<typename Key, typename Value>
+bool ShardedAVLMap<Key, Value>::covers(std::size_t index, const Key& key) const
+{
+    const Shard& shard = *shards_[index];
+    bool aboveLower = (index == 0) || (!shard.lower.infinite && !(key < shard.lower.key));
+    bool belowUpper = shard.upper.infinite || key < shard.upper.key;
+    return aboveLower && belowUpper;
+}
+
+/**
+* Corrects the cuts on either side of the shard at index.
+*/
+template<typename Key, typename Value>
+void ShardedAVLMap<Key, Value>::maybeRebalance(std::size_t index)
+{
+    if(index > 0) {
+        rebalanceFrom(index - 1);
+    }
+    if(index + 1 < shards_.size()) {
+        rebalanceFrom(index);
+    }
+}
+
+/**
+* Corrects the cut after the shard at index, then the next cut on the far
+* side of whichever shard took items in, and so on while there is drift.
+*/
+template<typename Key, typename Value>
+void ShardedAVLMap<Key, Value>::rebalanceFrom(std::size_t index)
+{
+    while(index + 1 < shards_.size()) {
+        index = moveCut(index);
+    }
+}
+
+/**
+* Moves the cut between the shards at index and index + 1 to where an even
+* spread would put it: after (index + 1) / shardCount() of the items. Only
+* the items between the two positions change shards. Returns the next cut
+* to check, on the far side of the shard that took the items, or
+* shardCount() if the cut is close enough or another move is running.
+*/
+template<typename Key, typename Value>
+std::size_t ShardedAVLMap<Key, Value>::moveCut(std::size_t index)
+{
+    std::unique_lock<std::mutex> serial(rebalanceMutex_, std::try_to_lock);
+    if(!serial.owns_lock()) {
+        return shards_.size();
+    }
+    // locks are always taken in key order
+    Shard& left = *shards_[index];
+    Shard& right = *shards_[index + 1];
+    std::lock_guard<std::mutex> leftGuard(left.mutex);
+    std::lock_guard<std::mutex> rightGuard(right.mutex);
+    // other shards may change meanwhile, which only blurs the target
+    std::size_t before = 0;
+    std::size_t total = 0;
+    for(std::size_t i = 0; i < shards_.size(); ++i) {
+        std::size_t count = shards_[i]->count.load(std::memory_order_relaxed);
+        if(i <= index) {
+            before += count;
+        }
+        total += count;
+    }
+    std::size_t target = total * (index + 1) / shards_.size();
+    std::size_t slack = MIN_IMBALANCE + total / shards_.size() / 8;
+    std::size_t leftCount = left.count.load(std::memory_order_relaxed);
+    std::size_t rightCount = right.count.load(std::memory_order_relaxed);
+    std::size_t next;
+    if(before > target + slack && leftCount > 0) {
+        // the surplus may sit further left, behind an empty shard; the
+        // cuts on that side are corrected when their shards next change
+        std::size_t moved = std::min(before - target, leftCount);
+        moveUp(left, right, moved);
+        leftCount -= moved;
+        rightCount += moved;
+        next = index + 1;
+    }
+    else if(before + slack < target && rightCount > 1) {
+        // one item stays behind to give the new cut its key
+        std::size_t moved = std::min(target - before, rightCount - 1);
+        moveDown(right, left, moved);
+        leftCount += moved;
+        rightCount -= moved;
+        next = (index > 0) ? index - 1 : shards_.size();
+    }
+    else {
+        return shards_.size();
+    }
+    left.count.store(leftCount, std::memory_order_relaxed);
+    right.count.store(rightCount, std::memory_order_relaxed);
+    // readers routed by the old table find out under the shard locks
+    publishCut(index + 1, right.lower.key);
+    rebalances_.fetch_add(1, std::memory_order_relaxed);
+    return next;
+}
+
+/**
+* Moves the count largest items of from to the front of to, its right
+* neighbour, and sets the cut to the smallest of them.
+*/
+template<typename Key, typename Value>
+void ShardedAVLMap<Key, Value>::moveUp(Shard& from, Shard& to, std::size_t count)
+{
+    assert(count > 0 && count <= from.tree.size());
+    Key cut = from.tree.select(from.tree.size() - count)->first;
+    Tree moved;
+    from.tree.split(cut, moved);
+    appendTree(moved, to.tree);
+    to.tree = std::move(moved);
+    from.upper.key = cut;
+    from.upper.infinite = false;
+    to.lower = from.upper;
+}
+
+/**
+* Moves the count smallest items of from to the back of to, its left
+* neighbour, and sets the cut to the smallest item left in from.
+*/
+template<typename Key, typename Value>
+void ShardedAVLMap<Key, Value>::moveDown(Shard& from, Shard& to, std::size_t count)
+{
+    assert(count > 0 && count < from.tree.size());
+    Key cut = from.tree.select(count)->first;
+    Tree kept;
+    from.tree.split(cut, kept);
+    appendTree(to.tree, from.tree);
+    from.tree = std::move(kept);
+    to.upper.key = cut;
+    to.upper.infinite = false;
+    from.lower = to.upper;
+}
+
+// helper function that replaces the routing table with one where the
+// shard at index starts at key, retiring the old table
+template<typename Key, typename Value>
+void ShardedAVLMap<Key, Value>::publishCut(std::size_t index, const Key& key)
+{
+    Routing* old = routing_.load(std::memory_order_relaxed);
+    Routing* routing = new Routing(*old);
+    routing->lower[index].key = key;
+    routing->lower[index].infinite = false;
+    routing_.store(routing, std::memory_order_release);
+    epochs_.retire(old, &ShardedAVLMap<Key, Value>::destroyRouting, NULL, sizeof(Routing));
+}
+
+// helper function that appends the items of right, all greater than those
+// of left, to left in O(log n), leaving right empty
+template<typename Key, typename Value>
+void ShardedAVLMap<Key, Value>::appendTree(Tree& left, Tree& right)
+{
+    if(right.empty()) {
+        return;
+    }
+    std::pair<const Key, Value> pivot = right.front();
+    right.pop_min();
+    left.join(left, pivot, right);
+}
+
+template<typename Key, typename Value>
+void ShardedAVLMap<Key, Value>::destroyRouting(void* routing, void*)
+{
+    delete static_cast<Routing*>(routing);
+}
+
+/*
+  -----------------------------------------------
+  End implementations for the ShardedAVLMap class.
+  -----------------------------------------------
+*/
+
+/*
+  -------------------------------------------------
+  Begin implementations for the ShardedAVLMap::iterator class.
+  -------------------------------------------------
+*/
+
+/**
+* The end() iterator.
+*/
+template<typename Key, typename Value>
+ShardedAVLMap<Key, Value>::iterator::iterator() :
+    map_(NULL),
+    index_(0)
+{
+
+}
+
+template<typename Key, typename Value>
+ShardedAVLMap<Key, Value>::iterator::iterator(const ShardedAVLMap<Key, Value>* map) :
+    map_(map),
+    index_(0)
+{
+    fill(NULL);
+}
+
+template<typename Key, typename Value>
+typename ShardedAVLMap<Key, Value>::iterator::reference ShardedAVLMap<Key, Value>::iterator::operator*() const
+{
+    return items_[index_];
+}
+
+template<typename Key, typename Value>
+typename ShardedAVLMap<Key, Value>::iterator::pointer ShardedAVLMap<Key, Value>::iterator::operator->() const
+{
+    return &items_[index_];
+}
+
+/**
+* Advances to the next item, fetching the next batch once this one is used up.
+*/
+template<typename Key, typename Value>
+typename ShardedAVLMap<Key, Value>::iterator& ShardedAVLMap<Key, Value>::iterator::operator++()
+{
+    if(++index_ == items_.size()) {
+        Key last = items_.back().first;
+        fill(&last);
+    }
+    return *this;
+}
+
+template<typename Key, typename Value>
+typename ShardedAVLMap<Key, Value>::iterator ShardedAVLMap<Key, Value>::iterator::operator++(int)
+{
+    iterator old(*this);
+    ++(*this);
+    return old;
+}
+
+/**
+* Two iterators are equal if both are at the end, or both are at the same
+* key of the same map.
+*/
+template<typename Key, typename Value>
+bool ShardedAVLMap<Key, Value>::iterator::operator==(const iterator& rhs) const
+{
+    if(map_ == NULL || rhs.map_ == NULL) {
+        return map_ == rhs.map_;
+    }
+    return map_ == rhs.map_ && !(items_[index_].first < rhs.items_[rhs.index_].first)
+           && !(rhs.items_[rhs.index_].first < items_[index_].first);
+}
+
+template<typename Key, typename Value>
+bool ShardedAVLMap<Key, Value>::iterator::operator!=(const iterator& rhs) const
+{
+    return !(*this == rhs);
+}
+
+/**
+* Copies the next BATCH items after the key after points to, or from the
+* start if it is NULL, becoming end() if there are none. It starts in the
+* shard that holds that key and moves to the next shard hand over hand,
+* so no item can cross a cut behind it while it does.
+*/
+template<typename Key, typename Value>
+void ShardedAVLMap<Key, Value>::iterator::fill(const Key* after)
+{
+    items_.clear();
+    index_ = 0;
+    std::size_t shard = 0;
+    if(after != NULL) {
+        shard = map_->lockShardFor(*after);
+    }
+    else {
+        map_->shards_[0]->mutex.lock();
+    }
+    while(true) {
+        Tree& tree = map_->shards_[shard]->tree;
+        typename Tree::iterator it = (after != NULL) ? tree.upper_bound(*after) : tree.begin();
+        for(; it != tree.end() && items_.size() < BATCH; ++it) {
+            items_.push_back(value_type(it->first, it->second));
+        }
+        // keys in later shards are all greater than after
+        after = NULL;
+        if(items_.size() == BATCH || shard + 1 == map_->shards_.size()) {
+            break;
+        }
+        map_->shards_[shard + 1]->mutex.lock();
+        map_->shards_[shard]->mutex.unlock();
+        ++shard;
+    }
+    map_->shards_[shard]->mutex.unlock();
+    if(items_.empty()) {
+        map_ = NULL;
+    }
+}
+
+/*
+  -----------------------------------------------
+  End implementations for the ShardedAVLMap::iterator class.
+  -----------------------------------------------
+*/
+
+#endif
@@ -0,0 +1,18 @@
+#ifndef TEST_CHECK_H
+#define TEST_CHECK_H
+
+#include <iostream>
+#include <cstdlib>
+
+// Stops the test program with the failed condition and its line, so the
+// first difference is the one reported
+#define CHECK(cond)                                                          \
+    do {                                                                     \
+        if(!(cond)) {                                                        \
+            std::cout << __FILE__ << ":" << __LINE__ << ": CHECK(" #cond     \
+                      << ") failed" << std::endl;                            \
+            std::exit(1);                                                    \
+        }                                                                    \
+    } while(0)
+
+#endif
@@ -0,0 +1,596 @@
+#ifndef WORK_STEALING_H
+#define WORK_STEALING_H
+
+#include <cstddef>
+#include <vector>
+#include <deque>
+#include <functional>
+#include <algorithm>
+#include <iterator>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <memory>
+#include <new>
+#include <exception>
+
+/**
+* A fork-join pool whose threads balance the load by stealing. Every
+* participant has its own deque of tasks. It pushes and pops at the back,
+* so it keeps working depth first on the piece it just split off, while an
+* idle participant steals from the front of someone else's deque, which
+* holds the oldest and so the largest piece of work.
+*
+* The thread that creates the pool is participant 0 and runs tasks while
+* it waits in TaskGroup::wait(), so a pool of n threads starts n - 1.
+* Tasks may run and wait on TaskGroups of their own, which is how
+* recursive splits nest. A task that throws does not stop the rest of its
+* group: wait() lets them all finish and then rethrows the first exception
+* to the thread that waits, and so on up through the nested groups.
+*/
+class WorkStealingPool
+{
+public:
+    // Tasks are queued with run(); wait() returns once all have finished,
+    // running queued tasks itself meanwhile
+    class TaskGroup
+    {
+    public:
+        explicit TaskGroup(WorkStealingPool& pool);
+        ~TaskGroup();
+
+        void run(const std::function<void()>& task);
+        void wait();
+
+    private:
+        friend class WorkStealingPool;
+
+        TaskGroup(const TaskGroup& other);
+        TaskGroup& operator=(const TaskGroup& other);
+
+        void finish();
+        void fail(std::exception_ptr error);
+
+        WorkStealingPool& pool_;
+        std::atomic<std::size_t> pending_;
+        // the first exception a task threw, kept for wait() to rethrow
+        std::mutex errorMutex_;
+        std::exception_ptr error_;
+    };
+
+    // 0 threads means one per hardware thread
+    explicit WorkStealingPool(unsigned threads);
+    ~WorkStealingPool();
+
+    unsigned threads() const;
+
+private:
+    WorkStealingPool(const WorkStealingPool& other);
+    WorkStealingPool& operator=(const WorkStealingPool& other);
+
+    struct Task {
+        std::function<void()> fn;
+        TaskGroup* group;
+    };
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+        // keeps neighbouring queues' locks off one cache line
+        char padding[64];
+    };
+    // which pool, if any, the calling thread works for, and as whom
+    struct Participant {
+        const WorkStealingPool* pool;
+        unsigned index;
+    };
+
+    static Participant& current();
+    unsigned self() const;
+    void push(const Task& task);
+    bool runOne(unsigned self);
+    void work(unsigned self);
+
+    std::vector<Queue*> queues_;
+    std::vector<std::thread> workers_;
+    // tasks waiting in any queue; idle workers sleep while it is 0
+    std::atomic<std::size_t> queued_;
+    std::atomic<bool> stop_;
+    std::mutex sleepMutex_;
+    std::condition_variable wake_;
+    // what current() said in the creating thread before this pool
+    Participant previous_;
+};
+
+/*
+  -------------------------------------------------
+  Begin implementations for the WorkStealingPool class.
+  -------------------------------------------------
+*/
+
+inline WorkStealingPool::TaskGroup::TaskGroup(WorkStealingPool& pool) :
+    pool_(pool),
+    pending_(0)
+{
+
+}
+
+/**
+* Destructor, which waits for the group's tasks; they may refer to it. An
+* exception no one waited for is dropped, as the destructor may be running
+* because of another one.
+*/
+inline WorkStealingPool::TaskGroup::~TaskGroup()
+{
+    finish();
+}
+
+inline void WorkStealingPool::TaskGroup::run(const std::function<void()>& task)
+{
+    pending_.fetch_add(1, std::memory_order_relaxed);
+    Task queued = { task, this };
+    pool_.push(queued);
+}
+
+/**
+* Waits for every task run so far, then rethrows the first exception any
+* of them threw. The group can be reused afterwards.
+*/
+inline void WorkStealingPool::TaskGroup::wait()
+{
+    finish();
+    std::exception_ptr error;
+    {
+        std::lock_guard<std::mutex> guard(errorMutex_);
+        std::swap(error, error_);
+    }
+    if(error) {
+        std::rethrow_exception(error);
+    }
+}
+
+// helper function that runs queued tasks until the group's are all done
+inline void WorkStealingPool::TaskGroup::finish()
+{
+    unsigned self = pool_.self();
+    while(pending_.load(std::memory_order_acquire) != 0) {
+        if(!pool_.runOne(self)) {
+            // the last tasks are running elsewhere
+            std::this_thread::yield();
+        }
+    }
+}
+
+// helper function that records what a task threw, keeping only the first
+inline void WorkStealingPool::TaskGroup::fail(std::exception_ptr error)
+{
+    std::lock_guard<std::mutex> guard(errorMutex_);
+    if(!error_) {
+        error_ = error;
+    }
+}
+
+inline WorkStealingPool::WorkStealingPool(unsigned threads) :
+    queued_(0),
+    stop_(false),
+    previous_(current())
+{
+    if(threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    for(unsigned i = 0; i < threads; ++i) {
+        queues_.push_back(new Queue);
+    }
+    Participant creator = { this, 0 };
+    current() = creator;
+    for(unsigned i = 1; i < threads; ++i) {
+        workers_.push_back(std::thread(&WorkStealingPool::work, this, i));
+    }
+}
+
+/**
+* Destructor. Every TaskGroup must have finished.
+*/
+inline WorkStealingPool::~WorkStealingPool()
+{
+    {
+        std::lock_guard<std::mutex> guard(sleepMutex_);
+        stop_.store(true);
+    }
+    wake_.notify_all();
+    for(std::size_t i = 0; i < workers_.size(); ++i) {
+        workers_[i].join();
+    }
+    for(std::size_t i = 0; i < queues_.size(); ++i) {
+        delete queues_[i];
+    }
+    current() = previous_;
+}
+
+inline unsigned WorkStealingPool::threads() const
+{
+    return static_cast<unsigned>(queues_.size());
+}
+
+inline WorkStealingPool::Participant& WorkStealingPool::current()
+{
+    static thread_local Participant participant = { NULL, 0 };
+    return participant;
+}
+
+// helper function that returns the queue of the calling thread; threads
+// outside the pool share the creator's
+inline unsigned WorkStealingPool::self() const
+{
+    const Participant& participant = current();
+    return (participant.pool == this) ? participant.index : 0;
+}
+
+inline void WorkStealingPool::push(const Task& task)
+{
+    Queue& queue = *queues_[self()];
+    // counted first, so the count never runs below what the queues hold
+    queued_.fetch_add(1, std::memory_order_release);
+    {
+        std::lock_guard<std::mutex> guard(queue.mutex);
+        queue.tasks.push_back(task);
+    }
+    // pairs with the check under sleepMutex_ in work(), so no wake-up is lost
+    {
+        std::lock_guard<std::mutex> guard(sleepMutex_);
+    }
+    wake_.notify_one();
+}
+
+/**
+* Runs one task, the newest of the caller's own or else the oldest of the
+* first other queue that has one, and hands anything it throws to its
+* group. Returns false if every queue was empty.
+*/
+inline bool WorkStealingPool::runOne(unsigned self)
+{
+    Task task;
+    bool found = false;
+    for(std::size_t i = 0; i < queues_.size() && !found; ++i) {
+        Queue& queue = *queues_[(self + i) % queues_.size()];
+        std::lock_guard<std::mutex> guard(queue.mutex);
+        if(queue.tasks.empty()) {
+            continue;
+        }
+        if(i == 0) {
+            task = queue.tasks.back();
+            queue.tasks.pop_back();
+        }
+        else {
+            task = queue.tasks.front();
+            queue.tasks.pop_front();
+        }
+        found = true;
+    }
+    if(!found) {
+        return false;
+    }
+    queued_.fetch_sub(1, std::memory_order_relaxed);
+    try {
+        task.fn();
+    }
+    catch(...) {
+        task.group->fail(std::current_exception());
+    }
+    task.group->pending_.fetch_sub(1, std::memory_order_release);
+    return true;
+}
+
+// helper function that is the body of each worker thread
+inline void WorkStealingPool::work(unsigned self)
+{
+    Participant worker = { this, self };
+    current() = worker;
+    while(true) {
+        if(runOne(self)) {
+            continue;
+        }
+        std::unique_lock<std::mutex> guard(sleepMutex_);
+        wake_.wait(guard, [this]() {
+            return stop_.load() || queued_.load(std::memory_order_acquire) != 0;
+        });
+        if(stop_.load()) {
+            return;
+        }
+    }
+}
+
+/*
+  -----------------------------------------------
+  End implementations for the WorkStealingPool class.
+  -----------------------------------------------
+*/
+
+
+/**
+* Merges the sorted ranges [first1, last1) and [first2, last2) into out by
+* moving, on pool. Like std::merge it is stable: of equivalent items, those
+* of the first range come first. Ranges of up to cutoff items in total are
+* merged sequentially; larger ones are split around the middle item of the
+* longer range and its place in the shorter one, and the halves are merged
+* in parallel.
+*/
+template<typename RandomIt, typename OutIt, typename Less>
+void parallelMerge(RandomIt first1, RandomIt last1, RandomIt first2, RandomIt last2, OutIt out,
+                   Less less, WorkStealingPool& pool, std::size_t cutoff)
+{
+    std::size_t count1 = last1 - first1;
+    std::size_t count2 = last2 - first2;
+    if(count1 + count2 <= cutoff) {
+        std::merge(std::make_move_iterator(first1), std::make_move_iterator(last1),
+                   std::make_move_iterator(first2), std::make_move_iterator(last2), out, less);
+        return;
+    }
+    RandomIt mid1;
+    RandomIt mid2;
+    if(count1 >= count2) {
+        mid1 = first1 + count1 / 2;
+        mid2 = std::lower_bound(first2, last2, *mid1, less);
+    }
+    else {
+        mid2 = first2 + count2 / 2;
+        mid1 = std::upper_bound(first1, last1, *mid2, less);
+    }
+    OutIt outMid = out + (mid1 - first1) + (mid2 - first2);
+    WorkStealingPool::TaskGroup group(pool);
+    group.run([=, &pool]() {
+        parallelMerge(first1, mid1, first2, mid2, out, less, pool, cutoff);
+    });
+    parallelMerge(mid1, last1, mid2, last2, outMid, less, pool, cutoff);
+    group.wait();
+}
+
+/**
+* Returns how many of the first k items of the stable merge of the sorted
+* ranges [first1, first1 + count1) and [first2, first2 + count2) come from
+* the first range, found by a binary search in O(log k).
+*/
+template<typename RandomIt, typename Less>
+std::size_t mergeSplit(RandomIt first1, std::size_t count1, RandomIt first2, std::size_t count2,
+                       std::size_t k, Less less)
+{
+    std::size_t lo = (k > count2) ? k - count2 : 0;
+    std::size_t hi = std::min(k, count1);
+    while(lo < hi) {
+        std::size_t i = lo + (hi - lo) / 2;
+        // the merge takes first1[i] before first2[k - i - 1] unless the
+        // latter is strictly less
+        if(less(first2[k - i - 1], first1[i])) {
+            hi = i;
+        }
+        else {
+            lo = i + 1;
+        }
+    }
+    return lo;
+}
+
+/**
+* Merges the neighbouring sorted runs [first, mid) and [mid, last) in
+* place, stably, on pool, with room for mid - first items at buffer. The
+* first mid - first items of the result are merged into buffer. That
+* leaves as many free places in front of the rest of the second run as
+* items of the first run remain, so the next that many items can be merged
+* straight into them, and so on; every round is a parallelMerge(). Rounds
+* that would merge no more than cutoff items finish sequentially instead.
+*/
+template<typename RandomIt, typename Less>
+void parallelMergeAdjacent(RandomIt first, RandomIt mid, RandomIt last, RandomIt buffer, Less less,
+                           WorkStealingPool& pool, std::size_t cutoff)
+{
+    std::size_t head = mid - first;
+    std::size_t taken = mergeSplit(first, head, mid, last - mid, head, less);
+    parallelMerge(first, first + taken, mid, mid + (head - taken), buffer, less, pool, cutoff);
+    // [rest1, mid) and [rest2, last) are left to merge into out, and
+    // [out, rest2) has one free place for every item of [rest1, mid)
+    RandomIt rest1 = first + taken;
+    RandomIt rest2 = mid + (head - taken);
+    RandomIt out = mid;
+    while(rest1 != mid && rest2 != last) {
+        std::size_t count = mid - rest1;
+        if(count <= cutoff) {
+            // writing never overtakes reading, as there is always a free place
+            while(rest1 != mid && rest2 != last) {
+                if(less(*rest2, *rest1)) {
+                    *out = std::move(*rest2);
+                    ++rest2;
+                }
+                else {
+                    *out = std::move(*rest1);
+                    ++rest1;
+                }
+                ++out;
+            }
+            break;
+        }
+        std::size_t from1 = mergeSplit(rest1, count, rest2, last - rest2, count, less);
+        parallelMerge(rest1, rest1 + from1, rest2, rest2 + (count - from1), out, less, pool, cutoff);
+        rest1 += from1;
+        rest2 += count - from1;
+        out += count;
+    }
+    // what is left of the second run is already in place
+    std::move(rest1, mid, out);
+    // move the merged head back, in cutoff-sized pieces
+    WorkStealingPool::TaskGroup group(pool);
+    for(std::size_t start = 0; start < head; start += cutoff) {
+        std::size_t end = std::min(head, start + cutoff);
+        group.run([=]() {
+            std::move(buffer + start, buffer + end, first + start);
+        });
+    }
+    group.wait();
+}
+
+/**
+* Sorts [first, last) stably on pool, using [scratch, scratch + (last -
+* first) / 2) as working space. The halves are sorted in parallel down to
+* cutoff items, which std::stable_sort handles, and merged in place with
+* parallelMergeAdjacent().
+*/
+template<typename RandomIt, typename Less>
+void parallelStableSort(RandomIt first, RandomIt last, RandomIt scratch, Less less,
+                        WorkStealingPool& pool, std::size_t cutoff)
+{
+    std::size_t count = last - first;
+    if(count <= cutoff) {
+        std::stable_sort(first, last, less);
+        return;
+    }
+    std::size_t half = count / 2;
+    RandomIt mid = first + half;
+    {
+        // each half needs half its own length, which together fits
+        WorkStealingPool::TaskGroup group(pool);
+        group.run([=, &pool]() {
+            parallelStableSort(first, mid, scratch, less, pool, cutoff);
+        });
+        parallelStableSort(mid, last, scratch + half / 2, less, pool, cutoff);
+        group.wait();
+    }
+    parallelMergeAdjacent(first, mid, last, scratch, less, pool, cutoff);
+}
+
+/**
+* Hands the last item of every run of equivalent items in the sorted range
+* [first, last) to place, on pool, and returns how many it handed over.
+* Keeping the last matches inserting the items one at a time, where a
+* repeated key takes the newer value. Works in pieces of cutoff items: one
+* parallel pass counts what each piece keeps, reserve(total) is called
+* with the sum, and a second pass calls place(i, item) for the i-th kept
+* item, with pieces running in parallel.
+*/
+template<typename RandomIt, typename Less, typename Reserve, typename Place>
+std::size_t parallelUniqueLast(RandomIt first, RandomIt last, Less less, Reserve reserve, Place place,
+                               WorkStealingPool& pool, std::size_t cutoff)
+{
+    std::size_t count = last - first;
+    std::size_t pieces = (count + cutoff - 1) / cutoff;
+    // offsets[i] is the index of the first item piece i keeps once the
+    // counts are summed
+    std::vector<std::size_t> offsets(pieces + 1, 0);
+    {
+        WorkStealingPool::TaskGroup group(pool);
+        for(std::size_t piece = 0; piece < pieces; ++piece) {
+            group.run([=, &offsets]() {
+                std::size_t end = std::min(count, (piece + 1) * cutoff);
+                std::size_t kept = 0;
+                for(std::size_t i = piece * cutoff; i < end; ++i) {
+                    if(i + 1 == count || less(first[i], first[i + 1])) {
+                        ++kept;
+                    }
+                }
+                offsets[piece + 1] = kept;
+            });
+        }
+        group.wait();
+    }
+    for(std::size_t piece = 0; piece < pieces; ++piece) {
+        offsets[piece + 1] += offsets[piece];
+    }
+    reserve(offsets[pieces]);
+    WorkStealingPool::TaskGroup group(pool);
+    for(std::size_t piece = 0; piece < pieces; ++piece) {
+        group.run([=, &offsets, &place]() {
+            std::size_t end = std::min(count, (piece + 1) * cutoff);
+            std::size_t next = offsets[piece];
+            for(std::size_t i = piece * cutoff; i < end; ++i) {
+                if(i + 1 == count || less(first[i], first[i + 1])) {
+                    place(next, first[i]);
+                    ++next;
+                }
+            }
+        });
+    }
+    group.wait();
+    return offsets[pieces];
+}
+
+/**
+* An array of count copies of the items from first, constructed in
+* parallel on pool in pieces of cutoff items and destroyed with the
+* array. It only needs the items to be copy constructible, where a
+* std::vector filled in parallel would need them default constructible
+* as well. A plain forward iterator is walked once to find the pieces. If
+* a copy throws, the copies already made are destroyed and the exception
+* is passed on.
+*/
+template<typename T>
+class ParallelArray
+{
+public:
+    template<typename ForwardIt>
+    ParallelArray(ForwardIt first, std::size_t count, WorkStealingPool& pool, std::size_t cutoff);
+    ~ParallelArray();
+
+    T* begin() const;
+    T* end() const;
+
+private:
+    ParallelArray(const ParallelArray& other);
+    ParallelArray& operator=(const ParallelArray& other);
+
+    T* items_;
+    std::size_t count_;
+};
+
+template<typename T>
+template<typename ForwardIt>
+ParallelArray<T>::ParallelArray(ForwardIt first, std::size_t count, WorkStealingPool& pool, std::size_t cutoff) :
+    items_(static_cast<T*>(::operator new(count * sizeof(T)))),
+    count_(count)
+{
+    // a piece that throws has already destroyed its own copies
+    std::vector<char> copied((count + cutoff - 1) / cutoff, 0);
+    try {
+        WorkStealingPool::TaskGroup group(pool);
+        for(std::size_t start = 0; start < count; start += cutoff) {
+            std::size_t pieceCount = std::min(cutoff, count - start);
+            T* out = items_ + start;
+            char* done = &copied[start / cutoff];
+            group.run([=]() {
+                std::uninitialized_copy_n(first, pieceCount, out);
+                *done = 1;
+            });
+            std::advance(first, pieceCount);
+        }
+        group.wait();
+    }
+    catch(...) {
+        for(std::size_t i = 0; i < count; ++i) {
+            if(copied[i / cutoff]) {
+                items_[i].~T();
+            }
+        }
+        ::operator delete(items_);
+        throw;
+    }
+}
+
+template<typename T>
+ParallelArray<T>::~ParallelArray()
+{
+    for(std::size_t i = 0; i < count_; ++i) {
+        items_[i].~T();
+    }
+    ::operator delete(items_);
+}
+
+template<typename T>
+T* ParallelArray<T>::begin() const
+{
+    return items_;
+}
+
+template<typename T>
+T* ParallelArray<T>::end() const
+{
+    return items_ + count_;
+}
+
+#endif